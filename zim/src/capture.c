@@ -0,0 +1,420 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include "capture.h"
+#include "filter.h"
+#include "pool.h"
+#include "spsc.h"
+#include "placement.h"
+#include "utils.h"
+
+// Re-read kernel drop counters this often (in received packets or timeouts)
+#define CAPTURE_DROP_POLL 1024
+
+// One capture source: a socket, its thread, its descriptor pool and a
+// single-producer/single-consumer queue of packets waiting to be merged.
+typedef struct {
+    char name[MAX_INTERFACE_LEN];
+    int sock_fd;
+    pthread_t thread;
+    int thread_running;
+    int index;
+    PacketPool *pool;
+    SpscQueue queue;
+    atomic_ulong drops;     // Kernel and pool-exhausted drops not yet collected
+    atomic_ulong overruns;  // Pool-exhausted drops since the start
+    atomic_ulong errors;    // Receive errors not yet collected
+    atomic_int stopped;     // The thread gave up on the interface
+    
+    // Merging side: the batch last taken off the queue
+    void *batch[CAPTURE_BATCH];
+    unsigned int batch_count;
+    unsigned int batch_next;
+    
+    // Kernel filter in force: its generation (0 if none) and the time it
+    // took effect. since is written before generation and read after it.
+    atomic_ulong filter_generation;
+    atomic_ullong filter_since;       // Microseconds since the epoch
+} CaptureSource;
+
+static CaptureSource sources[MAX_INTERFACES];
+static int source_count = 0;
+static atomic_int capturing = 0;
+
+// Packets released while an interface was idle: after the reorder window,
+// or early because their interface was running out of descriptors
+static atomic_ulong reorder_waited = 0;
+static atomic_ulong reorder_forced = 0;
+
+// Split "eth0,eth1" into names; "any" expands to every interface that is up
+int capture_parse_interfaces(const char *list, char names[][MAX_INTERFACE_LEN], int max) {
+    char buffer[MAX_INTERFACE_LIST_LEN];
+    int count = 0;
+    
+    if (strcmp(list, "any") == 0) {
+        return find_all_interfaces(names, max);
+    }
+    
+    strncpy(buffer, list, sizeof(buffer) - 1);
+    buffer[sizeof(buffer) - 1] = '\0';
+    
+    char *saveptr = NULL;
+    for (char *name = strtok_r(buffer, ",", &saveptr); name != NULL;
+         name = strtok_r(NULL, ",", &saveptr)) {
+        if (count == max) {
+            fprintf(stderr, "Too many interfaces (max %d)\n", max);
+            return -1;
+        }
+        strncpy(names[count], name, MAX_INTERFACE_LEN - 1);
+        names[count][MAX_INTERFACE_LEN - 1] = '\0';
+        count++;
+    }
+    
+    return count;
+}
+
+// Replace the kernel filter on one socket. The socket is never without
+// a filter, so nothing is lost or leaked while it changes. If the new
+// program cannot be attached the old one comes off too, or it would keep
+// dropping packets the new expression accepts; every packet is then
+// checked in user space.
+static void attach_filter(CaptureSource *source, const FilterProgram *program) {
+    struct timeval now;
+    
+    if (apply_filter(source->sock_fd, program) != 0) {
+        fprintf(stderr, "Filtering %s in user space only\n", source->name);
+        atomic_store(&source->filter_generation, 0);
+        if (remove_filter(source->sock_fd) != 0) {
+            fprintf(stderr, "Cannot remove the old filter on %s\n", source->name);
+        }
+        return;
+    }
+    
+    gettimeofday(&now, NULL);
+    atomic_store(&source->filter_since, (unsigned long long)now.tv_sec * 1000000 + now.tv_usec);
+    atomic_store(&source->filter_generation, program->generation);
+}
+
+// Tag a packet with the kernel filter that admitted it. Packets the
+// kernel stamped before the latest swap completed may have passed the
+// previous filter, so they are tagged as unknown (re-checked by the caller).
+static void tag_filter(CaptureSource *source, Packet *packet) {
+    unsigned long generation = atomic_load(&source->filter_generation);
+    unsigned long long since = atomic_load(&source->filter_since);
+    unsigned long long stamp = (unsigned long long)packet->timestamp.tv_sec * 1000000 +
+                               packet->timestamp.tv_usec;
+    
+    packet->filter_generation = stamp >= since ? generation : 0;
+}
+
+// Errors after which the interface is gone for good
+static int capture_fatal(int error) {
+    return error == ENODEV || error == ENXIO || error == EBADF;
+}
+
+// Count a failed receive and pause before the next one, so an interface
+// that keeps failing neither spins nor floods the terminal: only the
+// first error of a run is reported. Returns -1 when capture on the
+// interface should stop.
+static int capture_failed(CaptureSource *source, int error, unsigned int *failures) {
+    atomic_fetch_add(&source->errors, 1);
+    
+    if (capture_fatal(error)) {
+        fprintf(stderr, "Stopped capture on %s: %s\n", source->name, strerror(error));
+        return -1;
+    }
+    if ((*failures)++ == 0) {
+        fprintf(stderr, "Capture on %s failing: %s\n", source->name, strerror(error));
+    }
+    
+    unsigned long pause = CAPTURE_BACKOFF_USEC;
+    for (unsigned int i = 1; i < *failures && pause < CAPTURE_BACKOFF_MAX_USEC; i++) {
+        pause *= 2;
+    }
+    usleep(pause < CAPTURE_BACKOFF_MAX_USEC ? pause : CAPTURE_BACKOFF_MAX_USEC);
+    return 0;
+}
+
+static void *capture_thread(void *arg) {
+    CaptureSource *source = arg;
+    Packet *overflow = malloc(sizeof(Packet));
+    void *batch[CAPTURE_BATCH];
+    unsigned int count = 0;
+    unsigned int failures = 0;
+    unsigned long polls = 0;
+    
+    if (overflow == NULL) {
+        perror("malloc");
+        return NULL;
+    }
+    
+    while (atomic_load(&capturing)) {
+        // When every descriptor is in use keep draining the socket but
+        // drop the packet
+        Packet *slot = pool_get(source->pool);
+        
+        // Only block with nothing held back, so a batch is never delayed
+        int flags = count > 0 ? MSG_DONTWAIT : 0;
+        int size = capture_packet(source->sock_fd, slot != NULL ? slot : overflow, flags);
+        int error = errno;
+        
+        if (size > 0 && slot != NULL) {
+            slot->if_index = source->index;
+            tag_filter(source, slot);
+            batch[count++] = slot;
+        } else {
+            if (slot != NULL) {
+                pool_put(source->pool, slot);
+            } else if (size > 0) {
+                atomic_fetch_add(&source->drops, 1);
+                atomic_fetch_add(&source->overruns, 1);
+            }
+        }
+        
+        // Hand over a full batch, or whatever is held once the socket runs
+        // dry. The queue holds the whole pool, so the push always fits.
+        if (count == CAPTURE_BATCH || (count > 0 && size <= 0)) {
+            spsc_push(&source->queue, batch, count);
+            count = 0;
+        }
+        
+        if (++polls % CAPTURE_DROP_POLL == 0 || (size == 0 && flags == 0)) {
+            atomic_fetch_add(&source->drops, get_socket_drops(source->sock_fd));
+        }
+        
+        if (size < 0) {
+            if (capture_failed(source, error, &failures) != 0) {
+                break;
+            }
+        } else if (size > 0 && failures > 0) {
+            fprintf(stderr, "Capture on %s resumed after %u errors\n", source->name, failures);
+            failures = 0;
+        }
+    }
+    
+    spsc_push(&source->queue, batch, count);
+    atomic_store(&source->stopped, 1);
+    free(overflow);
+    return NULL;
+}
+
+int capture_start(char names[][MAX_INTERFACE_LEN], int count, int promiscuous, int busy_poll_usec) {
+    struct timeval timeout = {0, 100000};  // 100ms, so threads notice shutdown
+    
+    atomic_store(&capturing, 1);
+    
+    for (int i = 0; i < count; i++) {
+        CaptureSource *source = &sources[i];
+        
+        memset(source, 0, sizeof(*source));
+        strncpy(source->name, names[i], MAX_INTERFACE_LEN - 1);
+        source->index = i;
+        
+        source->sock_fd = create_raw_socket(source->name, promiscuous, busy_poll_usec);
+        if (source->sock_fd < 0) {
+            fprintf(stderr, "Error: Failed to open capture on %s\n", source->name);
+            capture_stop();
+            return -1;
+        }
+        source_count = i + 1;
+        
+        setsockopt(source->sock_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        attach_filter(source, filter_current());
+        
+        // Descriptors and queue on the interface's node with -N
+        source->pool = pool_create(CAPTURE_POOL_SIZE, placement_node(i));
+        if (source->pool == NULL ||
+            spsc_init(&source->queue, CAPTURE_POOL_SIZE, placement_node(i)) != 0) {
+            capture_stop();
+            return -1;
+        }
+        
+        char name[MAX_INTERFACE_LEN + 8];
+        pthread_attr_t attr;
+        snprintf(name, sizeof(name), "capture %.*s", MAX_INTERFACE_LEN - 1, source->name);
+        placement_thread_attr(&attr, name);
+        int started = pthread_create(&source->thread, &attr, capture_thread, source);
+        pthread_attr_destroy(&attr);
+        if (started != 0) {
+            fprintf(stderr, "Error: Failed to start capture thread for %s\n", source->name);
+            capture_stop();
+            return -1;
+        }
+        source->thread_running = 1;
+    }
+    
+    return 0;
+}
+
+// Stop the capture threads but keep what they queued; capture_next()
+// then hands out the rest without waiting on the reorder window
+void capture_quiesce(void) {
+    atomic_store(&capturing, 0);
+    
+    for (int i = 0; i < source_count; i++) {
+        if (sources[i].thread_running) {
+            pthread_join(sources[i].thread, NULL);
+            sources[i].thread_running = 0;
+        }
+    }
+}
+
+
+void capture_stop(void) {
+    capture_quiesce();
+    
+    for (int i = 0; i < source_count; i++) {
+        CaptureSource *source = &sources[i];
+        
+        // The pipeline has stopped, so no stage still holds a descriptor
+        spsc_free(&source->queue);
+        pool_destroy(source->pool);
+        source->pool = NULL;
+        if (source->sock_fd >= 0) {
+            close(source->sock_fd);
+            source->sock_fd = -1;
+        }
+    }
+    
+    source_count = 0;
+}
+
+// Oldest packet of a source, taking a new batch off its queue as needed
+static Packet *source_head(CaptureSource *source) {
+    if (source->batch_next == source->batch_count) {
+        source->batch_count = spsc_pop(&source->queue, source->batch, CAPTURE_BATCH);
+        source->batch_next = 0;
+        if (source->batch_count == 0) {
+            return NULL;
+        }
+    }
+    
+    return source->batch[source->batch_next];
+}
+
+// K-way merge over the queue heads. k is at most MAX_INTERFACES, so a
+// linear scan for the oldest head beats maintaining a heap. The caller
+// owns the returned packet and hands it back with pool_release().
+Packet *capture_next(void) {
+    CaptureSource *from = NULL;
+    Packet *oldest = NULL;
+    int idle = 0;
+    int pressed = 0;
+    
+    for (int i = 0; i < source_count; i++) {
+        // Read before the queue: a thread flags itself after its last push
+        int stopped = atomic_load(&sources[i].stopped);
+        Packet *candidate = source_head(&sources[i]);
+        
+        if (candidate == NULL) {
+            // A stopped interface has nothing more to deliver
+            idle |= !stopped;
+            continue;
+        }
+        
+        if (oldest == NULL || timercmp(&candidate->timestamp, &oldest->timestamp, <)) {
+            oldest = candidate;
+            from = &sources[i];
+        }
+        pressed |= atomic_load(&sources[i].pool->in_use) >= CAPTURE_REORDER_HOLD;
+    }
+    
+    if (oldest == NULL) {
+        return NULL;
+    }
+    
+    // An idle interface may still deliver something older; hold the
+    // candidate until it falls out of the reorder window. The window is
+    // also bounded by count: a busy interface would otherwise run out of
+    // descriptors waiting on a quiet one, so once any interface with
+    // packets held has half its pool in use the oldest goes out at once.
+    if (idle && atomic_load(&capturing)) {
+        struct timeval now, age;
+        gettimeofday(&now, NULL);
+        timersub(&now, &oldest->timestamp, &age);
+        if (age.tv_sec == 0 && age.tv_usec < CAPTURE_REORDER_USEC) {
+            if (!pressed) {
+                return NULL;
+            }
+            atomic_fetch_add(&reorder_forced, 1);
+        } else {
+            atomic_fetch_add(&reorder_waited, 1);
+        }
+    }
+    
+    from->batch_next++;
+    return oldest;
+}
+
+// Swap every socket over to a newly published filter
+void capture_apply_filter(const FilterProgram *program) {
+    for (int i = 0; i < source_count; i++) {
+        attach_filter(&sources[i], program);
+    }
+}
+
+// Drops on one interface since the previous call
+unsigned long capture_take_drops(int index) {
+    return atomic_exchange(&sources[index].drops, 0);
+}
+
+// Receive errors on one interface since the previous call
+unsigned long capture_take_errors(int index) {
+    return atomic_exchange(&sources[index].errors, 0);
+}
+
+// Share of the fullest pool's descriptors in use anywhere in the
+// pipeline, 0.0 to 1.0. At 1.0 that interface drops packets.
+double capture_occupancy(void) {
+    unsigned long worst = 0;
+    
+    for (int i = 0; i < source_count; i++) {
+        unsigned long used = atomic_load(&sources[i].pool->in_use);
+        if (used > worst) {
+            worst = used;
+        }
+    }
+    
+    return (double)worst / CAPTURE_POOL_SIZE;
+}
+
+// Packets waiting in the deepest interface queue
+unsigned long capture_queue_depth(void) {
+    unsigned long worst = 0;
+    
+    for (int i = 0; i < source_count; i++) {
+        unsigned long depth = spsc_depth(&sources[i].queue);
+        if (depth > worst) {
+            worst = depth;
+        }
+    }
+    
+    return worst;
+}
+
+// Packets dropped because every descriptor was in use
+unsigned long capture_overruns(void) {
+    unsigned long total = 0;
+    
+    for (int i = 0; i < source_count; i++) {
+        total += atomic_load(&sources[i].overruns);
+    }
+    
+    return total;
+}
+
+// Packets held for the whole reorder window
+unsigned long capture_reorder_waited(void) {
+    return atomic_load(&reorder_waited);
+}
+
+// Packets released before the window ended to free descriptors
+unsigned long capture_reorder_forced(void) {
+    return atomic_load(&reorder_forced);
+}
@@ -0,0 +1,29 @@
+#ifndef ZIM_CAPTURE_H
+#define ZIM_CAPTURE_H
+
+#include "network.h"
+#include "config.h"
+
+#define CAPTURE_POOL_SIZE 256        // Packet descriptors per interface
+#define CAPTURE_BATCH 32             // Packets handed over at a time
+#define CAPTURE_REORDER_USEC 50000   // How long to wait for a late interface
+#define CAPTURE_REORDER_HOLD (CAPTURE_POOL_SIZE / 2)  // Or until this many descriptors are in use
+#define CAPTURE_BACKOFF_USEC 1000     // First pause after a receive error
+#define CAPTURE_BACKOFF_MAX_USEC 100000  // Pauses double up to this
+
+// Function prototypes
+int capture_parse_interfaces(const char *list, char names[][MAX_INTERFACE_LEN], int max);
+int capture_start(char names[][MAX_INTERFACE_LEN], int count, int promiscuous, int busy_poll_usec);
+void capture_stop(void);
+void capture_quiesce(void);
+void capture_apply_filter(const FilterProgram *program);
+Packet *capture_next(void);
+unsigned long capture_take_drops(int index);
+unsigned long capture_take_errors(int index);
+double capture_occupancy(void);
+unsigned long capture_queue_depth(void);
+unsigned long capture_overruns(void);
+unsigned long capture_reorder_waited(void);
+unsigned long capture_reorder_forced(void);
+
+#endif // ZIM_CAPTURE_H
@@ -0,0 +1,474 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "compress.h"
+#ifdef ZIM_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+// LZ4 block format limits
+#define LZ4_HASH_BITS 12
+#define LZ4_MIN_MATCH 4
+#define LZ4_LAST_LITERALS 5  // The block always ends with this many literals
+#define LZ4_MATCH_LIMIT 12   // ...and the last match starts this far from the end
+#define LZ4_MAX_OFFSET 65535
+#define LZ4_SKIP_TRIGGER 6   // Step faster through data that does not compress
+
+// LZ4 frame: magic, FLG, BD, content size, header checksum, one data
+// block (size word, data), end mark
+#define LZ4_FLG 0x68          // Version 1, independent blocks, content size
+#define LZ4_BD 0x50           // 256 KB maximum block size
+#define LZ4_HEADER_SIZE 15
+#define LZ4_UNCOMPRESSED 0x80000000U
+#define LZ4_FRAME_OVERHEAD (LZ4_HEADER_SIZE + 4 + 4)
+
+static uint32_t read32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint64_t read64(const uint8_t *p) {
+    return read32(p) | ((uint64_t)read32(p + 4) << 32);
+}
+
+static void write32(uint8_t *p, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        p[i] = value >> (i * 8);
+    }
+}
+
+static void write64(uint8_t *p, uint64_t value) {
+    write32(p, value);
+    write32(p + 4, value >> 32);
+}
+
+static uint32_t rotl32(uint32_t value, int bits) {
+    return (value << bits) | (value >> (32 - bits));
+}
+
+// xxHash32 for inputs under 16 bytes, which covers the frame descriptor
+static uint32_t xxh32_short(const uint8_t *p, size_t length) {
+    uint32_t hash = 374761393U + (uint32_t)length;
+    size_t i = 0;
+    
+    for (; i + 4 <= length; i += 4) {
+        hash += read32(p + i) * 3266489917U;
+        hash = rotl32(hash, 17) * 668265263U;
+    }
+    for (; i < length; i++) {
+        hash += p[i] * 374761393U;
+        hash = rotl32(hash, 11) * 2654435761U;
+    }
+    
+    hash ^= hash >> 15;
+    hash *= 2246822519U;
+    hash ^= hash >> 13;
+    hash *= 3266489917U;
+    hash ^= hash >> 16;
+    return hash;
+}
+
+static uint32_t lz4_hash(uint32_t sequence) {
+    return (sequence * 2654435761U) >> (32 - LZ4_HASH_BITS);
+}
+
+static uint8_t *put_length(uint8_t *out, size_t length) {
+    while (length >= 255) {
+        *out++ = 255;
+        length -= 255;
+    }
+    *out++ = length;
+    return out;
+}
+
+// Emit one sequence: literals, then a match unless it is the last one.
+// Returns NULL when the output would not fit.
+static uint8_t *put_sequence(uint8_t *out, uint8_t *end, const uint8_t *literals,
+                             size_t literal_length, size_t offset, size_t match_length) {
+    size_t needed = 1 + literal_length + literal_length / 255 + 1 +
+                    (offset > 0 ? 2 + match_length / 255 + 1 : 0);
+    
+    if ((size_t)(end - out) < needed) {
+        return NULL;
+    }
+    
+    uint8_t *token = out++;
+    *token = (literal_length < 15 ? literal_length : 15) << 4;
+    if (literal_length >= 15) {
+        out = put_length(out, literal_length - 15);
+    }
+    memcpy(out, literals, literal_length);
+    out += literal_length;
+    
+    if (offset > 0) {
+        match_length -= LZ4_MIN_MATCH;
+        *token |= match_length < 15 ? match_length : 15;
+        *out++ = offset;
+        *out++ = offset >> 8;
+        if (match_length >= 15) {
+            out = put_length(out, match_length - 15);
+        }
+    }
+    
+    return out;
+}
+
+// Greedy single-pass LZ4 block compressor. Returns 0 when the result
+// would not fit, in which case the block is stored uncompressed.
+static size_t lz4_compress(uint32_t *table, const uint8_t *src, size_t size,
+                           uint8_t *dst, size_t capacity) {
+    uint8_t *out = dst, *end = dst + capacity;
+    size_t anchor = 0, pos = 0;
+    unsigned int misses = 0;
+    
+    memset(table, 0, sizeof(uint32_t) << LZ4_HASH_BITS);
+    
+    while (pos + LZ4_MATCH_LIMIT <= size) {
+        uint32_t sequence = read32(src + pos);
+        uint32_t hash = lz4_hash(sequence);
+        size_t candidate = table[hash];
+        
+        table[hash] = pos;
+        if (candidate >= pos || pos - candidate > LZ4_MAX_OFFSET ||
+            read32(src + candidate) != sequence) {
+            pos += 1 + (misses++ >> LZ4_SKIP_TRIGGER);
+            continue;
+        }
+        misses = 0;
+        
+        // Grow the match backwards into the pending literals, then forwards
+        while (pos > anchor && candidate > 0 && src[pos - 1] == src[candidate - 1]) {
+            pos--;
+            candidate--;
+        }
+        size_t length = LZ4_MIN_MATCH;
+        while (pos + length < size - LZ4_LAST_LITERALS && src[candidate + length] == src[pos + length]) {
+            length++;
+        }
+        
+        out = put_sequence(out, end, src + anchor, pos - anchor, pos - candidate, length);
+        if (out == NULL) {
+            return 0;
+        }
+        pos += length;
+        anchor = pos;
+        if (pos >= 2 && pos + LZ4_MATCH_LIMIT <= size) {
+            table[lz4_hash(read32(src + pos - 2))] = pos - 2;
+        }
+    }
+    
+    out = put_sequence(out, end, src + anchor, size - anchor, 0, 0);
+    return out == NULL ? 0 : (size_t)(out - dst);
+}
+
+static long lz4_decompress(const uint8_t *src, size_t size, uint8_t *dst, size_t capacity) {
+    const uint8_t *in = src, *in_end = src + size;
+    uint8_t *out = dst, *out_end = dst + capacity;
+    
+    while (in < in_end) {
+        unsigned int token = *in++;
+        size_t length = token >> 4;
+        
+        if (length == 15) {
+            unsigned int byte;
+            do {
+                if (in >= in_end) {
+                    return -1;
+                }
+                byte = *in++;
+                length += byte;
+            } while (byte == 255);
+        }
+        if ((size_t)(in_end - in) < length || (size_t)(out_end - out) < length) {
+            return -1;
+        }
+        memcpy(out, in, length);
+        in += length;
+        out += length;
+        
+        // The last sequence has literals only
+        if (in == in_end) {
+            break;
+        }
+        if (in_end - in < 2) {
+            return -1;
+        }
+        size_t offset = in[0] | (in[1] << 8);
+        in += 2;
+        if (offset == 0 || offset > (size_t)(out - dst)) {
+            return -1;
+        }
+        
+        length = token & 15;
+        if (length == 15) {
+            unsigned int byte;
+            do {
+                if (in >= in_end) {
+                    return -1;
+                }
+                byte = *in++;
+                length += byte;
+            } while (byte == 255);
+        }
+        length += LZ4_MIN_MATCH;
+        if ((size_t)(out_end - out) < length) {
+            return -1;
+        }
+        
+        // Matches may overlap their own output (runs)
+        const uint8_t *match = out - offset;
+        if (offset >= length) {
+            memcpy(out, match, length);
+        } else {
+            for (size_t i = 0; i < length; i++) {
+                out[i] = match[i];
+            }
+        }
+        out += length;
+    }
+    
+    return out - dst;
+}
+
+static size_t lz4_frame(uint32_t *table, const uint8_t *data, size_t size,
+                        uint8_t *frame, size_t capacity) {
+    if (capacity < size + LZ4_FRAME_OVERHEAD) {
+        return 0;
+    }
+    
+    write32(frame, COMPRESS_LZ4_MAGIC);
+    frame[4] = LZ4_FLG;
+    frame[5] = LZ4_BD;
+    write64(frame + 6, size);
+    frame[14] = xxh32_short(frame + 4, 10) >> 8;
+    
+    // Keep the block raw unless compressing actually saves space
+    uint8_t *block = frame + LZ4_HEADER_SIZE;
+    if (size == 0) {
+        write32(block, 0);
+        return LZ4_HEADER_SIZE + 4;
+    }
+    size_t compressed = lz4_compress(table, data, size, block + 4, size - 1);
+    if (compressed > 0) {
+        write32(block, compressed);
+    } else {
+        memcpy(block + 4, data, size);
+        compressed = size;
+        write32(block, compressed | LZ4_UNCOMPRESSED);
+    }
+    write32(block + 4 + compressed, 0);
+    
+    return LZ4_HEADER_SIZE + 4 + compressed + 4;
+}
+
+// Walk a frame written by lz4_frame (or any LZ4 frame with a content
+// size and no checksums)
+static int lz4_frame_info(const uint8_t *frame, size_t available,
+                          uint64_t *frame_size, uint64_t *raw_size) {
+    size_t header = 7;
+    
+    if (available < header || read32(frame) != COMPRESS_LZ4_MAGIC) {
+        return -1;
+    }
+    
+    int flags = frame[4];
+    if ((flags >> 6) != 1 || !(flags & 0x20) || !(flags & 0x08) || (flags & 0x15)) {
+        return -1;
+    }
+    header += 8;
+    if (available < header || ((xxh32_short(frame + 4, header - 5) >> 8) & 0xff) != frame[header - 1]) {
+        return -1;
+    }
+    *raw_size = read64(frame + 6);
+    
+    size_t offset = header;
+    for (;;) {
+        if (available - offset < 4) {
+            return -1;
+        }
+        uint32_t block = read32(frame + offset) & ~LZ4_UNCOMPRESSED;
+        offset += 4;
+        if (block == 0) {
+            break;
+        }
+        if (available - offset < block) {
+            return -1;
+        }
+        offset += block;
+    }
+    
+    *frame_size = offset;
+    return 0;
+}
+
+static long lz4_decode(const uint8_t *frame, size_t size, uint8_t *data, size_t capacity) {
+    uint64_t frame_size, raw_size;
+    size_t offset = LZ4_HEADER_SIZE, produced = 0;
+    
+    if (lz4_frame_info(frame, size, &frame_size, &raw_size) != 0 || raw_size > capacity) {
+        return -1;
+    }
+    
+    for (;;) {
+        uint32_t word = read32(frame + offset);
+        uint32_t block = word & ~LZ4_UNCOMPRESSED;
+        long length;
+        
+        offset += 4;
+        if (block == 0) {
+            break;
+        }
+        if (word & LZ4_UNCOMPRESSED) {
+            if (block > raw_size - produced) {
+                return -1;
+            }
+            memcpy(data + produced, frame + offset, block);
+            length = block;
+        } else {
+            length = lz4_decompress(frame + offset, block, data + produced, raw_size - produced);
+            if (length < 0) {
+                return -1;
+            }
+        }
+        produced += length;
+        offset += block;
+    }
+    
+    return produced == raw_size ? (long)produced : -1;
+}
+
+int compressor_init(Compressor *compressor, int codec) {
+    compressor->codec = codec;
+    compressor->state = NULL;
+    
+    switch (codec) {
+        case COMPRESS_LZ4:
+            compressor->state = malloc(sizeof(uint32_t) << LZ4_HASH_BITS);
+            break;
+#ifdef ZIM_HAVE_ZSTD
+        case COMPRESS_ZSTD:
+            compressor->state = ZSTD_createCCtx();
+            break;
+#endif
+        default:
+            return -1;
+    }
+    
+    return compressor->state != NULL ? 0 : -1;
+}
+
+void compressor_free(Compressor *compressor) {
+#ifdef ZIM_HAVE_ZSTD
+    if (compressor->codec == COMPRESS_ZSTD) {
+        ZSTD_freeCCtx(compressor->state);
+        compressor->state = NULL;
+    }
+#endif
+    free(compressor->state);
+    compressor->state = NULL;
+}
+
+// Compress one block into a self-contained frame. Returns the frame size,
+// or 0 if it does not fit in capacity (see compress_bound).
+size_t compressor_frame(Compressor *compressor, const void *data, size_t size,
+                        void *frame, size_t capacity) {
+    switch (compressor->codec) {
+        case COMPRESS_LZ4:
+            return lz4_frame(compressor->state, data, size, frame, capacity);
+#ifdef ZIM_HAVE_ZSTD
+        case COMPRESS_ZSTD: {
+            size_t length = ZSTD_compressCCtx(compressor->state, frame, capacity, data, size,
+                                              COMPRESS_ZSTD_LEVEL);
+            return ZSTD_isError(length) ? 0 : length;
+        }
+#endif
+        default:
+            return 0;
+    }
+}
+
+// Largest frame a full block can turn into
+size_t compress_bound(int codec) {
+#ifdef ZIM_HAVE_ZSTD
+    if (codec == COMPRESS_ZSTD) {
+        return ZSTD_compressBound(COMPRESS_BLOCK_SIZE);
+    }
+#endif
+    (void)codec;
+    return COMPRESS_BLOCK_SIZE + LZ4_FRAME_OVERHEAD;
+}
+
+// Size of the frame at the start of the buffer and of its contents.
+// Fails on truncated frames and on blocks larger than COMPRESS_BLOCK_SIZE.
+int compress_frame_info(int codec, const void *frame, size_t available,
+                        uint64_t *frame_size, uint64_t *raw_size) {
+    int result = -1;
+    
+    if (codec == COMPRESS_LZ4) {
+        result = lz4_frame_info(frame, available, frame_size, raw_size);
+    }
+#ifdef ZIM_HAVE_ZSTD
+    if (codec == COMPRESS_ZSTD) {
+        unsigned long long content = ZSTD_getFrameContentSize(frame, available);
+        size_t length = ZSTD_findFrameCompressedSize(frame, available);
+        
+        if (content != ZSTD_CONTENTSIZE_UNKNOWN && content != ZSTD_CONTENTSIZE_ERROR &&
+            !ZSTD_isError(length)) {
+            *frame_size = length;
+            *raw_size = content;
+            result = 0;
+        }
+    }
+#endif
+    
+    return result == 0 && *raw_size <= COMPRESS_BLOCK_SIZE ? 0 : -1;
+}
+
+// Decompress one whole frame. Returns the bytes produced or -1.
+long compress_decode(int codec, const void *frame, size_t size, void *data, size_t capacity) {
+    if (codec == COMPRESS_LZ4) {
+        return lz4_decode(frame, size, data, capacity);
+    }
+#ifdef ZIM_HAVE_ZSTD
+    if (codec == COMPRESS_ZSTD) {
+        size_t length = ZSTD_decompress(data, capacity, frame, size);
+        return ZSTD_isError(length) ? -1 : (long)length;
+    }
+#endif
+    
+    return -1;
+}
+
+// Codec of a file that starts with this (little-endian) word
+int compress_detect(uint32_t magic) {
+    if (magic == COMPRESS_LZ4_MAGIC) {
+        return COMPRESS_LZ4;
+    }
+    if (magic == COMPRESS_ZSTD_MAGIC) {
+        return COMPRESS_ZSTD;
+    }
+    return COMPRESS_NONE;
+}
+
+// Returns -1 for names that are unknown or not compiled in
+int compress_parse(const char *name) {
+    if (strcmp(name, "lz4") == 0) {
+        return COMPRESS_LZ4;
+    }
+#ifdef ZIM_HAVE_ZSTD
+    if (strcmp(name, "zstd") == 0) {
+        return COMPRESS_ZSTD;
+    }
+#endif
+    return -1;
+}
+
+const char *compress_name(int codec) {
+    switch (codec) {
+        case COMPRESS_LZ4:
+            return "lz4";
+        case COMPRESS_ZSTD:
+            return "zstd";
+        default:
+            return "none";
+    }
+}
@@ -0,0 +1,61 @@
+#ifndef ZIM_COMPRESS_H
+#define ZIM_COMPRESS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Block compression for output files. A compressed file is a run of
+// independent frames, each holding one block of at most
+// COMPRESS_BLOCK_SIZE bytes, closed by a map of where every block starts:
+//
+//   frame x N                (LZ4 frame format, or zstd frames)
+//   skippable frame:         CompressMapEntry x N, CompressMapTrailer
+//
+// Each frame decompresses on its own, so readers seek through the map
+// and only decode the blocks they need. The lz4 and zstd tools read the
+// files as they are and skip the map. A file without a map (writer
+// killed) is read by walking the frames from the start.
+#define COMPRESS_NONE 0
+#define COMPRESS_LZ4  1
+#define COMPRESS_ZSTD 2  // Needs libzstd, see ZIM_HAVE_ZSTD
+
+#define COMPRESS_BLOCK_SIZE (256 * 1024)
+#define COMPRESS_ZSTD_LEVEL 3
+
+#define COMPRESS_LZ4_MAGIC  0x184d2204
+#define COMPRESS_ZSTD_MAGIC 0xfd2fb528
+#define COMPRESS_SKIP_MAGIC 0x184d2a5a  // Skippable frame, holds the map
+#define COMPRESS_MAP_MAGIC  0x504d425a  // "ZBMP"
+
+typedef struct {
+    uint64_t offset;      // File offset of the frame
+    uint64_t raw_offset;  // Uncompressed offset of its first byte
+} CompressMapEntry;
+
+typedef struct {
+    uint64_t size;        // Uncompressed size of the whole file
+    uint32_t count;
+    uint32_t magic;
+} CompressMapTrailer;
+
+// Per-thread compression state
+typedef struct {
+    int codec;
+    void *state;
+} Compressor;
+
+// Function prototypes
+int compressor_init(Compressor *compressor, int codec);
+void compressor_free(Compressor *compressor);
+size_t compressor_frame(Compressor *compressor, const void *data, size_t size,
+                        void *frame, size_t capacity);
+
+size_t compress_bound(int codec);
+int compress_frame_info(int codec, const void *frame, size_t available,
+                        uint64_t *frame_size, uint64_t *raw_size);
+long compress_decode(int codec, const void *frame, size_t size, void *data, size_t capacity);
+int compress_detect(uint32_t magic);
+int compress_parse(const char *name);
+const char *compress_name(int codec);
+
+#endif // ZIM_COMPRESS_H
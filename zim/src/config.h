@@ -3,21 +3,47 @@
 
 // Maximum string lengths
 #define MAX_INTERFACE_LEN 32
+#define MAX_INTERFACE_LIST_LEN 256
+#define MAX_INTERFACES 16
 #define MAX_FILTER_LEN 256
 #define MAX_FILENAME_LEN 256
 #define MAX_PACKET_SIZE 65536
 #define MAX_ADDR_STR_LEN 46 // IPv6 string length
 #define MAX_PAYLOAD_SIZE 1500
+#define MAX_SPEC_LEN 32
 
 // Configuration structure
 typedef struct {
-    char interface[MAX_INTERFACE_LEN];
+    char interface[MAX_INTERFACE_LIST_LEN];  // Comma-separated list or "any"
+    char interfaces[MAX_INTERFACES][MAX_INTERFACE_LEN];
+    int interface_count;
     char filter[MAX_FILTER_LEN];
     char log_file[MAX_FILENAME_LEN];
+    char alert_file[MAX_FILENAME_LEN];  // Scan/flood alert log (see detect.h)
+    char pcap_file[MAX_FILENAME_LEN];
+    char store_file[MAX_FILENAME_LEN];  // Columnar record store (see store.h)
+    char replay_file[MAX_FILENAME_LEN]; // Read packets from a capture instead
+    char stats_file[MAX_FILENAME_LEN];  // Persistent statistics (see stats_file.h)
+    char replay_window[MAX_SPEC_LEN * 2];
+    char replay_host[MAX_ADDR_STR_LEN];
     unsigned long packet_count;
     int promiscuous;
+    int direct_io;                   // Write logs and captures with O_DIRECT
+    int compression;                 // COMPRESS_* codec for logs, captures and stores
+    char sample_spec[MAX_SPEC_LEN];  // "<N>" or "auto[:<N>]", empty disables
+    char flow_collector[MAX_FILENAME_LEN];  // "host:port", empty disables flow export
+    int flow_version;                       // IPFIX_VERSION or NETFLOW_V9_VERSION
+    int daemon;                             // No terminal rendering
+    char control_path[MAX_FILENAME_LEN];    // Control socket, empty disables
+    char cpu_list[MAX_SPEC_LEN * 2];        // CPUs to pin threads to, or "auto" (see placement.h)
+    int busy_poll_usec;                     // SO_BUSY_POLL on capture sockets, 0 disables
+    int numa;                               // Bind buffers to the interfaces' NUMA nodes
+    int hugepages;                          // Back packet buffers with hugepages
 } ZimConfig;
 
+// Runtime configuration, defined in main.c
+extern ZimConfig config;
+
 // Packet protocols
 #define PROTO_UNKNOWN 0
 #define PROTO_ICMP    1
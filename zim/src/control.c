@@ -0,0 +1,517 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include "control.h"
+#include "capture.h"
+#include "filter.h"
+#include "display.h"
+#include "logger.h"
+#include "pcap_writer.h"
+#include "store.h"
+#include "pipeline.h"
+#include "config.h"
+
+#define ATTACH_INTERVAL_MSEC 500
+
+typedef struct {
+    int fd;
+    char line[CONTROL_LINE_LEN];
+    size_t length;
+} ControlClient;
+
+static int listen_fd = -1;
+static char socket_path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+static ControlClient clients[CONTROL_MAX_CLIENTS];
+static int drain_requested = 0;
+
+static int make_address(const char *path, struct sockaddr_un *addr) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr->sun_path)) {
+        fprintf(stderr, "Control socket path too long: %s\n", path);
+        return -1;
+    }
+    strcpy(addr->sun_path, path);
+    return 0;
+}
+
+int control_init(const char *path) {
+    struct sockaddr_un addr;
+    
+    if (make_address(path, &addr) != 0) {
+        return -1;
+    }
+    
+    // A socket file nobody answers on is left over from a crash
+    int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (probe >= 0) {
+        if (connect(probe, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+            fprintf(stderr, "Control socket %s is in use by another Zim process\n", path);
+            close(probe);
+            return -1;
+        }
+        close(probe);
+    }
+    unlink(path);
+    
+    listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0) {
+        perror("socket");
+        return -1;
+    }
+    
+    // The socket can start writers, so it is created owner-only rather
+    // than restricted after bind(), which would leave a window in which
+    // anyone could connect. Nothing else creates files this early, so
+    // changing the process umask briefly is safe.
+    mode_t mask = umask(0177);
+    int bound = bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr));
+    umask(mask);
+    if (bound < 0) {
+        perror("bind");
+        close(listen_fd);
+        listen_fd = -1;
+        return -1;
+    }
+    strcpy(socket_path, path);
+    
+    if (listen(listen_fd, CONTROL_MAX_CLIENTS) < 0) {
+        perror("listen");
+        control_cleanup();
+        return -1;
+    }
+    
+    for (int i = 0; i < CONTROL_MAX_CLIENTS; i++) {
+        clients[i].fd = -1;
+    }
+    
+    return 0;
+}
+
+static void close_client(ControlClient *client) {
+    close(client->fd);
+    client->fd = -1;
+    client->length = 0;
+}
+
+void control_cleanup(void) {
+    if (listen_fd < 0) {
+        return;
+    }
+    
+    for (int i = 0; i < CONTROL_MAX_CLIENTS; i++) {
+        if (clients[i].fd >= 0) {
+            close_client(&clients[i]);
+        }
+    }
+    close(listen_fd);
+    listen_fd = -1;
+    unlink(socket_path);
+}
+
+// Replies never block the capture path: a client that cannot take a
+// whole reply is disconnected
+static int send_all(ControlClient *client, const void *data, size_t size) {
+    ssize_t sent = send(client->fd, data, size, MSG_DONTWAIT | MSG_NOSIGNAL);
+    
+    if (sent < 0 || (size_t)sent != size) {
+        close_client(client);
+        return -1;
+    }
+    
+    return 0;
+}
+
+static int reply(ControlClient *client, const char *format, ...) {
+    char buffer[CONTROL_LINE_LEN];
+    va_list args;
+    
+    va_start(args, format);
+    int length = vsnprintf(buffer, sizeof(buffer) - 1, format, args);
+    va_end(args);
+    
+    if (length < 0 || length > (int)sizeof(buffer) - 2) {
+        length = sizeof(buffer) - 2;
+    }
+    buffer[length++] = '\n';
+    
+    return send_all(client, buffer, length);
+}
+
+static char *writer_file(const char *kind) {
+    if (strcmp(kind, "pcap") == 0) {
+        return config.pcap_file;
+    } else if (strcmp(kind, "log") == 0) {
+        return config.log_file;
+    } else if (strcmp(kind, "store") == 0) {
+        return config.store_file;
+    }
+    return NULL;
+}
+
+static void command_writer(ControlClient *client, char *args) {
+    char *saveptr = NULL;
+    char *action = strtok_r(args, " ", &saveptr);
+    char *kind = strtok_r(NULL, " ", &saveptr);
+    char *filename = strtok_r(NULL, "", &saveptr);
+    char *current = kind != NULL ? writer_file(kind) : NULL;
+    int result;
+    
+    if (action == NULL || current == NULL) {
+        reply(client, "ERR usage: WRITER START|STOP pcap|log|store [file]");
+        return;
+    }
+    
+    if (strcmp(action, "STOP") == 0) {
+        if (current[0] == '\0') {
+            reply(client, "ERR %s writer is not running", kind);
+            return;
+        }
+        char stopped[MAX_FILENAME_LEN];
+        
+        // The output thread writes under the same lock
+        strcpy(stopped, current);
+        pipeline_lock_writers();
+        if (current == config.pcap_file) {
+            pcap_writer_cleanup();
+        } else if (current == config.log_file) {
+            logger_cleanup();
+        } else {
+            store_writer_cleanup();
+        }
+        current[0] = '\0';
+        pipeline_unlock_writers();
+        
+        reply(client, "OK stopped %s writer (%s)", kind, stopped);
+        return;
+    }
+    
+    if (strcmp(action, "START") != 0 || filename == NULL) {
+        reply(client, "ERR usage: WRITER START|STOP pcap|log|store [file]");
+        return;
+    }
+    if (current[0] != '\0') {
+        reply(client, "ERR %s writer already running (%s)", kind, current);
+        return;
+    }
+    
+    pipeline_lock_writers();
+    if (current == config.pcap_file) {
+        result = pcap_writer_init(filename);
+    } else if (current == config.log_file) {
+        result = logger_init(filename);
+    } else {
+        result = store_writer_init(filename);
+    }
+    if (result == 0) {
+        strncpy(current, filename, MAX_FILENAME_LEN - 1);
+        current[MAX_FILENAME_LEN - 1] = '\0';
+    }
+    pipeline_unlock_writers();
+    
+    if (result != 0) {
+        reply(client, "ERR cannot open %s", filename);
+        return;
+    }
+    reply(client, "OK writing %s to %s", kind, current);
+}
+
+static void command_filter(ControlClient *client, const char *filter) {
+    char error[128];
+    
+    if (filter_swap(filter, error, sizeof(error)) != 0) {
+        reply(client, "ERR %s", error);
+        return;
+    }
+    capture_apply_filter(filter_current());
+    
+    strncpy(config.filter, filter, MAX_FILTER_LEN - 1);
+    config.filter[MAX_FILTER_LEN - 1] = '\0';
+    reply(client, "OK filter: %s", config.filter[0] != '\0' ? config.filter : "(none)");
+}
+
+static void command_stats(ControlClient *client) {
+    static DisplaySnapshot snapshot;
+    
+    display_latest(&snapshot);
+    if (reply(client, "OK %zu", sizeof(snapshot)) == 0) {
+        send_all(client, &snapshot, sizeof(snapshot));
+    }
+}
+
+static void handle_command(ControlClient *client, char *line) {
+    char *args = strchr(line, ' ');
+    
+    if (args != NULL) {
+        *args++ = '\0';
+    } else {
+        args = line + strlen(line);
+    }
+    
+    if (strcmp(line, "STATS") == 0) {
+        command_stats(client);
+    } else if (strcmp(line, "FILTER") == 0) {
+        command_filter(client, args);
+    } else if (strcmp(line, "WRITER") == 0) {
+        command_writer(client, args);
+    } else if (strcmp(line, "DRAIN") == 0) {
+        drain_requested = 1;
+        reply(client, "OK draining");
+    } else if (strcmp(line, "HELP") == 0) {
+        reply(client, "OK STATS | FILTER <expr> | WRITER START|STOP pcap|log|store [file] | DRAIN");
+    } else {
+        reply(client, "ERR unknown command: %s", line);
+    }
+}
+
+static void read_client(ControlClient *client) {
+    ssize_t received = recv(client->fd, client->line + client->length,
+                            sizeof(client->line) - 1 - client->length, MSG_DONTWAIT);
+    
+    if (received == 0 || (received < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+        close_client(client);
+        return;
+    }
+    if (received < 0) {
+        return;
+    }
+    client->length += received;
+    
+    // Handle every complete line
+    char *start = client->line;
+    char *end;
+    while (client->fd >= 0 &&
+           (end = memchr(start, '\n', client->length - (start - client->line))) != NULL) {
+        *end = '\0';
+        if (end > start && end[-1] == '\r') {
+            end[-1] = '\0';
+        }
+        handle_command(client, start);
+        start = end + 1;
+    }
+    if (client->fd < 0) {
+        return;
+    }
+    
+    client->length -= start - client->line;
+    memmove(client->line, start, client->length);
+    
+    if (client->length == sizeof(client->line) - 1) {
+        reply(client, "ERR line too long");
+        close_client(client);
+    }
+}
+
+// Called from the main loop: accept new clients and serve pending commands
+void control_poll(void) {
+    if (listen_fd < 0) {
+        return;
+    }
+    
+    int fd;
+    while ((fd = accept(listen_fd, NULL, NULL)) >= 0) {
+        int slot = -1;
+        for (int i = 0; i < CONTROL_MAX_CLIENTS && slot < 0; i++) {
+            if (clients[i].fd < 0) {
+                slot = i;
+            }
+        }
+        if (slot < 0) {
+            close(fd);
+            continue;
+        }
+        clients[slot].fd = fd;
+        clients[slot].length = 0;
+    }
+    
+    for (int i = 0; i < CONTROL_MAX_CLIENTS; i++) {
+        if (clients[i].fd >= 0) {
+            read_client(&clients[i]);
+        }
+    }
+}
+
+int control_drain_requested(void) {
+    return drain_requested;
+}
+
+// 'zim attach': render the display modes from a daemon's snapshots
+
+static volatile sig_atomic_t attached = 1;
+
+static void attach_signal(int signal) {
+    (void)signal;
+    attached = 0;
+}
+
+static void print_attach_usage(void) {
+    printf("Usage: zim attach [options]\n");
+    printf("Options:\n");
+    printf("  -C <path>       Control socket (default: %s)\n", CONTROL_DEFAULT_PATH);
+    printf("  -m <mode>       Start in stats (default), graph, alerts, latency or packets mode\n");
+}
+
+static int read_exact(int fd, void *buffer, size_t size) {
+    size_t done = 0;
+    
+    while (done < size) {
+        ssize_t received = recv(fd, (char *)buffer + done, size - done, 0);
+        if (received <= 0) {
+            return -1;
+        }
+        done += received;
+    }
+    
+    return 0;
+}
+
+// Send one command and read its reply line. The reply is read a byte at
+// a time so nothing of a binary body that follows is consumed with it.
+static int send_command(int fd, const char *command, char *line, size_t size) {
+    size_t length = 0;
+    
+    if (send(fd, command, strlen(command), MSG_NOSIGNAL) != (ssize_t)strlen(command) ||
+        send(fd, "\n", 1, MSG_NOSIGNAL) != 1) {
+        return -1;
+    }
+    
+    while (length < size - 1) {
+        if (read_exact(fd, &line[length], 1) != 0) {
+            return -1;
+        }
+        if (line[length] == '\n') {
+            break;
+        }
+        length++;
+    }
+    line[length] = '\0';
+    
+    return 0;
+}
+
+static int fetch_snapshot(int fd, DisplaySnapshot *snapshot) {
+    char line[CONTROL_LINE_LEN];
+    size_t size;
+    
+    if (send_command(fd, "STATS", line, sizeof(line)) != 0) {
+        return -1;
+    }
+    
+    if (sscanf(line, "OK %zu", &size) != 1 || size != sizeof(*snapshot)) {
+        fprintf(stderr, "Unexpected reply (different Zim version?): %s\n", line);
+        return -1;
+    }
+    
+    return read_exact(fd, snapshot, size);
+}
+
+int attach_main(int argc, char *argv[]) {
+    const char *path = CONTROL_DEFAULT_PATH;
+    int mode = DISPLAY_STATS;
+    struct sockaddr_un addr;
+    struct timeval timeout = {2, 0};
+    int opt;
+    
+    optind = 1;
+    while ((opt = getopt(argc, argv, "C:m:h")) != -1) {
+        switch (opt) {
+            case 'C':
+                path = optarg;
+                break;
+            case 'm':
+                if (strcmp(optarg, "stats") == 0) mode = DISPLAY_STATS;
+                else if (strcmp(optarg, "graph") == 0) mode = DISPLAY_GRAPH;
+                else if (strcmp(optarg, "alerts") == 0) mode = DISPLAY_ALERTS;
+                else if (strcmp(optarg, "latency") == 0) mode = DISPLAY_LATENCY;
+                else if (strcmp(optarg, "packets") == 0) mode = DISPLAY_PACKETS;
+                else {
+                    fprintf(stderr, "Unknown display mode: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'h':
+                print_attach_usage();
+                return 0;
+            default:
+                print_attach_usage();
+                return 1;
+        }
+    }
+    
+    if (make_address(path, &addr) != 0) {
+        return 1;
+    }
+    
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror(path);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return 1;
+    }
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    
+    DisplaySnapshot *snapshot = malloc(sizeof(DisplaySnapshot));
+    if (snapshot == NULL) {
+        perror("malloc");
+        close(fd);
+        return 1;
+    }
+    
+    signal(SIGINT, attach_signal);
+    signal(SIGTERM, attach_signal);
+    
+    display_init();
+    display_set_mode(mode);
+    
+    int result = 0;
+    while (attached) {
+        if (fetch_snapshot(fd, snapshot) != 0) {
+            result = 1;
+            break;
+        }
+        display_render(snapshot);
+        fflush(stdout);
+        
+        // Stay responsive to keys between refreshes
+        for (int waited = 0; attached && waited < ATTACH_INTERVAL_MSEC; waited += 50) {
+            int key = display_check_input();
+            if (key == 'q') {
+                attached = 0;
+            } else if (key == 'h') {
+                display_help();
+            } else if (key == 'm' || key == 'o' || key == 'n' || key == 'p') {
+                break;
+            } else if (key == DISPLAY_KEY_FILTER) {
+                // Filters typed here are applied by the daemon
+                char command[CONTROL_LINE_LEN], line[CONTROL_LINE_LEN] = "";
+                snprintf(command, sizeof(command), "FILTER %s", display_filter_input());
+                if (send_command(fd, command, line, sizeof(line)) != 0) {
+                    attached = 0;
+                    result = 1;
+                }
+                printf("%s\n", line);
+                break;
+            }
+            usleep(50000);
+        }
+    }
+    
+    display_cleanup();
+    if (result != 0) {
+        printf("\nLost connection to %s\n", path);
+    }
+    
+    free(snapshot);
+    close(fd);
+    return result;
+}
@@ -0,0 +1,25 @@
+#ifndef ZIM_CONTROL_H
+#define ZIM_CONTROL_H
+
+// Unix-domain control socket. Clients send one command per line and get
+// one reply per command: "OK [text]" or "ERR <reason>". STATS replies
+// "OK <size>" followed by a binary DisplaySnapshot of that size.
+//
+//   STATS                          Snapshot for 'zim attach'
+//   FILTER <expression>            Replace the capture filter
+//   WRITER START pcap|log|store <file>
+//   WRITER STOP pcap|log|store
+//   DRAIN                          Stop capturing, finish queued packets, exit
+//   HELP
+#define CONTROL_DEFAULT_PATH "/run/zim.sock"
+#define CONTROL_MAX_CLIENTS 8
+#define CONTROL_LINE_LEN 512
+
+// Function prototypes
+int control_init(const char *path);
+void control_cleanup(void);
+void control_poll(void);
+int control_drain_requested(void);
+int attach_main(int argc, char *argv[]);
+
+#endif // ZIM_CONTROL_H
@@ -0,0 +1,290 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <netinet/tcp.h>
+#include <netinet/ip_icmp.h>
+#include "detect.h"
+#include "sketch.h"
+#include "utils.h"
+#include "config.h"
+
+#define SKETCH_BYTES HLL_REGISTERS(DETECT_HLL_PRECISION)
+
+// Per-address state. Index 0 is the current epoch, 1 the previous one.
+typedef struct {
+    unsigned int addr;
+    int used;
+    time_t epoch_start;
+    time_t last_seen;
+    unsigned int alerted;  // Alert types already raised this epoch
+    uint8_t ports[2][SKETCH_BYTES];
+    uint8_t hosts[2][SKETCH_BYTES];
+    unsigned long syn_sent[2];
+    unsigned long synack_received[2];
+    unsigned long syn_received[2];
+    unsigned long synack_sent[2];
+} DetectEntry;
+
+static DetectEntry *table = NULL;
+static uint32_t *udp_seen = NULL;  // Tags of UDP port pairs, direct mapped
+static FILE *alert_file = NULL;
+static DetectAlert alerts[DETECT_ALERT_RING];
+static unsigned long alert_total = 0;
+
+int detect_init(const char *alert_log) {
+    table = calloc(DETECT_SETS * DETECT_WAYS, sizeof(DetectEntry));
+    udp_seen = calloc(DETECT_UDP_SLOTS, sizeof(uint32_t));
+    if (table == NULL || udp_seen == NULL) {
+        perror("calloc");
+        detect_cleanup();
+        return -1;
+    }
+    
+    if (alert_log != NULL && alert_log[0] != '\0') {
+        alert_file = fopen(alert_log, "a");
+        if (alert_file == NULL) {
+            perror("fopen");
+            detect_cleanup();
+            return -1;
+        }
+        fprintf(alert_file, "Timestamp,Alert,Address,Value\n");
+        fflush(alert_file);
+    }
+    
+    return 0;
+}
+
+void detect_cleanup(void) {
+    free(table);
+    table = NULL;
+    free(udp_seen);
+    udp_seen = NULL;
+    
+    if (alert_file != NULL) {
+        fclose(alert_file);
+        alert_file = NULL;
+    }
+}
+
+const char *detect_alert_name(int type) {
+    switch (type) {
+        case ALERT_PORT_SCAN:
+            return "Port scan";
+        case ALERT_HOST_SCAN:
+            return "Host sweep";
+        case ALERT_SYN_FLOOD_FROM:
+            return "SYN flood from";
+        case ALERT_SYN_FLOOD_TO:
+            return "SYN flood against";
+        default:
+            return "Unknown";
+    }
+}
+
+// Roll the epochs forward so the counters cover at most two windows
+static void advance_epoch(DetectEntry *entry, time_t now) {
+    if (now < entry->epoch_start + DETECT_WINDOW_SEC) {
+        return;
+    }
+    
+    if (now < entry->epoch_start + 2 * DETECT_WINDOW_SEC) {
+        memcpy(entry->ports[1], entry->ports[0], SKETCH_BYTES);
+        memcpy(entry->hosts[1], entry->hosts[0], SKETCH_BYTES);
+        entry->syn_sent[1] = entry->syn_sent[0];
+        entry->synack_received[1] = entry->synack_received[0];
+        entry->syn_received[1] = entry->syn_received[0];
+        entry->synack_sent[1] = entry->synack_sent[0];
+        entry->epoch_start += DETECT_WINDOW_SEC;
+    } else {
+        memset(entry->ports[1], 0, SKETCH_BYTES);
+        memset(entry->hosts[1], 0, SKETCH_BYTES);
+        entry->syn_sent[1] = entry->synack_received[1] = 0;
+        entry->syn_received[1] = entry->synack_sent[1] = 0;
+        entry->epoch_start = now;
+    }
+    
+    memset(entry->ports[0], 0, SKETCH_BYTES);
+    memset(entry->hosts[0], 0, SKETCH_BYTES);
+    entry->syn_sent[0] = entry->synack_received[0] = 0;
+    entry->syn_received[0] = entry->synack_sent[0] = 0;
+    entry->alerted = 0;
+}
+
+// Find or claim the entry for addr. keep is never evicted, so a caller
+// holding one entry can safely look up a second.
+static DetectEntry *lookup(unsigned int addr, time_t now, const DetectEntry *keep) {
+    uint32_t set = sketch_hash(addr) % DETECT_SETS;
+    DetectEntry *ways = &table[set * DETECT_WAYS];
+    DetectEntry *victim = &ways[0] == keep ? &ways[1] : &ways[0];
+    
+    for (int i = 0; i < DETECT_WAYS; i++) {
+        if (ways[i].used && ways[i].addr == addr) {
+            ways[i].last_seen = now;
+            advance_epoch(&ways[i], now);
+            return &ways[i];
+        }
+        if (&ways[i] == keep) {
+            continue;
+        }
+        if (!ways[i].used) {
+            if (victim->used) {
+                victim = &ways[i];
+            }
+        } else if (victim->used && ways[i].last_seen < victim->last_seen) {
+            victim = &ways[i];
+        }
+    }
+    
+    memset(victim, 0, sizeof(*victim));
+    victim->used = 1;
+    victim->addr = addr;
+    victim->epoch_start = now;
+    victim->last_seen = now;
+    return victim;
+}
+
+static double window_estimate(uint8_t sketches[2][SKETCH_BYTES]) {
+    uint8_t merged[SKETCH_BYTES];
+    
+    memcpy(merged, sketches[0], SKETCH_BYTES);
+    hll_merge(merged, sketches[1], DETECT_HLL_PRECISION);
+    return hll_estimate(merged, DETECT_HLL_PRECISION);
+}
+
+static void raise_alert(DetectEntry *entry, int type, unsigned long value, time_t now) {
+    DetectAlert *alert;
+    
+    if (entry->alerted & type) {
+        return;
+    }
+    entry->alerted |= type;
+    
+    alert = &alerts[alert_total % DETECT_ALERT_RING];
+    alert->time = now;
+    alert->type = type;
+    alert->addr = entry->addr;
+    alert->value = value;
+    alert_total++;
+    
+    if (alert_file != NULL) {
+        char timestamp[32];
+        char addr[MAX_ADDR_STR_LEN];
+        struct tm tm_info;
+        
+        localtime_r(&now, &tm_info);
+        strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S", &tm_info);
+        format_ipv4(entry->addr, addr, sizeof(addr));
+        fprintf(alert_file, "%s,%s,%s,%lu\n", timestamp, detect_alert_name(type), addr, value);
+        fflush(alert_file);
+    }
+}
+
+static void check_syn(DetectEntry *entry, int type, unsigned long *syns, unsigned long *answers,
+                      time_t now) {
+    unsigned long total = syns[0] + syns[1];
+    
+    if (total >= DETECT_SYN_THRESHOLD && total > DETECT_SYN_RATIO * (answers[0] + answers[1])) {
+        raise_alert(entry, type, total, now);
+    }
+}
+
+static uint64_t udp_pair(unsigned int src_addr, unsigned short src_port,
+                         unsigned int dst_addr, unsigned short dst_port) {
+    uint64_t addrs = sketch_hash(((uint64_t)src_addr << 32) | dst_addr);
+    
+    return sketch_hash(addrs ^ ((uint64_t)src_port << 16 | dst_port));
+}
+
+// Remember this UDP datagram's port pair and tell whether it answers one
+// seen the other way. Replies are not probes: a DNS or QUIC server
+// answering many clients would otherwise look like a port scan.
+static int udp_reply(const Packet *packet) {
+    uint64_t key = udp_pair(packet->src_addr, packet->src_port,
+                            packet->dst_addr, packet->dst_port);
+    uint64_t reverse = udp_pair(packet->dst_addr, packet->dst_port,
+                                packet->src_addr, packet->src_port);
+    uint32_t *reverse_slot = &udp_seen[reverse % DETECT_UDP_SLOTS];
+    
+    udp_seen[key % DETECT_UDP_SLOTS] = (key >> 32) | 1;
+    return *reverse_slot == ((reverse >> 32) | 1);
+}
+
+// ICMP echo requests probe; replies and errors answer someone else
+static int icmp_probe(const Packet *packet) {
+    unsigned int offset = ((unsigned char *)packet->ip_header - packet->buffer) +
+                          packet->ip_header->ihl * 4;
+    
+    return offset < packet->size && packet->buffer[offset] == ICMP_ECHO;
+}
+
+// Feed one parsed packet. Probes (TCP SYNs, unanswered UDP and ICMP echo
+// requests) count towards the scan sketches; SYN and SYN-ACK counts track
+// half-open handshakes.
+void detect_packet(Packet *packet) {
+    if (table == NULL || packet->ip_header == NULL) {
+        return;
+    }
+    
+    time_t now = packet->timestamp.tv_sec;
+    struct tcphdr *tcp = packet->tcp_header;
+    int syn = tcp != NULL && tcp->syn && !tcp->ack;
+    int synack = tcp != NULL && tcp->syn && tcp->ack;
+    int probe = syn ||
+                (packet->udp_header != NULL && !udp_reply(packet)) ||
+                (packet->protocol == PROTO_ICMP && icmp_probe(packet));
+    
+    if (!probe && !synack) {
+        return;
+    }
+    
+    DetectEntry *src = lookup(packet->src_addr, now, NULL);
+    
+    if (probe) {
+        // Only re-estimate when a register actually changed
+        if (packet->protocol != PROTO_ICMP &&
+            hll_add(src->ports[0], DETECT_HLL_PRECISION, sketch_hash(packet->dst_port))) {
+            double ports = window_estimate(src->ports);
+            if (ports >= DETECT_PORT_THRESHOLD) {
+                raise_alert(src, ALERT_PORT_SCAN, ports, now);
+            }
+        }
+        if (hll_add(src->hosts[0], DETECT_HLL_PRECISION, sketch_hash(packet->dst_addr))) {
+            double hosts = window_estimate(src->hosts);
+            if (hosts >= DETECT_HOST_THRESHOLD) {
+                raise_alert(src, ALERT_HOST_SCAN, hosts, now);
+            }
+        }
+    }
+    
+    if (syn) {
+        DetectEntry *dst = lookup(packet->dst_addr, now, src);
+        
+        src->syn_sent[0]++;
+        dst->syn_received[0]++;
+        check_syn(src, ALERT_SYN_FLOOD_FROM, src->syn_sent, src->synack_received, now);
+        check_syn(dst, ALERT_SYN_FLOOD_TO, dst->syn_received, dst->synack_sent, now);
+    } else if (synack) {
+        DetectEntry *dst = lookup(packet->dst_addr, now, src);
+        
+        src->synack_sent[0]++;
+        dst->synack_received[0]++;
+    }
+}
+
+// Copy up to max alerts, newest first
+int detect_recent_alerts(DetectAlert *out, int max) {
+    int count = 0;
+    
+    for (unsigned long i = alert_total; i > 0 && count < max; i--) {
+        if (alert_total - i >= DETECT_ALERT_RING) {
+            break;
+        }
+        out[count++] = alerts[(i - 1) % DETECT_ALERT_RING];
+    }
+    
+    return count;
+}
+
+unsigned long detect_alert_total(void) {
+    return alert_total;
+}
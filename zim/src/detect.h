@@ -0,0 +1,46 @@
+#ifndef ZIM_DETECT_H
+#define ZIM_DETECT_H
+
+#include <time.h>
+#include "network.h"
+
+// Scan and flood detection. Every address is tracked in a fixed-size,
+// set-associative table (least recently seen entry evicted), so memory
+// does not grow with the number of hosts or ports a scan touches.
+#define DETECT_SETS 1024
+#define DETECT_WAYS 4
+#define DETECT_HLL_PRECISION 7  // 128 registers per sketch, ~9% error
+#define DETECT_UDP_SLOTS (1 << 16)  // UDP port pairs remembered to spot replies
+
+// Thresholds apply to a sliding window of one to two DETECT_WINDOW_SEC
+// epochs (current epoch plus the previous one)
+#define DETECT_WINDOW_SEC 10
+#define DETECT_PORT_THRESHOLD 100  // Distinct destination ports probed
+#define DETECT_HOST_THRESHOLD 64   // Distinct destination hosts probed
+#define DETECT_SYN_THRESHOLD 500   // SYNs sent or received...
+#define DETECT_SYN_RATIO 4         // ...at more than this many per SYN-ACK
+
+#define DETECT_ALERT_RING 64
+
+// Alert types
+#define ALERT_PORT_SCAN      0x01
+#define ALERT_HOST_SCAN      0x02
+#define ALERT_SYN_FLOOD_FROM 0x04
+#define ALERT_SYN_FLOOD_TO   0x08
+
+typedef struct {
+    time_t time;
+    int type;
+    unsigned int addr;    // Host byte order
+    unsigned long value;  // Distinct ports/hosts, or SYN count
+} DetectAlert;
+
+// Function prototypes
+int detect_init(const char *alert_log);
+void detect_cleanup(void);
+void detect_packet(Packet *packet);
+int detect_recent_alerts(DetectAlert *alerts, int max);
+unsigned long detect_alert_total(void);
+const char *detect_alert_name(int type);
+
+#endif // ZIM_DETECT_H
@@ -5,8 +5,19 @@
 #include <termios.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <ctype.h>
+#include <pthread.h>
 #include "display.h"
 #include "packet_parser.h"
+#include "sampler.h"
+#include "ipfix.h"
+#include "filter.h"
+#include "io_writer.h"
+#include "compress.h"
+#include "detect.h"
+#include "tunnel.h"
+#include "tcpstat.h"
+#include "utils.h"
 #include "config.h"
 
 // Terminal control
@@ -14,9 +25,23 @@ static struct termios old_termios, new_termios;
 static int term_configured = 0;
 
 // Display state
-static int display_mode = 0;  // 0: Packet list, 1: Statistics, 2: Graph
+static int display_mode = DISPLAY_PACKETS;
 static int auto_scroll = 1;
 static int detailed_view = 0;
+static int shown_shed_level = SHED_NONE;
+static unsigned long shown_alerts = 0;
+static int source_sort = TOPK_PACKETS;  // Graph mode sort key and page
+static int source_page = 0;
+
+// Filter line editor ('f')
+static int editing_filter = 0;
+static char filter_input[MAX_FILTER_LEN];
+static size_t filter_input_length = 0;
+static char shown_filter[MAX_FILTER_LEN];  // From the last rendered snapshot
+
+// Latest snapshot from the parse thread
+static DisplaySnapshot published;
+static pthread_mutex_t published_lock = PTHREAD_MUTEX_INITIALIZER;
 
 // Initialize terminal for non-blocking input
 void display_init(void) {
@@ -49,16 +74,55 @@ void display_cleanup(void) {
     }
 }
 
+static void show_filter_prompt(void) {
+    printf("\r\033[K%sfilter>%s %s", COLOR_BOLD, COLOR_RESET, filter_input);
+    fflush(stdout);
+}
+
+// One key of filter input. Capture continues while the user types;
+// Enter hands the expression to the caller, Esc abandons it.
+static int edit_filter(char c) {
+    if (c == '\n' || c == '\r') {
+        editing_filter = 0;
+        printf("\n");
+        return DISPLAY_KEY_FILTER;
+    }
+    
+    if (c == 27) {
+        editing_filter = 0;
+        printf("\r\033[K");
+    } else if (c == 127 || c == '\b') {
+        if (filter_input_length > 0) {
+            filter_input[--filter_input_length] = '\0';
+        }
+        show_filter_prompt();
+    } else if (isprint((unsigned char)c) && filter_input_length < MAX_FILTER_LEN - 1) {
+        filter_input[filter_input_length++] = c;
+        filter_input[filter_input_length] = '\0';
+        show_filter_prompt();
+    }
+    
+    return 0;
+}
+
+const char *display_filter_input(void) {
+    return filter_input;
+}
+
 // Check for keyboard input
 int display_check_input(void) {
     char c;
     int ret = read(STDIN_FILENO, &c, 1);
     
+    if (ret > 0 && editing_filter) {
+        return edit_filter(c);
+    }
+    
     if (ret > 0) {
         switch (c) {
             case 'm':
                 // Toggle display mode
-                display_mode = (display_mode + 1) % 3;
+                display_mode = (display_mode + 1) % DISPLAY_MODES;
                 printf("\033[2J\033[H");  // Clear screen
                 break;
             case 's':
@@ -69,6 +133,31 @@ int display_check_input(void) {
                 // Toggle detailed view
                 detailed_view = !detailed_view;
                 break;
+            case 'o':
+                // Next sort key for the top sources
+                source_sort = (source_sort + 1) % TOPK_KEYS;
+                source_page = 0;
+                printf("\033[2J\033[H");  // Clear screen
+                break;
+            case 'n':
+                // Next page of top sources; clamped when drawn
+                source_page++;
+                printf("\033[2J\033[H");  // Clear screen
+                break;
+            case 'p':
+                // Previous page of top sources
+                if (source_page > 0) {
+                    source_page--;
+                }
+                printf("\033[2J\033[H");  // Clear screen
+                break;
+            case 'f':
+                // Edit the filter, starting from the current one
+                editing_filter = 1;
+                snprintf(filter_input, sizeof(filter_input), "%s", shown_filter);
+                filter_input_length = strlen(filter_input);
+                show_filter_prompt();
+                return 0;
             case 'h':
                 // Display help
                 return 'h';
@@ -84,10 +173,15 @@ int display_check_input(void) {
 
 // Display packet information
 void display_packet(Packet *packet) {
+    if (packet->shed & SHED_STAGE_DISPLAY) {
+        return;
+    }
+    
     // Get current time
     char time_str[20];
-    strftime(time_str, sizeof(time_str), "%H:%M:%S", 
-             localtime(&packet->timestamp.tv_sec));
+    struct tm tm_info;
+    localtime_r(&packet->timestamp.tv_sec, &tm_info);
+    strftime(time_str, sizeof(time_str), "%H:%M:%S", &tm_info);
     
     // Choose color based on protocol
     const char *color;
@@ -112,19 +206,34 @@ void display_packet(Packet *packet) {
             break;
     }
     
+    // Tunneled packets are tagged with the tunnel they were carried in
+    char tunnel_tag[32] = "";
+    if (packet->tunnel != TUNNEL_NONE) {
+        snprintf(tunnel_tag, sizeof(tunnel_tag), "%s[%s %u]%s ", COLOR_MAGENTA,
+                 tunnel_name(packet->tunnel), packet->tunnel_id, COLOR_RESET);
+    }
+    
     // Print basic packet info
-    if (display_mode == 0) {  // Packet list mode
-        printf("%s[%s]%s %s%s%s %s%s%s:%d -> %s:%d %d bytes\n",
+    if (display_mode == DISPLAY_PACKETS) {
+        printf("%s[%s]%s %s%s%s %s%s%s%s:%d -> %s:%d %d bytes\n",
                COLOR_CYAN, time_str, COLOR_RESET,
-               color, proto_str, COLOR_RESET,
+               color, proto_str, COLOR_RESET, tunnel_tag,
                COLOR_BOLD, packet->src_ip, COLOR_RESET, packet->src_port,
                packet->dst_ip, packet->dst_port,
                packet->size);
                
         // If detailed view is enabled, print more information
-        if (detailed_view) {
+        if (detailed_view && !(packet->shed & SHED_STAGE_DETAIL)) {
             printf("  MAC: %s -> %s\n", packet->src_mac, packet->dst_mac);
             
+            if (packet->tunnel != TUNNEL_NONE) {
+                char outer_src[MAX_ADDR_STR_LEN], outer_dst[MAX_ADDR_STR_LEN];
+                format_ipv4(packet->outer_src_addr, outer_src, sizeof(outer_src));
+                format_ipv4(packet->outer_dst_addr, outer_dst, sizeof(outer_dst));
+                printf("  Tunnel: %s %u, %s -> %s\n", tunnel_name(packet->tunnel),
+                       packet->tunnel_id, outer_src, outer_dst);
+            }
+            
             // Display TCP flags if it's a TCP packet
             if (packet->protocol == PROTO_TCP && packet->tcp_header != NULL) {
                 printf("  Flags: %s%s%s%s%s%s\n",
@@ -134,6 +243,17 @@ void display_packet(Packet *packet) {
                        packet->tcp_header->rst ? "RST " : "",
                        packet->tcp_header->psh ? "PSH " : "",
                        packet->tcp_header->urg ? "URG " : "");
+                if (packet->tcp_events != 0) {
+                    printf("  TCP: %s%s%s%s",
+                           packet->tcp_events & TCP_EVENT_RETRANSMIT ? "retransmission " : "",
+                           packet->tcp_events & TCP_EVENT_OUT_OF_ORDER ? "out-of-order " : "",
+                           packet->tcp_events & TCP_EVENT_ZERO_WINDOW ? "zero-window " : "",
+                           packet->tcp_events & TCP_EVENT_HANDSHAKE ? "handshake " : "");
+                    if (packet->tcp_events & TCP_EVENT_RTT) {
+                        printf("RTT %.3f ms", packet->rtt_usec / 1000.0);
+                    }
+                    printf("\n");
+                }
             }
             
             // Display first few bytes of payload
@@ -150,103 +270,358 @@ void display_packet(Packet *packet) {
     }
 }
 
+// Queue depths and backpressure of the processing stages
+static void display_pipeline(const PipelineStats *pipeline) {
+    printf("\nPipeline:      %9s %9s\n", "queued", "capacity");
+    if (pipeline->capture_capacity > 0) {
+        printf("  Capture      %9lu %9lu   %lu dropped (no free descriptor)\n",
+               pipeline->capture_depth, pipeline->capture_capacity, pipeline->capture_overruns);
+        printf("  Reorder      %lu held for the window, %lu released early\n",
+               pipeline->reorder_waited, pipeline->reorder_forced);
+    }
+    printf("  Output       %9lu %9lu   %lu stalls\n",
+           pipeline->output_depth, pipeline->output_capacity, pipeline->output_stalls);
+    if (pipeline->display_capacity > 0) {
+        printf("  Display      %9lu %9lu   %lu skipped\n",
+               pipeline->display_depth, pipeline->display_capacity, pipeline->display_skipped);
+    }
+    printf("  Descriptors  %9lu %9lu\n", pipeline->descriptors_used, pipeline->descriptors);
+    if (pipeline->write_backend != IO_WRITER_NONE) {
+        printf("  Writes       %s%s, %.1f MB/s, %.1f MB total",
+               io_writer_backend_name(pipeline->write_backend),
+               pipeline->write_direct ? " (O_DIRECT)" : "",
+               pipeline->write_rate / 1e6, pipeline->write_bytes / 1e6);
+        if (pipeline->write_codec != COMPRESS_NONE) {
+            printf(", %s %.1f:1", compress_name(pipeline->write_codec), pipeline->write_ratio);
+        }
+        printf("\n");
+    }
+}
+
 // Display network statistics
-void display_statistics(void) {
+static void display_statistics(DisplaySnapshot *snapshot) {
+    const PacketStats *stats = &snapshot->stats;
+    
     printf("\033[H");  // Move cursor to home position
     
     printf("%s======== Network Statistics ========%s\n\n", COLOR_BOLD, COLOR_RESET);
     
-    printf("Total Packets: %s%lu%s\n", COLOR_BOLD, stats.total_packets, COLOR_RESET);
-    printf("Total Bytes: %lu\n\n", stats.total_bytes);
+    printf("Total Packets: %s%lu%s\n", COLOR_BOLD, stats->total_packets, COLOR_RESET);
+    printf("Total Bytes: %lu\n", stats->total_bytes);
+    printf("Dropped: %lu\n\n", stats->dropped_packets);
     
     printf("Protocol Breakdown:\n");
     printf("  %sTCP:%s %lu (%.1f%%)\n", COLOR_BLUE, COLOR_RESET, 
-           stats.tcp_packets, 
-           stats.total_packets > 0 ? (stats.tcp_packets * 100.0 / stats.total_packets) : 0);
+           stats->tcp_packets, 
+           stats->total_packets > 0 ? (stats->tcp_packets * 100.0 / stats->total_packets) : 0);
            
     printf("  %sUDP:%s %lu (%.1f%%)\n", COLOR_GREEN, COLOR_RESET, 
-           stats.udp_packets, 
-           stats.total_packets > 0 ? (stats.udp_packets * 100.0 / stats.total_packets) : 0);
+           stats->udp_packets, 
+           stats->total_packets > 0 ? (stats->udp_packets * 100.0 / stats->total_packets) : 0);
            
     printf("  %sICMP:%s %lu (%.1f%%)\n", COLOR_YELLOW, COLOR_RESET, 
-           stats.icmp_packets, 
-           stats.total_packets > 0 ? (stats.icmp_packets * 100.0 / stats.total_packets) : 0);
+           stats->icmp_packets, 
+           stats->total_packets > 0 ? (stats->icmp_packets * 100.0 / stats->total_packets) : 0);
            
     printf("  %sOther:%s %lu (%.1f%%)\n", COLOR_WHITE, COLOR_RESET, 
-           stats.other_packets, 
-           stats.total_packets > 0 ? (stats.other_packets * 100.0 / stats.total_packets) : 0);
+           stats->other_packets, 
+           stats->total_packets > 0 ? (stats->other_packets * 100.0 / stats->total_packets) : 0);
+    
+    printf("\nUnique (estimated):\n");
+    printf("  Sources: %-10.0f Destinations: %-10.0f Flows: %.0f\n",
+           hll_estimate(stats->unique_sources, STATS_HLL_PRECISION),
+           hll_estimate(stats->unique_destinations, STATS_HLL_PRECISION),
+           hll_estimate(stats->unique_flows, STATS_HLL_PRECISION));
+    
+    printf("\nPacket Sizes:   %10s %6s %6s %6s %6s\n", "packets", "p50", "p90", "p99", "max");
+    for (int i = 0; i < STATS_CLASSES; i++) {
+        static const char *names[STATS_CLASSES] = {"TCP", "UDP", "ICMP", "Other"};
+        const LogHistogram *sizes = &stats->sizes[i];
+        
+        if (sizes->count == 0) {
+            continue;
+        }
+        printf("  %-13s %10lu %6lu %6lu %6lu %6lu\n", names[i], sizes->count,
+               loghist_percentile(sizes, 50), loghist_percentile(sizes, 90),
+               loghist_percentile(sizes, 99), sizes->max);
+    }
+    
+    int tunneled = 0;
+    for (int i = 1; i < TUNNEL_TYPES; i++) {
+        if (stats->tunnel_packets[i] == 0) {
+            continue;
+        }
+        if (!tunneled++) {
+            printf("\nTunnels:\n");
+        }
+        printf("  %-12s %10lu pkts %12lu bytes\n", tunnel_name(i),
+               stats->tunnel_packets[i], stats->tunnel_bytes[i]);
+    }
+    
+    if (stats->interface_count > 1) {
+        printf("\nInterfaces:\n");
+        for (int i = 0; i < stats->interface_count; i++) {
+            printf("  %-12s %10lu pkts %12lu bytes %8lu dropped %6lu errors\n",
+                   stats->interfaces[i].name, stats->interfaces[i].packets,
+                   stats->interfaces[i].bytes, stats->interfaces[i].dropped,
+                   stats->interfaces[i].errors);
+        }
+    }
+    
+    printf("\nFilter: %s\n", snapshot->filter[0] != '\0' ? snapshot->filter : "(none)");
+    
+    if (snapshot->shed_enabled) {
+        int level = snapshot->shed_level;
+        printf("Load Shedding: %s%-8s%s (level %d/%d, 1-in-%u sampled)\n",
+               level > SHED_NONE ? COLOR_RED : COLOR_GREEN,
+               sampler_level_name(level), COLOR_RESET,
+               level, SHED_MAX, snapshot->sample_rate);
+    }
+    
+    if (snapshot->flow_export) {
+        printf("Flow Export:   %lu records in %lu datagrams\n",
+               snapshot->flow_records, snapshot->flow_datagrams);
+    }
+    
+    display_pipeline(&snapshot->pipeline);
 }
 
-// Display IP source graph
-void display_source_graph(void) {
+static double source_value(const TopKItem *item, int sort) {
+    switch (sort) {
+        case TOPK_PACKETS:
+            return item->packets;
+        case TOPK_BYTES:
+            return item->bytes;
+        default:
+            return item->rate;
+    }
+}
+
+// Display IP source graph, one page of the current sort key. The parse
+// thread keeps the lists sorted, so drawing is linear in the page size.
+static void display_source_graph(DisplaySnapshot *snapshot) {
+    const TopKItem *items = snapshot->sources[source_sort];
+    int count = snapshot->source_count[source_sort];
+    int pages = count > 0 ? (count + DISPLAY_SOURCE_ROWS - 1) / DISPLAY_SOURCE_ROWS : 1;
+    
+    if (source_page >= pages) {
+        source_page = pages - 1;
+    }
+    
     printf("\033[H");  // Move cursor to home position
     
     printf("%s======== Top IP Sources ========%s\n\n", COLOR_BOLD, COLOR_RESET);
+    printf("Sorted by %s%s%s, page %d/%d, %lu sources tracked (o: sort, n/p: page)\n\n",
+           COLOR_BOLD, topk_key_name(source_sort), COLOR_RESET, source_page + 1, pages,
+           snapshot->sources_tracked);
     
-    // Sort top sources by count
-    for (int i = 0; i < 9; i++) {
-        for (int j = i + 1; j < 10; j++) {
-            if (stats.top_sources[j].count > stats.top_sources[i].count) {
-                // Swap
-                char temp_ip[MAX_ADDR_STR_LEN];
-                unsigned long temp_count = stats.top_sources[i].count;
-                
-                strncpy(temp_ip, stats.top_sources[i].ip, MAX_ADDR_STR_LEN);
-                strncpy(stats.top_sources[i].ip, stats.top_sources[j].ip, MAX_ADDR_STR_LEN);
-                strncpy(stats.top_sources[j].ip, temp_ip, MAX_ADDR_STR_LEN);
-                
-                stats.top_sources[i].count = stats.top_sources[j].count;
-                stats.top_sources[j].count = temp_count;
-            }
-        }
+    if (count == 0) {
+        printf("No data available yet.\n");
+        return;
     }
     
-    // Find maximum count for scaling
-    unsigned long max_count = 0;
-    for (int i = 0; i < 10; i++) {
-        if (stats.top_sources[i].count > max_count) {
-            max_count = stats.top_sources[i].count;
+    // Bars are scaled to the largest source overall, so pages compare
+    const int graph_width = 30;
+    double max_value = source_value(&items[0], source_sort);
+    int first = source_page * DISPLAY_SOURCE_ROWS;
+    int last = first + DISPLAY_SOURCE_ROWS < count ? first + DISPLAY_SOURCE_ROWS : count;
+    
+    printf("%5s %-15s %10s %12s %12s\n", "Rank", "Source", "Packets", "Bytes", "Rate/s");
+    for (int i = first; i < last; i++) {
+        char addr[MAX_ADDR_STR_LEN], bytes[24], rate[24];
+        int bar_width = max_value > 0 ?
+                        (int)(source_value(&items[i], source_sort) * graph_width / max_value) : 0;
+        if (bar_width < 1) bar_width = 1;
+        
+        format_ipv4(items[i].key, addr, sizeof(addr));
+        format_bytes(items[i].bytes, bytes, sizeof(bytes));
+        format_bytes((unsigned long)items[i].rate, rate, sizeof(rate));
+        printf("%5d %-15s %10lu %12s %12s ", i + 1, addr, items[i].packets, bytes, rate);
+        
+        for (int j = 0; j < bar_width; j++) {
+            printf("█");
         }
+        printf("\033[K\n");
+    }
+}
+
+// Display recent scan and flood alerts
+static void display_alerts(DisplaySnapshot *snapshot) {
+    printf("\033[H");  // Move cursor to home position
+    
+    printf("%s======== Alerts ========%s\n\n", COLOR_BOLD, COLOR_RESET);
+    printf("Total alerts: %lu\n\n", snapshot->alert_total);
+    
+    if (snapshot->alert_count == 0) {
+        printf("No alerts raised.\n");
+        return;
     }
     
-    // Display graph
-    if (max_count > 0) {
-        const int graph_width = 50;
+    for (int i = 0; i < snapshot->alert_count; i++) {
+        const DetectAlert *alert = &snapshot->alerts[i];
+        char time_str[20];
+        char addr[MAX_ADDR_STR_LEN];
+        struct tm tm_info;
         
-        for (int i = 0; i < 10; i++) {
-            if (stats.top_sources[i].ip[0] == '\0') {
-                continue;
-            }
-            
-            int bar_width = (stats.top_sources[i].count * graph_width) / max_count;
-            if (bar_width < 1) bar_width = 1;
-            
-            printf("%-15s [%5lu] ", stats.top_sources[i].ip, stats.top_sources[i].count);
-            
-            for (int j = 0; j < bar_width; j++) {
-                printf("█");
-            }
-            printf("\n");
-        }
+        localtime_r(&alert->time, &tm_info);
+        strftime(time_str, sizeof(time_str), "%H:%M:%S", &tm_info);
+        format_ipv4(alert->addr, addr, sizeof(addr));
+        printf("%s[%s]%s %s%-18s%s %-15s %8lu %s\n",
+               COLOR_CYAN, time_str, COLOR_RESET,
+               COLOR_RED, detect_alert_name(alert->type), COLOR_RESET, addr,
+               alert->value,
+               alert->type & (ALERT_SYN_FLOOD_FROM | ALERT_SYN_FLOOD_TO) ? "SYNs" :
+               alert->type == ALERT_PORT_SCAN ? "ports" : "hosts");
+    }
+}
+
+// One RTT percentile in milliseconds, or a dash without samples
+static void print_rtt(const LogHistogram *rtt, double percentile) {
+    if (rtt->count == 0) {
+        printf(" %8s", "-");
     } else {
-        printf("No data available yet.\n");
+        printf(" %8.2f", loghist_percentile(rtt, percentile) * TCPSTAT_RTT_UNIT_USEC / 1000.0);
     }
 }
 
-// Update display based on current mode
-void display_update(void) {
+static void print_server_latency(const char *name, const TcpServerStats *server) {
+    printf("%-21s %10lu %8lu", name, server->packets, server->handshakes);
+    print_rtt(&server->handshake_rtt, 50);
+    print_rtt(&server->handshake_rtt, 99);
+    print_rtt(&server->data_rtt, 50);
+    print_rtt(&server->data_rtt, 99);
+    printf(" %8lu %8lu %8lu\n", server->retransmits, server->out_of_order, server->zero_windows);
+}
+
+// Display passive TCP latency, retransmissions and window closures
+static void display_latency(DisplaySnapshot *snapshot) {
+    const TcpStatSnapshot *tcp = &snapshot->tcp;
+    
+    printf("\033[H");  // Move cursor to home position
+    
+    printf("%s======== TCP Latency ========%s\n\n", COLOR_BOLD, COLOR_RESET);
+    printf("Connections tracked: %lu\n", tcp->connections);
+    printf("Handshake RTT: SYN to ACK. Data RTT: segment to ACK, from the capture point.\n\n");
+    
+    if (tcp->total.packets == 0) {
+        printf("No TCP traffic seen yet.\n");
+        return;
+    }
+    
+    printf("%-21s %10s %8s %17s %17s %8s %8s %8s\n", "", "", "",
+           "Handshake RTT ms", "Data RTT ms", "", "Out of", "Zero");
+    printf("%-21s %10s %8s %8s %8s %8s %8s %8s %8s %8s\n", "Server", "Packets", "Conns",
+           "p50", "p99", "p50", "p99", "Retrans", "order", "windows");
+    print_server_latency("All", &tcp->total);
+    printf("\n");
+    
+    for (int i = 0; i < tcp->server_count; i++) {
+        const TcpServerStats *server = &tcp->servers[i];
+        char addr[MAX_ADDR_STR_LEN], name[MAX_ADDR_STR_LEN + 8];
+        
+        format_ipv4(server->addr, addr, sizeof(addr));
+        snprintf(name, sizeof(name), "%s:%u", addr, server->port);
+        print_server_latency(name, server);
+    }
+}
+
+// Gather what the display modes show from the local modules
+void display_fill_snapshot(DisplaySnapshot *snapshot) {
+    memcpy(&snapshot->stats, stats, sizeof(PacketStats));
+    strncpy(snapshot->filter, filter_current()->expression, MAX_FILTER_LEN - 1);
+    snapshot->filter[MAX_FILTER_LEN - 1] = '\0';
+    snapshot->shed_enabled = sampler_enabled();
+    snapshot->shed_level = sampler_level();
+    snapshot->sample_rate = sampler_rate();
+    snapshot->flow_export = ipfix_enabled();
+    snapshot->flow_records = ipfix_records_sent();
+    snapshot->flow_datagrams = ipfix_datagrams_sent();
+    snapshot->alert_total = detect_alert_total();
+    snapshot->alert_count = detect_recent_alerts(snapshot->alerts, DISPLAY_RECENT_ALERTS);
+    tcpstat_snapshot(&snapshot->tcp);
+    pipeline_stats(&snapshot->pipeline);
+    snapshot->sources_tracked = stats_sources_tracked();
+    for (int sort = 0; sort < TOPK_KEYS; sort++) {
+        snapshot->source_count[sort] = stats_top_sources(sort, snapshot->sources[sort], TOPK_K);
+    }
+}
+
+// Called by the thread that owns the statistics; readers only ever wait
+// for one copy
+void display_publish(void) {
+    static DisplaySnapshot scratch;
+    
+    display_fill_snapshot(&scratch);
+    pthread_mutex_lock(&published_lock);
+    memcpy(&published, &scratch, sizeof(published));
+    pthread_mutex_unlock(&published_lock);
+}
+
+void display_latest(DisplaySnapshot *snapshot) {
+    pthread_mutex_lock(&published_lock);
+    memcpy(snapshot, &published, sizeof(*snapshot));
+    pthread_mutex_unlock(&published_lock);
+}
+
+// Render the current mode from a snapshot, local or remote
+void display_render(DisplaySnapshot *snapshot) {
+    memcpy(shown_filter, snapshot->filter, MAX_FILTER_LEN);
+    
     switch (display_mode) {
-        case 1:  // Statistics mode
-            display_statistics();
+        case DISPLAY_STATS:
+            display_statistics(snapshot);
+            break;
+        case DISPLAY_GRAPH:
+            display_source_graph(snapshot);
             break;
-        case 2:  // Graph mode
-            display_source_graph();
+        case DISPLAY_ALERTS:
+            display_alerts(snapshot);
             break;
-        default:  // Packet list mode (no special update needed)
+        case DISPLAY_LATENCY:
+            display_latency(snapshot);
+            break;
+        default:  // Packet list mode
+            // Announce shed level changes inline with the packet stream
+            if (snapshot->shed_enabled && snapshot->shed_level != shown_shed_level) {
+                shown_shed_level = snapshot->shed_level;
+                printf("%s-- load shedding: %s (level %d/%d, 1-in-%u sampled) --%s\n",
+                       COLOR_MAGENTA, sampler_level_name(shown_shed_level),
+                       shown_shed_level, SHED_MAX, snapshot->sample_rate, COLOR_RESET);
+            }
+            // ...and new alerts
+            if (snapshot->alert_total != shown_alerts) {
+                unsigned long fresh = snapshot->alert_total - shown_alerts;
+                int count = fresh < (unsigned long)snapshot->alert_count ? (int)fresh
+                                                                         : snapshot->alert_count;
+                
+                for (int i = count - 1; i >= 0; i--) {
+                    const DetectAlert *alert = &snapshot->alerts[i];
+                    char addr[MAX_ADDR_STR_LEN];
+                    
+                    format_ipv4(alert->addr, addr, sizeof(addr));
+                    printf("%s-- alert: %s %s (%lu) --%s\n", COLOR_RED,
+                           detect_alert_name(alert->type), addr, alert->value, COLOR_RESET);
+                }
+                shown_alerts = snapshot->alert_total;
+            }
             break;
     }
 }
 
+// Update display based on current mode
+void display_update(void) {
+    static DisplaySnapshot snapshot;
+    
+    display_latest(&snapshot);
+    display_render(&snapshot);
+}
+
+void display_set_mode(int mode) {
+    if (mode >= 0 && mode < DISPLAY_MODES) {
+        display_mode = mode;
+    }
+}
+
 // Display help information
 void display_help(void) {
     printf("\033[2J\033[H");  // Clear screen
@@ -256,14 +631,19 @@ void display_help(void) {
     printf("Keyboard Commands:\n");
     printf("  %sq%s - Quit the application\n", COLOR_BOLD, COLOR_RESET);
     printf("  %sh%s - Show this help screen\n", COLOR_BOLD, COLOR_RESET);
-    printf("  %sm%s - Cycle through display modes (packet list, statistics, graph)\n", COLOR_BOLD, COLOR_RESET);
+    printf("  %sm%s - Cycle through display modes (packet list, statistics, graph, alerts, latency)\n", COLOR_BOLD, COLOR_RESET);
     printf("  %ss%s - Toggle auto-scroll in packet list mode\n", COLOR_BOLD, COLOR_RESET);
     printf("  %sd%s - Toggle detailed packet view\n", COLOR_BOLD, COLOR_RESET);
+    printf("  %sf%s - Change the capture filter (Enter applies, Esc cancels)\n", COLOR_BOLD, COLOR_RESET);
+    printf("  %so%s - Sort top sources by packets, bytes or rate (graph mode)\n", COLOR_BOLD, COLOR_RESET);
+    printf("  %sn%s/%sp%s - Next/previous page of top sources (graph mode)\n", COLOR_BOLD, COLOR_RESET, COLOR_BOLD, COLOR_RESET);
     
     printf("\nDisplay Modes:\n");
     printf("  %sPacket List%s - Shows captured packets in real-time\n", COLOR_BOLD, COLOR_RESET);
     printf("  %sStatistics%s - Shows packet count and protocol breakdown\n", COLOR_BOLD, COLOR_RESET);
-    printf("  %sGraph%s - Shows graph of top source IP addresses\n", COLOR_BOLD, COLOR_RESET);
+    printf("  %sGraph%s - Shows the %d busiest source IP addresses by packets, bytes or rate\n", COLOR_BOLD, COLOR_RESET, TOPK_K);
+    printf("  %sAlerts%s - Shows port scan, host sweep and SYN flood alerts\n", COLOR_BOLD, COLOR_RESET);
+    printf("  %sLatency%s - Shows TCP round-trip times and retransmissions per server\n", COLOR_BOLD, COLOR_RESET);
     
     printf("\nPress any key to return...\n");
     
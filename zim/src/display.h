@@ -2,12 +2,58 @@
 #define ZIM_DISPLAY_H
 
 #include "network.h"
+#include "packet_parser.h"
+#include "detect.h"
+#include "tcpstat.h"
+#include "pipeline.h"
+
+// Display modes
+#define DISPLAY_PACKETS 0
+#define DISPLAY_STATS   1
+#define DISPLAY_GRAPH   2
+#define DISPLAY_ALERTS  3
+#define DISPLAY_LATENCY 4
+#define DISPLAY_MODES   5
+
+#define DISPLAY_RECENT_ALERTS 20
+#define DISPLAY_SOURCE_ROWS 20  // Sources per page in the graph mode
+
+// Returned by display_check_input() once a filter has been typed in
+#define DISPLAY_KEY_FILTER 'f'
+
+// Everything the display modes render. Gathered from the local modules
+// by the parse thread and published for the main thread and the control
+// socket, or received from a daemon's control socket by 'zim attach'.
+typedef struct {
+    PacketStats stats;
+    char filter[MAX_FILTER_LEN];
+    int shed_enabled;
+    int shed_level;
+    unsigned int sample_rate;
+    int flow_export;
+    unsigned long flow_records;
+    unsigned long flow_datagrams;
+    unsigned long alert_total;
+    int alert_count;
+    DetectAlert alerts[DISPLAY_RECENT_ALERTS];  // Newest first
+    TcpStatSnapshot tcp;
+    PipelineStats pipeline;
+    unsigned long sources_tracked;
+    int source_count[TOPK_KEYS];
+    TopKItem sources[TOPK_KEYS][TOPK_K];  // Per sort key, largest first
+} DisplaySnapshot;
 
 // Function prototypes
 void display_init(void);
 void display_cleanup(void);
 int display_check_input(void);
 void display_update(void);
+void display_fill_snapshot(DisplaySnapshot *snapshot);
+void display_publish(void);
+void display_latest(DisplaySnapshot *snapshot);
+void display_render(DisplaySnapshot *snapshot);
+void display_set_mode(int mode);
+const char *display_filter_input(void);
 void display_packet(Packet *packet);
 void display_help(void);
 
@@ -1,13 +1,535 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
+#include <stdatomic.h>
 #include "filter.h"
+#include "qsbr.h"
+#include "utils.h"
 
-// This is a placeholder for packet filtering functionality.
-// In a real implementation, this would use libpcap's filtering capabilities
-// or implement a custom filtering engine.
+// Ethernet + IPv4 offsets used by the generated code
+#define OFF_ETHERTYPE 12
+#define OFF_IP 14
+#define OFF_IP_PROTO (OFF_IP + 9)
+#define OFF_IP_FRAG (OFF_IP + 6)
+#define OFF_IP_SRC (OFF_IP + 12)
+#define OFF_IP_DST (OFF_IP + 16)
+#define ETHERTYPE_IPV4 0x0800
 
-int filter_packet(const char *filter, const void *packet, int size) {
-    // Always return true for now (no filtering)
-    return 1;
-}
\ No newline at end of file
+// Expression tree
+#define NODE_AND 0
+#define NODE_OR 1
+#define NODE_NOT 2
+#define NODE_IP 3
+#define NODE_PROTO 4
+#define NODE_HOST 5
+#define NODE_NET 6
+#define NODE_PORT 7
+
+#define DIR_ANY 0
+#define DIR_SRC 1
+#define DIR_DST 2
+
+typedef struct {
+    int type;
+    int left, right;  // Child nodes
+    int dir;
+    unsigned int value;
+    unsigned int mask;
+} FilterNode;
+
+#define LABEL_NEXT -1  // Fall through to the next instruction
+#define MAX_LABELS (FILTER_MAX_NODES * 4 + 2)
+
+typedef struct {
+    // Parser
+    const char *input;
+    char token[64];
+    FilterNode nodes[FILTER_MAX_NODES];
+    int node_count;
+    
+    // Code generator: jump targets are labels until resolved
+    FilterProgram *program;
+    int jt[FILTER_MAX_INSNS];
+    int jf[FILTER_MAX_INSNS];
+    int labels[MAX_LABELS];
+    int label_count;
+    
+    char *error;
+    size_t error_size;
+    int failed;
+} FilterCompiler;
+
+static void compile_error(FilterCompiler *c, const char *message) {
+    if (!c->failed) {
+        snprintf(c->error, c->error_size, "%s", message);
+        c->failed = 1;
+    }
+}
+
+// Parser
+
+static void next_token(FilterCompiler *c) {
+    const char *p = c->input;
+    size_t length = 0;
+    
+    while (isspace((unsigned char)*p)) {
+        p++;
+    }
+    
+    if (*p == '(' || *p == ')' || *p == '!') {
+        c->token[length++] = *p++;
+    } else if ((p[0] == '&' && p[1] == '&') || (p[0] == '|' && p[1] == '|')) {
+        c->token[length++] = *p++;
+        c->token[length++] = *p++;
+    } else {
+        while (*p != '\0' && !isspace((unsigned char)*p) && strchr("()!&|", *p) == NULL) {
+            if (length < sizeof(c->token) - 1) {
+                c->token[length++] = *p;
+            }
+            p++;
+        }
+    }
+    
+    c->token[length] = '\0';
+    c->input = p;
+}
+
+static int accept_token(FilterCompiler *c, const char *word) {
+    if (strcmp(c->token, word) == 0) {
+        next_token(c);
+        return 1;
+    }
+    return 0;
+}
+
+static int new_node(FilterCompiler *c, int type) {
+    if (c->node_count == FILTER_MAX_NODES) {
+        compile_error(c, "filter too complex");
+        return 0;
+    }
+    
+    FilterNode *node = &c->nodes[c->node_count];
+    memset(node, 0, sizeof(*node));
+    node->type = type;
+    return c->node_count++;
+}
+
+static int parse_expr(FilterCompiler *c);
+
+static int parse_number(FilterCompiler *c, unsigned int max, unsigned int *value) {
+    char *end;
+    unsigned long number = strtoul(c->token, &end, 10);
+    
+    if (c->token[0] == '\0' || *end != '\0' || number > max) {
+        return -1;
+    }
+    *value = number;
+    next_token(c);
+    return 0;
+}
+
+static int parse_primitive(FilterCompiler *c) {
+    int dir = DIR_ANY;
+    int node;
+    
+    if (accept_token(c, "ip")) {
+        return new_node(c, NODE_IP);
+    }
+    if (strcmp(c->token, "tcp") == 0 || strcmp(c->token, "udp") == 0 ||
+        strcmp(c->token, "icmp") == 0) {
+        node = new_node(c, NODE_PROTO);
+        c->nodes[node].value = c->token[0] == 't' ? PROTO_TCP :
+                               c->token[0] == 'u' ? PROTO_UDP : PROTO_ICMP;
+        next_token(c);
+        return node;
+    }
+    
+    if (accept_token(c, "src")) {
+        dir = DIR_SRC;
+    } else if (accept_token(c, "dst")) {
+        dir = DIR_DST;
+    }
+    
+    if (accept_token(c, "port")) {
+        node = new_node(c, NODE_PORT);
+        if (parse_number(c, 65535, &c->nodes[node].value) != 0) {
+            compile_error(c, "expected a port number");
+        }
+    } else if (accept_token(c, "net")) {
+        char *slash = strchr(c->token, '/');
+        unsigned int bits = 32;
+        
+        node = new_node(c, NODE_NET);
+        if (slash != NULL) {
+            *slash = '\0';
+            bits = atoi(slash + 1);
+        }
+        if (bits > 32 || parse_ipv4(c->token, &c->nodes[node].value) != 0) {
+            compile_error(c, "expected <address>/<bits> after 'net'");
+        }
+        c->nodes[node].mask = bits == 0 ? 0 : 0xffffffffu << (32 - bits);
+        c->nodes[node].value &= c->nodes[node].mask;
+        next_token(c);
+    } else {
+        // "host" is optional before an address
+        accept_token(c, "host");
+        node = new_node(c, NODE_HOST);
+        if (parse_ipv4(c->token, &c->nodes[node].value) != 0) {
+            compile_error(c, c->token[0] != '\0' ? "unknown filter primitive" : "unexpected end of filter");
+        }
+        next_token(c);
+    }
+    
+    c->nodes[node].dir = dir;
+    return node;
+}
+
+static int parse_factor(FilterCompiler *c) {
+    if (accept_token(c, "not") || accept_token(c, "!")) {
+        int node = new_node(c, NODE_NOT);
+        c->nodes[node].left = parse_factor(c);
+        return node;
+    }
+    
+    if (accept_token(c, "(")) {
+        int node = parse_expr(c);
+        if (!accept_token(c, ")")) {
+            compile_error(c, "missing ')'");
+        }
+        return node;
+    }
+    
+    return parse_primitive(c);
+}
+
+static int parse_term(FilterCompiler *c) {
+    int left = parse_factor(c);
+    
+    while (!c->failed && (accept_token(c, "and") || accept_token(c, "&&"))) {
+        int node = new_node(c, NODE_AND);
+        c->nodes[node].left = left;
+        c->nodes[node].right = parse_factor(c);
+        left = node;
+    }
+    
+    return left;
+}
+
+static int parse_expr(FilterCompiler *c) {
+    int left = parse_term(c);
+    
+    while (!c->failed && (accept_token(c, "or") || accept_token(c, "||"))) {
+        int node = new_node(c, NODE_OR);
+        c->nodes[node].left = left;
+        c->nodes[node].right = parse_term(c);
+        left = node;
+    }
+    
+    return left;
+}
+
+// Code generator. Every jump is forward: a node's code always sits
+// before the labels it jumps to.
+
+static int new_label(FilterCompiler *c) {
+    if (c->label_count == MAX_LABELS) {
+        compile_error(c, "filter too complex");
+        return 0;
+    }
+    c->labels[c->label_count] = -1;
+    return c->label_count++;
+}
+
+static void place_label(FilterCompiler *c, int label) {
+    c->labels[label] = c->program->length;
+}
+
+static void emit(FilterCompiler *c, unsigned short code, unsigned int k, int jt, int jf) {
+    if (c->program->length == FILTER_MAX_INSNS) {
+        compile_error(c, "filter too complex");
+        return;
+    }
+    
+    int i = c->program->length++;
+    c->program->code[i].code = code;
+    c->program->code[i].k = k;
+    c->jt[i] = jt;
+    c->jf[i] = jf;
+}
+
+static void emit_ipv4_check(FilterCompiler *c, int fail) {
+    emit(c, BPF_LD | BPF_H | BPF_ABS, OFF_ETHERTYPE, 0, 0);
+    emit(c, BPF_JMP | BPF_JEQ | BPF_K, ETHERTYPE_IPV4, LABEL_NEXT, fail);
+}
+
+// Compare an address field (masked for nets) against value
+static void emit_address(FilterCompiler *c, const FilterNode *node, int pass, int fail) {
+    unsigned int offsets[2] = {OFF_IP_SRC, OFF_IP_DST};
+    int first = node->dir == DIR_DST ? 1 : 0;
+    int last = node->dir == DIR_SRC ? 0 : 1;
+    
+    emit_ipv4_check(c, fail);
+    for (int i = first; i <= last; i++) {
+        emit(c, BPF_LD | BPF_W | BPF_ABS, offsets[i], 0, 0);
+        if (node->type == NODE_NET) {
+            emit(c, BPF_ALU | BPF_AND | BPF_K, node->mask, 0, 0);
+        }
+        emit(c, BPF_JMP | BPF_JEQ | BPF_K, node->value, pass, i == last ? fail : LABEL_NEXT);
+    }
+}
+
+static void emit_port(FilterCompiler *c, const FilterNode *node, int pass, int fail) {
+    int transport = new_label(c);
+    int first = node->dir == DIR_DST ? 1 : 0;
+    int last = node->dir == DIR_SRC ? 0 : 1;
+    
+    emit_ipv4_check(c, fail);
+    emit(c, BPF_LD | BPF_B | BPF_ABS, OFF_IP_PROTO, 0, 0);
+    emit(c, BPF_JMP | BPF_JEQ | BPF_K, PROTO_TCP, transport, LABEL_NEXT);
+    emit(c, BPF_JMP | BPF_JEQ | BPF_K, PROTO_UDP, LABEL_NEXT, fail);
+    place_label(c, transport);
+    
+    // Only the first fragment carries the ports
+    emit(c, BPF_LD | BPF_H | BPF_ABS, OFF_IP_FRAG, 0, 0);
+    emit(c, BPF_JMP | BPF_JSET | BPF_K, 0x1fff, fail, LABEL_NEXT);
+    emit(c, BPF_LDX | BPF_B | BPF_MSH, OFF_IP, 0, 0);
+    for (int i = first; i <= last; i++) {
+        emit(c, BPF_LD | BPF_H | BPF_IND, OFF_IP + 2 * i, 0, 0);
+        emit(c, BPF_JMP | BPF_JEQ | BPF_K, node->value, pass, i == last ? fail : LABEL_NEXT);
+    }
+}
+
+static void generate(FilterCompiler *c, int index, int pass, int fail) {
+    const FilterNode *node = &c->nodes[index];
+    int middle;
+    
+    if (c->failed) {
+        return;
+    }
+    
+    switch (node->type) {
+        case NODE_AND:
+            middle = new_label(c);
+            generate(c, node->left, middle, fail);
+            place_label(c, middle);
+            generate(c, node->right, pass, fail);
+            break;
+        case NODE_OR:
+            middle = new_label(c);
+            generate(c, node->left, pass, middle);
+            place_label(c, middle);
+            generate(c, node->right, pass, fail);
+            break;
+        case NODE_NOT:
+            generate(c, node->left, fail, pass);
+            break;
+        case NODE_IP:
+            emit_ipv4_check(c, fail);
+            emit(c, BPF_JMP | BPF_JA, 0, pass, 0);
+            break;
+        case NODE_PROTO:
+            emit_ipv4_check(c, fail);
+            emit(c, BPF_LD | BPF_B | BPF_ABS, OFF_IP_PROTO, 0, 0);
+            emit(c, BPF_JMP | BPF_JEQ | BPF_K, node->value, pass, fail);
+            break;
+        case NODE_HOST:
+        case NODE_NET:
+            emit_address(c, node, pass, fail);
+            break;
+        case NODE_PORT:
+            emit_port(c, node, pass, fail);
+            break;
+    }
+}
+
+// Turn labels into relative offsets
+static void resolve(FilterCompiler *c) {
+    for (int i = 0; i < c->program->length && !c->failed; i++) {
+        struct sock_filter *insn = &c->program->code[i];
+        
+        if (BPF_CLASS(insn->code) != BPF_JMP) {
+            continue;
+        }
+        if (BPF_OP(insn->code) == BPF_JA) {
+            insn->k = c->labels[c->jt[i]] - (i + 1);
+            continue;
+        }
+        
+        int jt = c->jt[i] == LABEL_NEXT ? 0 : c->labels[c->jt[i]] - (i + 1);
+        int jf = c->jf[i] == LABEL_NEXT ? 0 : c->labels[c->jf[i]] - (i + 1);
+        if (jt > 255 || jf > 255) {
+            compile_error(c, "filter too complex");
+        }
+        insn->jt = jt;
+        insn->jf = jf;
+    }
+}
+
+static unsigned long next_generation = 2;  // 1 is the built-in accept-all
+
+// Compile an expression; an empty expression accepts everything
+FilterProgram *filter_compile(const char *expression, char *error, size_t error_size) {
+    FilterCompiler *c = calloc(1, sizeof(FilterCompiler));
+    FilterProgram *program = calloc(1, sizeof(FilterProgram));
+    
+    if (c == NULL || program == NULL) {
+        snprintf(error, error_size, "out of memory");
+        free(c);
+        free(program);
+        return NULL;
+    }
+    
+    c->input = expression;
+    c->program = program;
+    c->error = error;
+    c->error_size = error_size;
+    strncpy(program->expression, expression, MAX_FILTER_LEN - 1);
+    
+    next_token(c);
+    if (c->token[0] == '\0') {
+        emit(c, BPF_RET | BPF_K, FILTER_SNAPLEN, 0, 0);
+    } else {
+        int root = parse_expr(c);
+        if (!c->failed && c->token[0] != '\0') {
+            compile_error(c, "unexpected text after filter");
+        }
+        
+        int accept_label = new_label(c);
+        int reject_label = new_label(c);
+        generate(c, root, accept_label, reject_label);
+        place_label(c, accept_label);
+        emit(c, BPF_RET | BPF_K, FILTER_SNAPLEN, 0, 0);
+        place_label(c, reject_label);
+        emit(c, BPF_RET | BPF_K, 0, 0, 0);
+        resolve(c);
+    }
+    
+    if (c->failed) {
+        free(c);
+        free(program);
+        return NULL;
+    }
+    
+    program->generation = next_generation++;
+    free(c);
+    return program;
+}
+
+void filter_free(FilterProgram *program) {
+    free(program);
+}
+
+static unsigned int load(const unsigned char *packet, unsigned int length,
+                         unsigned int offset, unsigned int size, int *fault) {
+    if (offset > length || size > length - offset) {
+        *fault = 1;
+        return 0;
+    }
+    
+    switch (size) {
+        case 4:
+            return (unsigned int)packet[offset] << 24 | packet[offset + 1] << 16 |
+                   packet[offset + 2] << 8 | packet[offset + 3];
+        case 2:
+            return packet[offset] << 8 | packet[offset + 1];
+        default:
+            return packet[offset];
+    }
+}
+
+// Classic BPF interpreter for the instructions the compiler emits.
+// Returns the number of bytes to keep, 0 to drop (as the kernel does).
+unsigned int filter_run(const FilterProgram *program, const unsigned char *packet, unsigned int length) {
+    unsigned int a = 0, x = 0;
+    int fault = 0;
+    
+    for (unsigned int pc = 0; pc < program->length; pc++) {
+        const struct sock_filter *insn = &program->code[pc];
+        unsigned int size = BPF_SIZE(insn->code) == BPF_W ? 4 : BPF_SIZE(insn->code) == BPF_H ? 2 : 1;
+        
+        switch (insn->code) {
+            case BPF_LD | BPF_W | BPF_ABS:
+            case BPF_LD | BPF_H | BPF_ABS:
+            case BPF_LD | BPF_B | BPF_ABS:
+                a = load(packet, length, insn->k, size, &fault);
+                break;
+            case BPF_LD | BPF_W | BPF_IND:
+            case BPF_LD | BPF_H | BPF_IND:
+            case BPF_LD | BPF_B | BPF_IND:
+                a = load(packet, length, x + insn->k, size, &fault);
+                break;
+            case BPF_LDX | BPF_B | BPF_MSH:
+                x = (load(packet, length, insn->k, 1, &fault) & 0xf) << 2;
+                break;
+            case BPF_ALU | BPF_AND | BPF_K:
+                a &= insn->k;
+                break;
+            case BPF_JMP | BPF_JA:
+                pc += insn->k;
+                break;
+            case BPF_JMP | BPF_JEQ | BPF_K:
+                pc += a == insn->k ? insn->jt : insn->jf;
+                break;
+            case BPF_JMP | BPF_JSET | BPF_K:
+                pc += a & insn->k ? insn->jt : insn->jf;
+                break;
+            case BPF_RET | BPF_K:
+                return insn->k;
+            default:
+                return 0;
+        }
+        
+        // Loads past the end of the packet reject it
+        if (fault) {
+            return 0;
+        }
+    }
+    
+    return 0;
+}
+
+// Runtime swapping. The current program is published through an atomic
+// pointer; replaced programs are freed once no reader can hold them.
+
+static FilterProgram accept_all = {
+    .expression = "",
+    .generation = 1,
+    .length = 1,
+    .code = {BPF_STMT(BPF_RET | BPF_K, FILTER_SNAPLEN)},
+};
+
+static _Atomic(FilterProgram *) current = &accept_all;
+
+const FilterProgram *filter_current(void) {
+    return atomic_load_explicit(&current, memory_order_acquire);
+}
+
+static void release_program(void *program) {
+    if (program != &accept_all) {
+        filter_free(program);
+    }
+}
+
+// Compile and publish a new filter. Only the main loop swaps filters.
+int filter_swap(const char *expression, char *error, size_t error_size) {
+    FilterProgram *program = filter_compile(expression, error, error_size);
+    
+    if (program == NULL) {
+        return -1;
+    }
+    
+    FilterProgram *old = atomic_exchange(&current, program);
+    qsbr_retire(old, release_program);
+    return 0;
+}
+
+void filter_reclaim(void) {
+    qsbr_reclaim();
+}
+
+// After every reader has stopped
+void filter_cleanup(void) {
+    qsbr_reclaim();
+    release_program(atomic_exchange(&current, &accept_all));
+}
@@ -1,7 +1,46 @@
 #ifndef ZIM_FILTER_H
 #define ZIM_FILTER_H
 
+#include <stddef.h>
+#include <linux/filter.h>
+#include "config.h"
+
+// Filter expressions are compiled to classic BPF. The same program is
+// attached to the capture sockets (SO_ATTACH_FILTER) and run in user
+// space by filter_run(), so both sides agree exactly.
+//
+// Grammar (tcpdump style, IPv4 over Ethernet):
+//   expr      := term { ("or" | "||") term }
+//   term      := factor { ("and" | "&&") factor }
+//   factor    := ("not" | "!") factor | "(" expr ")" | primitive
+//   primitive := "ip" | "tcp" | "udp" | "icmp"
+//              | ["src" | "dst"] "host" <addr> | ["src" | "dst"] <addr>
+//              | ["src" | "dst"] "net" <addr>/<bits>
+//              | ["src" | "dst"] "port" <number>
+#define FILTER_MAX_INSNS 256
+#define FILTER_MAX_NODES 64
+#define FILTER_SNAPLEN 0x40000  // Accept: keep the whole packet
+
+// A compiled filter. Programs are immutable once published; each has a
+// unique generation so packets can record which program admitted them.
+typedef struct {
+    char expression[MAX_FILTER_LEN];
+    unsigned long generation;
+    unsigned short length;
+    struct sock_filter code[FILTER_MAX_INSNS];
+} FilterProgram;
+
 // Function prototypes
-int filter_packet(const char *filter, const void *packet, int size);
+FilterProgram *filter_compile(const char *expression, char *error, size_t error_size);
+void filter_free(FilterProgram *program);
+unsigned int filter_run(const FilterProgram *program, const unsigned char *packet, unsigned int length);
+
+// Runtime swapping. The parse thread reads the current program as a QSBR
+// reader; the main thread swaps it; capture threads only keep the
+// generation of the program attached to their socket.
+const FilterProgram *filter_current(void);
+int filter_swap(const char *expression, char *error, size_t error_size);
+void filter_reclaim(void);
+void filter_cleanup(void);
 
-#endif // ZIM_FILTER_H
\ No newline at end of file
+#endif // ZIM_FILTER_H
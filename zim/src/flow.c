@@ -0,0 +1,143 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "flow.h"
+#include "tcpstat.h"
+
+static FlowRecord *table = NULL;
+static FlowExportFn export_flow = NULL;
+static uint64_t last_packet_ms = 0;
+
+static uint32_t flow_hash(unsigned int src_addr, unsigned int dst_addr,
+                          unsigned short src_port, unsigned short dst_port,
+                          unsigned char protocol, unsigned int tunnel_id) {
+    uint64_t key = ((uint64_t)src_addr << 32) | dst_addr;
+    
+    key ^= ((uint64_t)src_port << 24) ^ ((uint64_t)dst_port << 8) ^ protocol;
+    key ^= (uint64_t)tunnel_id * 0x9e3779b97f4a7c15ULL;
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    
+    return key;
+}
+
+int flow_init(FlowExportFn exporter) {
+    table = calloc(FLOW_BUCKETS * FLOW_WAYS, sizeof(FlowRecord));
+    if (table == NULL) {
+        perror("calloc");
+        return -1;
+    }
+    
+    export_flow = exporter;
+    return 0;
+}
+
+void flow_cleanup(void) {
+    free(table);
+    table = NULL;
+}
+
+static void flow_close(FlowRecord *flow) {
+    if (export_flow != NULL) {
+        export_flow(flow);
+    }
+    flow->used = 0;
+}
+
+// Account one parsed packet against its flow. Non-IP frames are ignored.
+void flow_update(Packet *packet) {
+    if (table == NULL || packet->ip_header == NULL) {
+        return;
+    }
+    
+    uint64_t now = (uint64_t)packet->timestamp.tv_sec * 1000 + packet->timestamp.tv_usec / 1000;
+    uint32_t bucket = flow_hash(packet->src_addr, packet->dst_addr, packet->src_port,
+                                packet->dst_port, packet->protocol, packet->tunnel_id) % FLOW_BUCKETS;
+    FlowRecord *set = &table[bucket * FLOW_WAYS];
+    FlowRecord *flow = NULL, *victim = NULL;
+    
+    last_packet_ms = now;
+    
+    for (int i = 0; i < FLOW_WAYS; i++) {
+        FlowRecord *entry = &set[i];
+        
+        if (!entry->used) {
+            if (victim == NULL || victim->used) {
+                victim = entry;
+            }
+            continue;
+        }
+        if (entry->src_addr == packet->src_addr && entry->dst_addr == packet->dst_addr &&
+            entry->src_port == packet->src_port && entry->dst_port == packet->dst_port &&
+            entry->protocol == packet->protocol && entry->tunnel_id == packet->tunnel_id) {
+            flow = entry;
+            break;
+        }
+        if (victim == NULL || (victim->used && entry->last_ms < victim->last_ms)) {
+            victim = entry;
+        }
+    }
+    
+    if (flow == NULL) {
+        // Set is full: report the stalest flow early to make room
+        if (victim->used) {
+            flow_close(victim);
+        }
+        flow = victim;
+        memset(flow, 0, sizeof(*flow));
+        flow->used = 1;
+        flow->src_addr = packet->src_addr;
+        flow->dst_addr = packet->dst_addr;
+        flow->src_port = packet->src_port;
+        flow->dst_port = packet->dst_port;
+        flow->protocol = packet->protocol;
+        flow->tunnel_id = packet->tunnel_id;
+        flow->first_ms = now;
+    }
+    
+    flow->packets++;
+    flow->bytes += packet->size;
+    flow->last_ms = now;
+    if (packet->tcp_header != NULL) {
+        unsigned int events = packet->tcp_events;
+        
+        flow->tcp_flags |= ((unsigned char *)packet->tcp_header)[13];
+        if (events & TCP_EVENT_RTT) {
+            if (events & TCP_EVENT_HANDSHAKE) {
+                flow->handshake_rtt_usec = packet->rtt_usec;
+            } else {
+                flow->rtt_samples++;
+                flow->rtt_sum_usec += packet->rtt_usec;
+            }
+        }
+        flow->retransmits += (events & TCP_EVENT_RETRANSMIT) != 0;
+        flow->out_of_order += (events & TCP_EVENT_OUT_OF_ORDER) != 0;
+        flow->zero_windows += (events & TCP_EVENT_ZERO_WINDOW) != 0;
+    }
+}
+
+// Export flows past their active or inactive timeout, or all of them
+void flow_expire(uint64_t now_ms, int force) {
+    if (table == NULL) {
+        return;
+    }
+    
+    for (int i = 0; i < FLOW_BUCKETS * FLOW_WAYS; i++) {
+        FlowRecord *flow = &table[i];
+        
+        if (!flow->used) {
+            continue;
+        }
+        if (force ||
+            now_ms >= flow->last_ms + FLOW_INACTIVE_TIMEOUT_MS ||
+            now_ms >= flow->first_ms + FLOW_ACTIVE_TIMEOUT_MS) {
+            flow_close(flow);
+        }
+    }
+}
+
+// Capture time of the newest packet seen, for expiring replayed traffic
+uint64_t flow_last_packet_ms(void) {
+    return last_packet_ms;
+}
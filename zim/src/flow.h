@@ -0,0 +1,50 @@
+#ifndef ZIM_FLOW_H
+#define ZIM_FLOW_H
+
+#include <stdint.h>
+#include "network.h"
+
+// Flow table geometry: FLOW_BUCKETS sets of FLOW_WAYS entries each. A
+// full set evicts (and exports) its least recently seen flow.
+#define FLOW_BUCKETS 8192
+#define FLOW_WAYS 8
+
+// Export timeouts (IPFIX terminology)
+#define FLOW_ACTIVE_TIMEOUT_MS 60000    // Long-lived flows are reported this often
+#define FLOW_INACTIVE_TIMEOUT_MS 15000  // Idle flows are closed after this
+
+// Unidirectional 5-tuple flow record. Tunneled flows are keyed by their
+// inner addresses and the tunnel's VNI or key, as tenants may overlap.
+typedef struct {
+    unsigned int src_addr;
+    unsigned int dst_addr;
+    unsigned short src_port;
+    unsigned short dst_port;
+    unsigned char protocol;
+    unsigned char tcp_flags;  // OR of all flags seen
+    unsigned char used;
+    unsigned int tunnel_id;
+    unsigned long packets;
+    unsigned long bytes;
+    uint64_t first_ms;        // Milliseconds since the epoch
+    uint64_t last_ms;
+    
+    // TCP analytics (see tcpstat.h); RTTs are taken on this flow's ACKs
+    unsigned int handshake_rtt_usec;  // 0 if the handshake was not seen
+    unsigned int rtt_samples;
+    uint64_t rtt_sum_usec;
+    unsigned int retransmits;
+    unsigned int out_of_order;
+    unsigned int zero_windows;
+} FlowRecord;
+
+typedef void (*FlowExportFn)(const FlowRecord *flow);
+
+// Function prototypes
+int flow_init(FlowExportFn exporter);
+void flow_cleanup(void);
+void flow_update(Packet *packet);
+void flow_expire(uint64_t now_ms, int force);
+uint64_t flow_last_packet_ms(void);
+
+#endif // ZIM_FLOW_H
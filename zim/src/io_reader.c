@@ -0,0 +1,317 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+#include "io_reader.h"
+#include "compress.h"
+
+struct IoReader {
+    int fd;
+    int codec;
+    uint64_t id;               // Tags this reader's blocks in the thread caches
+    uint64_t size;             // Uncompressed
+    CompressMapEntry *blocks;  // count + 1 entries, the last marks the end
+    uint32_t count;
+};
+
+// The last block a thread decompressed
+typedef struct {
+    uint64_t reader;
+    uint32_t block;
+    size_t length;
+    char *data;
+    char *frame;
+    size_t frame_capacity;
+} BlockCache;
+
+static atomic_ulong next_id = 1;
+static pthread_key_t cache_key;
+static pthread_once_t cache_once = PTHREAD_ONCE_INIT;
+
+static void cache_free(void *value) {
+    BlockCache *cache = value;
+    
+    free(cache->data);
+    free(cache->frame);
+    free(cache);
+}
+
+static void cache_key_create(void) {
+    pthread_key_create(&cache_key, cache_free);
+}
+
+static int add_block(IoReader *reader, uint32_t *capacity, uint64_t offset, uint64_t raw_offset) {
+    if (reader->count + 1 >= *capacity) {
+        *capacity = *capacity ? *capacity * 2 : 64;
+        CompressMapEntry *grown = realloc(reader->blocks, *capacity * sizeof(CompressMapEntry));
+        if (grown == NULL) {
+            perror("realloc");
+            return -1;
+        }
+        reader->blocks = grown;
+    }
+    
+    reader->blocks[reader->count].offset = offset;
+    reader->blocks[reader->count].raw_offset = raw_offset;
+    reader->count++;
+    return 0;
+}
+
+// Use the block map at the end of the file, if the writer got to write it
+static int read_map(IoReader *reader, uint64_t file_size) {
+    CompressMapTrailer trailer;
+    uint32_t header[2];
+    
+    if (file_size < sizeof(header) + sizeof(trailer) ||
+        pread(reader->fd, &trailer, sizeof(trailer), file_size - sizeof(trailer)) != sizeof(trailer) ||
+        trailer.magic != COMPRESS_MAP_MAGIC) {
+        return -1;
+    }
+    
+    uint64_t map_size = (uint64_t)trailer.count * sizeof(CompressMapEntry) + sizeof(trailer);
+    if (map_size + sizeof(header) > file_size) {
+        return -1;
+    }
+    uint64_t map_offset = file_size - map_size - sizeof(header);
+    if (pread(reader->fd, header, sizeof(header), map_offset) != sizeof(header) ||
+        header[0] != COMPRESS_SKIP_MAGIC || header[1] != map_size) {
+        return -1;
+    }
+    
+    // One more entry marks where the frames end
+    reader->blocks = malloc((trailer.count + 1) * sizeof(CompressMapEntry));
+    if (reader->blocks == NULL ||
+        pread(reader->fd, reader->blocks, trailer.count * sizeof(CompressMapEntry),
+              map_offset + sizeof(header)) != (ssize_t)(trailer.count * sizeof(CompressMapEntry))) {
+        return -1;
+    }
+    reader->count = trailer.count;
+    reader->blocks[reader->count].offset = map_offset;
+    reader->blocks[reader->count].raw_offset = trailer.size;
+    
+    return 0;
+}
+
+// Rebuild the map by walking the frames. Stops at the first incomplete
+// frame, which is where a killed or still running writer got to.
+static int scan_frames(IoReader *reader, uint64_t file_size) {
+    size_t window_size = compress_bound(reader->codec);
+    char *window = malloc(window_size);
+    uint32_t capacity = 0;
+    uint64_t offset = 0, raw_offset = 0;
+    
+    if (window == NULL) {
+        perror("malloc");
+        return -1;
+    }
+    
+    while (offset < file_size) {
+        ssize_t available = pread(reader->fd, window, window_size, offset);
+        uint64_t frame_size, raw_size;
+        uint32_t magic = 0;
+        
+        if (available >= 4) {
+            memcpy(&magic, window, sizeof(magic));
+        }
+        if (available < 4 || magic == COMPRESS_SKIP_MAGIC ||
+            compress_frame_info(reader->codec, window, available, &frame_size, &raw_size) != 0) {
+            break;
+        }
+        if (add_block(reader, &capacity, offset, raw_offset) != 0) {
+            free(window);
+            return -1;
+        }
+        offset += frame_size;
+        raw_offset += raw_size;
+    }
+    free(window);
+    
+    if (add_block(reader, &capacity, offset, raw_offset) != 0) {
+        return -1;
+    }
+    reader->count--;
+    
+    return 0;
+}
+
+IoReader *io_reader_open(const char *filename) {
+    IoReader *reader = calloc(1, sizeof(IoReader));
+    uint32_t magic = 0;
+    struct stat st;
+    
+    if (reader == NULL) {
+        perror("calloc");
+        return NULL;
+    }
+    
+    reader->fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (reader->fd < 0) {
+        perror("open");
+        free(reader);
+        return NULL;
+    }
+    
+    if (fstat(reader->fd, &st) < 0) {
+        perror("fstat");
+        io_reader_close(reader);
+        return NULL;
+    }
+    if (pread(reader->fd, &magic, sizeof(magic), 0) != sizeof(magic)) {
+        magic = 0;
+    }
+    
+    reader->id = atomic_fetch_add(&next_id, 1);
+    reader->codec = compress_detect(magic);
+    if (reader->codec == COMPRESS_NONE) {
+        reader->size = st.st_size;
+        return reader;
+    }
+    
+    // zstd frames can only be read when built with libzstd
+    if (compress_parse(compress_name(reader->codec)) < 0) {
+        fprintf(stderr, "%s: compressed with %s, which this build does not support\n",
+                filename, compress_name(reader->codec));
+        io_reader_close(reader);
+        return NULL;
+    }
+    if (read_map(reader, st.st_size) != 0) {
+        free(reader->blocks);
+        reader->blocks = NULL;
+        reader->count = 0;
+        if (scan_frames(reader, st.st_size) != 0) {
+            io_reader_close(reader);
+            return NULL;
+        }
+    }
+    reader->size = reader->blocks[reader->count].raw_offset;
+    
+    return reader;
+}
+
+void io_reader_close(IoReader *reader) {
+    if (reader == NULL) {
+        return;
+    }
+    if (reader->fd >= 0) {
+        close(reader->fd);
+    }
+    free(reader->blocks);
+    free(reader);
+}
+
+static BlockCache *thread_cache(void) {
+    BlockCache *cache;
+    
+    pthread_once(&cache_once, cache_key_create);
+    cache = pthread_getspecific(cache_key);
+    if (cache == NULL) {
+        cache = calloc(1, sizeof(BlockCache));
+        if (cache == NULL) {
+            return NULL;
+        }
+        cache->data = malloc(COMPRESS_BLOCK_SIZE);
+        if (cache->data == NULL) {
+            free(cache);
+            return NULL;
+        }
+        pthread_setspecific(cache_key, cache);
+    }
+    
+    return cache;
+}
+
+// Decompress a block into this thread's cache unless it is already there
+static BlockCache *load_block(IoReader *reader, uint32_t block) {
+    BlockCache *cache = thread_cache();
+    
+    if (cache == NULL) {
+        perror("malloc");
+        return NULL;
+    }
+    if (cache->reader == reader->id && cache->block == block) {
+        return cache;
+    }
+    
+    size_t frame_size = reader->blocks[block + 1].offset - reader->blocks[block].offset;
+    if (frame_size > cache->frame_capacity) {
+        char *frame = realloc(cache->frame, frame_size);
+        if (frame == NULL) {
+            perror("realloc");
+            return NULL;
+        }
+        cache->frame = frame;
+        cache->frame_capacity = frame_size;
+    }
+    
+    cache->reader = 0;
+    if (pread(reader->fd, cache->frame, frame_size, reader->blocks[block].offset) != (ssize_t)frame_size) {
+        fprintf(stderr, "Truncated block at offset %llu\n",
+                (unsigned long long)reader->blocks[block].offset);
+        return NULL;
+    }
+    long length = compress_decode(reader->codec, cache->frame, frame_size,
+                                  cache->data, COMPRESS_BLOCK_SIZE);
+    if (length < 0 ||
+        (uint64_t)length != reader->blocks[block + 1].raw_offset - reader->blocks[block].raw_offset) {
+        fprintf(stderr, "Corrupt block at offset %llu\n",
+                (unsigned long long)reader->blocks[block].offset);
+        return NULL;
+    }
+    
+    cache->reader = reader->id;
+    cache->block = block;
+    cache->length = length;
+    return cache;
+}
+
+// Like pread(2): short at the end of the file, -1 on errors
+ssize_t io_reader_pread(IoReader *reader, void *buffer, size_t size, uint64_t offset) {
+    char *out = buffer;
+    size_t copied = 0;
+    
+    if (reader->codec == COMPRESS_NONE) {
+        return pread(reader->fd, buffer, size, offset);
+    }
+    
+    while (copied < size && offset < reader->size) {
+        // Last block starting at or before offset
+        uint32_t low = 0, high = reader->count - 1;
+        while (low < high) {
+            uint32_t middle = (low + high + 1) / 2;
+            if (reader->blocks[middle].raw_offset <= offset) {
+                low = middle;
+            } else {
+                high = middle - 1;
+            }
+        }
+        
+        BlockCache *cache = load_block(reader, low);
+        if (cache == NULL) {
+            return -1;
+        }
+        
+        size_t start = offset - reader->blocks[low].raw_offset;
+        size_t chunk = cache->length - start;
+        if (chunk > size - copied) {
+            chunk = size - copied;
+        }
+        memcpy(out + copied, cache->data + start, chunk);
+        copied += chunk;
+        offset += chunk;
+    }
+    
+    return copied;
+}
+
+// Uncompressed size
+uint64_t io_reader_size(const IoReader *reader) {
+    return reader->size;
+}
+
+int io_reader_codec(const IoReader *reader) {
+    return reader->codec;
+}
@@ -0,0 +1,21 @@
+#ifndef ZIM_IO_READER_H
+#define ZIM_IO_READER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+// Positional reads from files Zim wrote, compressed (see compress.h) or
+// not. Offsets and sizes are always those of the uncompressed data, so
+// indexes into a file work either way. Reads may come from several
+// threads at once; each thread keeps its last decompressed block.
+typedef struct IoReader IoReader;
+
+// Function prototypes
+IoReader *io_reader_open(const char *filename);
+void io_reader_close(IoReader *reader);
+ssize_t io_reader_pread(IoReader *reader, void *buffer, size_t size, uint64_t offset);
+uint64_t io_reader_size(const IoReader *reader);
+int io_reader_codec(const IoReader *reader);
+
+#endif // ZIM_IO_READER_H
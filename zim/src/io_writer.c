@@ -0,0 +1,670 @@
+#define _GNU_SOURCE  // O_DIRECT
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#include "io_writer.h"
+#include "compress.h"
+#include "spsc.h"
+#include "placement.h"
+
+#define IO_WRITER_IDLE_NSEC 100000  // Compression thread sleep when idle
+
+typedef struct {
+    char *data;
+    size_t used;      // Bytes gathered
+    size_t length;    // Bytes being written
+    uint64_t offset;  // Where they go
+    int busy;         // Write in flight
+} IoBuffer;
+
+// Submission and completion rings shared with the kernel
+typedef struct {
+    int fd;
+    void *sq_ring;
+    void *cq_ring;
+    size_t sq_size;
+    size_t cq_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+    _Atomic unsigned *sq_tail;
+    unsigned *sq_array;
+    unsigned sq_mask;
+    _Atomic unsigned *cq_head;
+    _Atomic unsigned *cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+    int fixed;  // Buffers registered, so writes are IORING_OP_WRITE_FIXED
+} IoRing;
+
+// Uncompressed data on its way to the compression thread
+typedef struct {
+    char *data;
+    size_t used;
+    int flush;  // Write out everything up to and including this block
+} IoBlock;
+
+struct IoWriter {
+    int fd;
+    int direct;
+    int backend;
+    atomic_int failed;
+    IoBuffer buffers[IO_WRITER_BUFFERS];
+    struct iovec iov[IO_WRITER_BUFFERS];
+    int current;
+    uint64_t offset;  // File offset of the current buffer
+    uint64_t size;    // Bytes handed to the writer
+    uint64_t stored;  // Bytes going to the file, the same unless compressed
+    IoRing ring;
+    
+    // Compression. Once the thread runs, it alone writes to the file.
+    int codec;
+    int threaded;
+    pthread_t thread;
+    atomic_int stopping;
+    IoBlock blocks[IO_WRITER_BLOCKS];
+    IoBlock *filling;
+    int unflushed;            // Blocks handed over since the last flush
+    SpscQueue full;           // To the compression thread
+    SpscQueue empty;          // And back
+    Compressor compressor;
+    char *frame;
+    size_t frame_capacity;
+    CompressMapEntry *map;
+    uint32_t map_count;
+    uint32_t map_capacity;
+    uint64_t compressed;      // Uncompressed bytes the thread has been through
+};
+
+static const struct timespec idle_time = {0, IO_WRITER_IDLE_NSEC};
+static atomic_int last_backend = IO_WRITER_NONE;
+static atomic_int last_direct = 0;
+static atomic_int last_codec = COMPRESS_NONE;
+static atomic_ulong bytes_written = 0;
+static atomic_ulong compress_in = 0;
+static atomic_ulong compress_out = 0;
+
+static int ring_setup(IoRing *ring, IoWriter *writer) {
+    struct io_uring_params params;
+    
+    memset(&params, 0, sizeof(params));
+    ring->fd = syscall(__NR_io_uring_setup, IO_WRITER_BUFFERS, &params);
+    if (ring->fd < 0) {
+        return -1;
+    }
+    
+    ring->sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_size > ring->sq_size) {
+            ring->sq_size = ring->cq_size;
+        }
+        ring->cq_size = 0;
+    }
+    
+    ring->sq_ring = mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         ring->fd, IORING_OFF_SQ_RING);
+    ring->cq_ring = ring->cq_size == 0 ? ring->sq_ring :
+                    mmap(NULL, ring->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         ring->fd, IORING_OFF_CQ_RING);
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ring->fd, IORING_OFF_SQES);
+    if (ring->sq_ring == MAP_FAILED || ring->cq_ring == MAP_FAILED || ring->sqes == MAP_FAILED) {
+        return -1;
+    }
+    
+    char *sq = ring->sq_ring;
+    char *cq = ring->cq_ring;
+    ring->sq_tail = (_Atomic unsigned *)(sq + params.sq_off.tail);
+    ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+    ring->sq_mask = *(unsigned *)(sq + params.sq_off.ring_mask);
+    ring->cq_head = (_Atomic unsigned *)(cq + params.cq_off.head);
+    ring->cq_tail = (_Atomic unsigned *)(cq + params.cq_off.tail);
+    ring->cq_mask = *(unsigned *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    
+    // Registered buffers save the kernel mapping them on every write. It
+    // can fail on a low RLIMIT_MEMLOCK; plain vectored writes still work.
+    for (int i = 0; i < IO_WRITER_BUFFERS; i++) {
+        writer->iov[i].iov_base = writer->buffers[i].data;
+        writer->iov[i].iov_len = IO_WRITER_BUFFER_SIZE;
+    }
+    ring->fixed = syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_BUFFERS,
+                          writer->iov, IO_WRITER_BUFFERS) == 0;
+    
+    return 0;
+}
+
+static void ring_teardown(IoRing *ring) {
+    if (ring->sqes != NULL && ring->sqes != MAP_FAILED) {
+        munmap(ring->sqes, ring->sqes_size);
+    }
+    if (ring->cq_size > 0 && ring->cq_ring != NULL && ring->cq_ring != MAP_FAILED) {
+        munmap(ring->cq_ring, ring->cq_size);
+    }
+    if (ring->sq_ring != NULL && ring->sq_ring != MAP_FAILED) {
+        munmap(ring->sq_ring, ring->sq_size);
+    }
+    if (ring->fd >= 0) {
+        close(ring->fd);
+    }
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = -1;
+}
+
+static void write_failed(IoWriter *writer, int error) {
+    if (!writer->failed) {
+        fprintf(stderr, "Write failed: %s\n", strerror(error));
+        writer->failed = 1;
+    }
+}
+
+static void complete(IoWriter *writer, IoBuffer *buffer, long result) {
+    buffer->busy = 0;
+    
+    if (result < 0) {
+        write_failed(writer, -result);
+    } else if ((size_t)result != buffer->length) {
+        write_failed(writer, ENOSPC);
+    } else {
+        atomic_fetch_add(&bytes_written, result);
+    }
+}
+
+// Collect finished writes, waiting for at least one if asked to
+static void ring_reap(IoWriter *writer, int wait) {
+    IoRing *ring = &writer->ring;
+    
+    if (wait) {
+        while (syscall(__NR_io_uring_enter, ring->fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0) {
+            if (errno != EINTR) {
+                write_failed(writer, errno);
+                return;
+            }
+        }
+    }
+    
+    unsigned head = atomic_load_explicit(ring->cq_head, memory_order_relaxed);
+    unsigned tail = atomic_load_explicit(ring->cq_tail, memory_order_acquire);
+    
+    while (head != tail) {
+        struct io_uring_cqe *cqe = &ring->cqes[head & ring->cq_mask];
+        complete(writer, &writer->buffers[cqe->user_data], cqe->res);
+        head++;
+    }
+    atomic_store_explicit(ring->cq_head, head, memory_order_release);
+}
+
+static void ring_submit(IoWriter *writer, int index) {
+    IoRing *ring = &writer->ring;
+    IoBuffer *buffer = &writer->buffers[index];
+    unsigned tail = atomic_load_explicit(ring->sq_tail, memory_order_relaxed);
+    unsigned slot = tail & ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[slot];
+    
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->fd = writer->fd;
+    sqe->off = buffer->offset;
+    sqe->user_data = index;
+    if (ring->fixed) {
+        sqe->opcode = IORING_OP_WRITE_FIXED;
+        sqe->addr = (unsigned long)buffer->data;
+        sqe->len = buffer->length;
+        sqe->buf_index = index;
+    } else {
+        writer->iov[index].iov_base = buffer->data;
+        writer->iov[index].iov_len = buffer->length;
+        sqe->opcode = IORING_OP_WRITEV;
+        sqe->addr = (unsigned long)&writer->iov[index];
+        sqe->len = 1;
+    }
+    
+    ring->sq_array[slot] = slot;
+    atomic_store_explicit(ring->sq_tail, tail + 1, memory_order_release);
+    buffer->busy = 1;
+    
+    while (syscall(__NR_io_uring_enter, ring->fd, 1, 0, 0, NULL, 0) < 0) {
+        if (errno != EINTR) {
+            buffer->busy = 0;
+            write_failed(writer, errno);
+            return;
+        }
+    }
+    
+    // Pick up whatever finished meanwhile, so the bandwidth stays current
+    ring_reap(writer, 0);
+}
+
+static void pwritev_submit(IoWriter *writer, IoBuffer *buffer) {
+    struct iovec iov = {buffer->data, buffer->length};
+    uint64_t offset = buffer->offset;
+    
+    while (iov.iov_len > 0) {
+        ssize_t written = pwritev(writer->fd, &iov, 1, offset);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            write_failed(writer, errno);
+            return;
+        }
+        iov.iov_base = (char *)iov.iov_base + written;
+        iov.iov_len -= written;
+        offset += written;
+        atomic_fetch_add(&bytes_written, written);
+    }
+}
+
+static void wait_buffer(IoWriter *writer, IoBuffer *buffer) {
+    while (buffer->busy && !writer->failed) {
+        ring_reap(writer, 1);
+    }
+}
+
+// Write out the current buffer and move on to the next. With O_DIRECT
+// only whole blocks go out; the rest is carried over.
+static void submit_current(IoWriter *writer) {
+    IoBuffer *buffer = &writer->buffers[writer->current];
+    int next = (writer->current + 1) % IO_WRITER_BUFFERS;
+    size_t carry = writer->direct ? buffer->used % IO_WRITER_ALIGN : 0;
+    
+    if (buffer->used - carry == 0 || writer->failed) {
+        return;
+    }
+    
+    // The next buffer is the oldest write in flight
+    wait_buffer(writer, &writer->buffers[next]);
+    if (carry > 0) {
+        memcpy(writer->buffers[next].data, buffer->data + buffer->used - carry, carry);
+    }
+    
+    buffer->length = buffer->used - carry;
+    buffer->offset = writer->offset;
+    writer->offset += buffer->length;
+    if (writer->backend == IO_WRITER_IO_URING) {
+        ring_submit(writer, writer->current);
+    } else {
+        pwritev_submit(writer, buffer);
+    }
+    
+    writer->buffers[next].used = carry;
+    writer->current = next;
+}
+
+static int open_file(const char *filename, int direct) {
+    int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+    int fd = open(filename, flags | (direct ? O_DIRECT : 0), 0644);
+    
+    // Not every filesystem (tmpfs, for one) supports O_DIRECT
+    if (fd < 0 && direct && errno == EINVAL) {
+        fprintf(stderr, "%s: O_DIRECT not supported, using the page cache\n", filename);
+        fd = open(filename, flags, 0644);
+    }
+    
+    return fd;
+}
+
+// Gather data into the write buffers. Called by the caller's thread, or
+// by the compression thread when there is one.
+static void sink_write(IoWriter *writer, const void *data, size_t size) {
+    const char *bytes = data;
+    
+    while (size > 0 && !writer->failed) {
+        IoBuffer *buffer = &writer->buffers[writer->current];
+        size_t room = IO_WRITER_BUFFER_SIZE - buffer->used;
+        size_t chunk = size < room ? size : room;
+        
+        memcpy(buffer->data + buffer->used, bytes, chunk);
+        buffer->used += chunk;
+        writer->stored += chunk;
+        bytes += chunk;
+        size -= chunk;
+        
+        if (buffer->used == IO_WRITER_BUFFER_SIZE) {
+            submit_current(writer);
+        }
+    }
+}
+
+// Compress a block into one frame, note where it went and pass it on
+static void compress_block(IoWriter *writer, IoBlock *block) {
+    if (block->used > 0 && !writer->failed) {
+        size_t length = compressor_frame(&writer->compressor, block->data, block->used,
+                                         writer->frame, writer->frame_capacity);
+        if (length == 0) {
+            write_failed(writer, EIO);
+            return;
+        }
+        
+        if (writer->map_count == writer->map_capacity) {
+            uint32_t capacity = writer->map_capacity ? writer->map_capacity * 2 : 256;
+            CompressMapEntry *grown = realloc(writer->map, capacity * sizeof(CompressMapEntry));
+            if (grown == NULL) {
+                write_failed(writer, ENOMEM);
+                return;
+            }
+            writer->map = grown;
+            writer->map_capacity = capacity;
+        }
+        writer->map[writer->map_count].offset = writer->stored;
+        writer->map[writer->map_count].raw_offset = writer->compressed;
+        writer->map_count++;
+        
+        sink_write(writer, writer->frame, length);
+        writer->compressed += block->used;
+        atomic_fetch_add(&compress_in, block->used);
+        atomic_fetch_add(&compress_out, length);
+    }
+    
+    if (block->flush) {
+        submit_current(writer);
+    }
+}
+
+static void *compress_main(void *arg) {
+    IoWriter *writer = arg;
+    void *item;
+    
+    for (;;) {
+        // Read the flag first: once it is set, no more blocks arrive
+        int stopping = atomic_load(&writer->stopping);
+        
+        if (spsc_pop(&writer->full, &item, 1) == 0) {
+            if (stopping) {
+                break;
+            }
+            nanosleep(&idle_time, NULL);
+            continue;
+        }
+        
+        IoBlock *block = item;
+        compress_block(writer, block);
+        block->used = 0;
+        block->flush = 0;
+        spsc_push(&writer->empty, &item, 1);
+    }
+    
+    return NULL;
+}
+
+// Pass the block being filled to the compression thread and take an
+// empty one. Waits only when every block is still being compressed.
+static void hand_over(IoWriter *writer, int flush) {
+    void *item = writer->filling;
+    
+    writer->filling->flush = flush;
+    spsc_push(&writer->full, &item, 1);
+    writer->unflushed = !flush;
+    
+    while (spsc_pop(&writer->empty, &item, 1) == 0) {
+        nanosleep(&idle_time, NULL);
+    }
+    writer->filling = item;
+}
+
+static int start_compression(IoWriter *writer, int codec) {
+    writer->frame_capacity = compress_bound(codec);
+    writer->frame = malloc(writer->frame_capacity);
+    if (writer->frame == NULL || compressor_init(&writer->compressor, codec) != 0 ||
+        spsc_init(&writer->full, IO_WRITER_BLOCKS, PLACEMENT_ANY) != 0 ||
+        spsc_init(&writer->empty, IO_WRITER_BLOCKS, PLACEMENT_ANY) != 0) {
+        perror("malloc");
+        return -1;
+    }
+    
+    for (int i = 0; i < IO_WRITER_BLOCKS; i++) {
+        void *item = &writer->blocks[i];
+        
+        writer->blocks[i].data = malloc(COMPRESS_BLOCK_SIZE);
+        if (writer->blocks[i].data == NULL) {
+            perror("malloc");
+            return -1;
+        }
+        if (i > 0) {
+            spsc_push(&writer->empty, &item, 1);
+        }
+    }
+    writer->filling = &writer->blocks[0];
+    
+    if (pthread_create(&writer->thread, NULL, compress_main, writer) != 0) {
+        perror("pthread_create");
+        return -1;
+    }
+    writer->codec = codec;
+    writer->threaded = 1;
+    
+    return 0;
+}
+
+// Stop the compression thread and append the block map
+static void stop_compression(IoWriter *writer) {
+    CompressMapTrailer trailer;
+    uint32_t header[2];
+    
+    if (writer->filling->used > 0) {
+        hand_over(writer, 0);
+    }
+    atomic_store(&writer->stopping, 1);
+    pthread_join(writer->thread, NULL);
+    writer->threaded = 0;
+    
+    trailer.size = writer->size;
+    trailer.count = writer->map_count;
+    trailer.magic = COMPRESS_MAP_MAGIC;
+    header[0] = COMPRESS_SKIP_MAGIC;
+    header[1] = writer->map_count * sizeof(CompressMapEntry) + sizeof(trailer);
+    
+    sink_write(writer, header, sizeof(header));
+    sink_write(writer, writer->map, writer->map_count * sizeof(CompressMapEntry));
+    sink_write(writer, &trailer, sizeof(trailer));
+}
+
+IoWriter *io_writer_open(const char *filename, int flags, int codec) {
+    IoWriter *writer = calloc(1, sizeof(IoWriter));
+    
+    if (writer == NULL) {
+        perror("calloc");
+        return NULL;
+    }
+    writer->ring.fd = -1;
+    
+    writer->fd = open_file(filename, flags & IO_WRITER_DIRECT);
+    if (writer->fd < 0) {
+        perror("open");
+        free(writer);
+        return NULL;
+    }
+    writer->direct = (fcntl(writer->fd, F_GETFL) & O_DIRECT) != 0;
+    
+    for (int i = 0; i < IO_WRITER_BUFFERS; i++) {
+        if (posix_memalign((void **)&writer->buffers[i].data, IO_WRITER_ALIGN,
+                           IO_WRITER_BUFFER_SIZE) != 0) {
+            perror("posix_memalign");
+            io_writer_close(writer);
+            return NULL;
+        }
+    }
+    
+    if (ring_setup(&writer->ring, writer) == 0) {
+        writer->backend = IO_WRITER_IO_URING;
+    } else {
+        ring_teardown(&writer->ring);
+        writer->backend = IO_WRITER_PWRITEV;
+    }
+    
+    if (codec != COMPRESS_NONE && start_compression(writer, codec) != 0) {
+        io_writer_close(writer);
+        return NULL;
+    }
+    atomic_store(&last_backend, writer->backend);
+    atomic_store(&last_direct, writer->direct);
+    atomic_store(&last_codec, codec);
+    
+    return writer;
+}
+
+int io_writer_write(IoWriter *writer, const void *data, size_t size) {
+    const char *bytes = data;
+    
+    if (!writer->threaded) {
+        sink_write(writer, data, size);
+        writer->size += size;
+        return writer->failed ? -1 : 0;
+    }
+    
+    writer->size += size;
+    while (size > 0) {
+        IoBlock *block = writer->filling;
+        size_t room = COMPRESS_BLOCK_SIZE - block->used;
+        size_t chunk = size < room ? size : room;
+        
+        memcpy(block->data + block->used, bytes, chunk);
+        block->used += chunk;
+        bytes += chunk;
+        size -= chunk;
+        
+        if (block->used == COMPRESS_BLOCK_SIZE) {
+            hand_over(writer, 0);
+        }
+    }
+    
+    return writer->failed ? -1 : 0;
+}
+
+// Start writing what has been gathered so far
+void io_writer_flush(IoWriter *writer) {
+    if (!writer->threaded) {
+        submit_current(writer);
+    } else if (writer->filling->used > 0 || writer->unflushed) {
+        hand_over(writer, 1);
+    }
+}
+
+// Write everything, wait for it and close. An O_DIRECT file gets a
+// padded last block and is then cut back to its real size.
+int io_writer_close(IoWriter *writer) {
+    int failed;
+    
+    if (writer == NULL) {
+        return 0;
+    }
+    
+    if (writer->threaded) {
+        stop_compression(writer);
+    }
+    
+    if (writer->fd >= 0 && writer->buffers[writer->current].data != NULL) {
+        IoBuffer *buffer = &writer->buffers[writer->current];
+        
+        if (writer->direct && buffer->used % IO_WRITER_ALIGN != 0) {
+            size_t padded = (buffer->used + IO_WRITER_ALIGN - 1) & ~(size_t)(IO_WRITER_ALIGN - 1);
+            memset(buffer->data + buffer->used, 0, padded - buffer->used);
+            buffer->used = padded;
+        }
+        submit_current(writer);
+        
+        for (int i = 0; i < IO_WRITER_BUFFERS; i++) {
+            wait_buffer(writer, &writer->buffers[i]);
+        }
+        if (writer->direct && ftruncate(writer->fd, writer->stored) < 0) {
+            write_failed(writer, errno);
+        }
+    }
+    
+    if (writer->backend == IO_WRITER_IO_URING) {
+        ring_teardown(&writer->ring);
+    }
+    if (writer->fd >= 0) {
+        close(writer->fd);
+    }
+    for (int i = 0; i < IO_WRITER_BUFFERS; i++) {
+        free(writer->buffers[i].data);
+    }
+    for (int i = 0; i < IO_WRITER_BLOCKS; i++) {
+        free(writer->blocks[i].data);
+    }
+    spsc_free(&writer->full);
+    spsc_free(&writer->empty);
+    compressor_free(&writer->compressor);
+    free(writer->frame);
+    free(writer->map);
+    
+    failed = writer->failed;
+    free(writer);
+    return failed ? -1 : 0;
+}
+
+// Bytes handed to the writer, i.e. the file size once everything is out
+// (uncompressed, for a compressed file)
+uint64_t io_writer_size(const IoWriter *writer) {
+    return writer->size;
+}
+
+// Backend of the most recently opened writer
+int io_writer_backend(void) {
+    return atomic_load(&last_backend);
+}
+
+int io_writer_direct(void) {
+    return atomic_load(&last_direct);
+}
+
+const char *io_writer_backend_name(int backend) {
+    switch (backend) {
+        case IO_WRITER_IO_URING:
+            return "io_uring";
+        case IO_WRITER_PWRITEV:
+            return "pwritev";
+        default:
+            return "none";
+    }
+}
+
+// Codec of the most recently opened writer
+int io_writer_codec(void) {
+    return atomic_load(&last_codec);
+}
+
+// Uncompressed to compressed bytes over every compressed writer so far
+double io_writer_ratio(void) {
+    unsigned long out = atomic_load(&compress_out);
+    
+    return out > 0 ? (double)atomic_load(&compress_in) / out : 0.0;
+}
+
+unsigned long io_writer_bytes_written(void) {
+    return atomic_load(&bytes_written);
+}
+
+// Bytes per second reaching the files, averaged over at least a second.
+// Called from one thread only.
+double io_writer_bandwidth(void) {
+    static struct timespec last_time = {0, 0};
+    static unsigned long last_bytes = 0;
+    static double rate = 0.0;
+    struct timespec now;
+    
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double elapsed = (now.tv_sec - last_time.tv_sec) + (now.tv_nsec - last_time.tv_nsec) / 1e9;
+    
+    if (elapsed >= 1.0) {
+        unsigned long bytes = atomic_load(&bytes_written);
+        if (last_time.tv_sec != 0) {
+            rate = (bytes - last_bytes) / elapsed;
+        }
+        last_time = now;
+        last_bytes = bytes;
+    }
+    
+    return rate;
+}
@@ -0,0 +1,47 @@
+#ifndef ZIM_IO_WRITER_H
+#define ZIM_IO_WRITER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Sequential file writer for logs and captures. Data is gathered into a
+// few large, page-aligned buffers; a full buffer is written while the
+// next one fills. Writes go through io_uring (raw syscalls, buffers
+// registered with the kernel) with every buffer in flight at once, or
+// through pwritev where io_uring is not available. With IO_WRITER_DIRECT
+// the file is opened with O_DIRECT, bypassing the page cache.
+//
+// With a codec (see compress.h) the data is cut into blocks that a
+// thread of the writer's own compresses into independent frames, so the
+// caller only pays for the copy. Offsets and sizes stay uncompressed.
+#define IO_WRITER_BUFFERS 4
+#define IO_WRITER_BUFFER_SIZE (1 << 20)
+#define IO_WRITER_ALIGN 4096      // O_DIRECT offset and length alignment
+#define IO_WRITER_FLUSH_MSEC 200  // Partial buffers are written at least this often
+#define IO_WRITER_BLOCKS 4        // Blocks being filled or compressed
+
+// Open flags
+#define IO_WRITER_DIRECT 0x01
+
+// Backends
+#define IO_WRITER_NONE     0
+#define IO_WRITER_IO_URING 1
+#define IO_WRITER_PWRITEV  2
+
+typedef struct IoWriter IoWriter;
+
+// Function prototypes
+IoWriter *io_writer_open(const char *filename, int flags, int codec);
+int io_writer_write(IoWriter *writer, const void *data, size_t size);
+void io_writer_flush(IoWriter *writer);
+int io_writer_close(IoWriter *writer);
+uint64_t io_writer_size(const IoWriter *writer);
+int io_writer_backend(void);
+int io_writer_direct(void);
+const char *io_writer_backend_name(int backend);
+int io_writer_codec(void);
+double io_writer_ratio(void);
+unsigned long io_writer_bytes_written(void);
+double io_writer_bandwidth(void);
+
+#endif // ZIM_IO_WRITER_H
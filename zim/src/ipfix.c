@@ -0,0 +1,308 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include "ipfix.h"
+#include "config.h"
+
+#define IPFIX_HEADER_LEN 16
+#define NETFLOW_V9_HEADER_LEN 20
+#define SET_HEADER_LEN 4
+#define IPFIX_TEMPLATE_SET_ID 2
+#define NETFLOW_V9_TEMPLATE_SET_ID 0
+
+// Template layouts: { information element, length }
+static const unsigned short ipfix_fields[][2] = {
+    {IE_SOURCE_IPV4_ADDRESS, 4},
+    {IE_DESTINATION_IPV4_ADDRESS, 4},
+    {IE_SOURCE_TRANSPORT_PORT, 2},
+    {IE_DESTINATION_TRANSPORT_PORT, 2},
+    {IE_PROTOCOL_IDENTIFIER, 1},
+    {IE_TCP_CONTROL_BITS, 1},
+    {IE_PACKET_DELTA_COUNT, 8},
+    {IE_OCTET_DELTA_COUNT, 8},
+    {IE_FLOW_START_MILLISECONDS, 8},
+    {IE_FLOW_END_MILLISECONDS, 8},
+    {ZIM_IE_HANDSHAKE_RTT, 4},
+    {ZIM_IE_MEAN_RTT, 4},
+    {ZIM_IE_RETRANSMITS, 4},
+    {ZIM_IE_OUT_OF_ORDER, 4},
+    {ZIM_IE_ZERO_WINDOWS, 4},
+};
+
+static const unsigned short v9_fields[][2] = {
+    {IE_SOURCE_IPV4_ADDRESS, 4},
+    {IE_DESTINATION_IPV4_ADDRESS, 4},
+    {IE_SOURCE_TRANSPORT_PORT, 2},
+    {IE_DESTINATION_TRANSPORT_PORT, 2},
+    {IE_PROTOCOL_IDENTIFIER, 1},
+    {IE_TCP_CONTROL_BITS, 1},
+    {IE_PACKET_DELTA_COUNT, 8},
+    {IE_OCTET_DELTA_COUNT, 8},
+    {IE_V9_FIRST_SWITCHED, 4},
+    {IE_V9_LAST_SWITCHED, 4},
+};
+
+// NetFlow v9 has no enterprise elements, so its records stop at the times
+#define IPFIX_FIELD_COUNT (sizeof(ipfix_fields) / sizeof(ipfix_fields[0]))
+#define V9_FIELD_COUNT (sizeof(v9_fields) / sizeof(v9_fields[0]))
+
+static int sock_fd = -1;
+static int export_version = IPFIX_VERSION;
+static size_t record_size = 0;
+
+// Datagram being assembled
+static unsigned char datagram[IPFIX_MAX_DATAGRAM];
+static size_t length = 0;
+static size_t data_set_offset = 0;
+static unsigned int datagram_records = 0;
+static int datagram_has_template = 0;
+static time_t datagram_started = 0;
+
+static uint32_t sequence = 0;
+static time_t last_template = 0;
+static uint64_t start_ms = 0;
+static unsigned long records_sent = 0;
+static unsigned long datagrams_sent = 0;
+
+static void put_u8(unsigned int value) {
+    datagram[length++] = value;
+}
+
+static void put_u16(unsigned int value) {
+    datagram[length++] = value >> 8;
+    datagram[length++] = value;
+}
+
+static void put_u32(uint32_t value) {
+    put_u16(value >> 16);
+    put_u16(value & 0xffff);
+}
+
+static void put_u64(uint64_t value) {
+    put_u32(value >> 32);
+    put_u32(value & 0xffffffff);
+}
+
+static void set_u16(size_t offset, unsigned int value) {
+    datagram[offset] = value >> 8;
+    datagram[offset + 1] = value;
+}
+
+static void set_u32(size_t offset, uint32_t value) {
+    set_u16(offset, value >> 16);
+    set_u16(offset + 2, value & 0xffff);
+}
+
+static uint64_t now_ms(void) {
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return (uint64_t)now.tv_sec * 1000 + now.tv_usec / 1000;
+}
+
+// Start a datagram: header placeholder, template set when due, data set header
+static void begin_datagram(void) {
+    const unsigned short (*fields)[2] = export_version == IPFIX_VERSION ? ipfix_fields : v9_fields;
+    size_t count = export_version == IPFIX_VERSION ? IPFIX_FIELD_COUNT : V9_FIELD_COUNT;
+    time_t now = time(NULL);
+    
+    length = export_version == IPFIX_VERSION ? IPFIX_HEADER_LEN : NETFLOW_V9_HEADER_LEN;
+    datagram_records = 0;
+    datagram_has_template = 0;
+    datagram_started = now;
+    
+    if (last_template == 0 || now - last_template >= IPFIX_TEMPLATE_REFRESH_SEC) {
+        put_u16(export_version == IPFIX_VERSION ? IPFIX_TEMPLATE_SET_ID : NETFLOW_V9_TEMPLATE_SET_ID);
+        size_t set_length = SET_HEADER_LEN + 4;
+        for (size_t i = 0; i < count; i++) {
+            set_length += fields[i][0] & IPFIX_ENTERPRISE_BIT ? 8 : 4;
+        }
+        put_u16(set_length);
+        put_u16(IPFIX_TEMPLATE_ID);
+        put_u16(count);
+        for (size_t i = 0; i < count; i++) {
+            put_u16(fields[i][0]);
+            put_u16(fields[i][1]);
+            if (fields[i][0] & IPFIX_ENTERPRISE_BIT) {
+                put_u32(ZIM_ENTERPRISE_NUMBER);
+            }
+        }
+        datagram_has_template = 1;
+        last_template = now;
+    }
+    
+    data_set_offset = length;
+    put_u16(IPFIX_TEMPLATE_ID);
+    put_u16(0);  // Set length, filled in on send
+}
+
+static void send_datagram(void) {
+    if (length == 0 || datagram_records == 0) {
+        return;
+    }
+    
+    // v9 flowsets are padded to a four byte boundary
+    if (export_version == NETFLOW_V9_VERSION) {
+        while ((length - data_set_offset) % 4 != 0) {
+            put_u8(0);
+        }
+    }
+    set_u16(data_set_offset + 2, length - data_set_offset);
+    
+    if (export_version == IPFIX_VERSION) {
+        set_u16(0, IPFIX_VERSION);
+        set_u16(2, length);
+        set_u32(4, time(NULL));
+        set_u32(8, sequence);   // Data records sent before this message
+        set_u32(12, 0);         // Observation domain
+        sequence += datagram_records;
+    } else {
+        set_u16(0, NETFLOW_V9_VERSION);
+        set_u16(2, datagram_records + datagram_has_template);
+        set_u32(4, now_ms() - start_ms);  // sysUptime
+        set_u32(8, time(NULL));
+        set_u32(12, sequence++);          // Export packets sent before this one
+        set_u32(16, 0);                   // Source ID
+    }
+    
+    if (send(sock_fd, datagram, length, 0) < 0) {
+        perror("ipfix send");
+    } else {
+        datagrams_sent++;
+        records_sent += datagram_records;
+    }
+    
+    length = 0;
+    datagram_records = 0;
+}
+
+// collector is "host:port"; version is IPFIX_VERSION or NETFLOW_V9_VERSION
+int ipfix_init(const char *collector, int version) {
+    char host[MAX_FILENAME_LEN];
+    struct addrinfo hints, *result, *ai;
+    const char *colon = strrchr(collector, ':');
+    
+    if (colon == NULL || colon == collector || (size_t)(colon - collector) >= sizeof(host)) {
+        fprintf(stderr, "Invalid collector address: %s (expected host:port)\n", collector);
+        return -1;
+    }
+    memcpy(host, collector, colon - collector);
+    host[colon - collector] = '\0';
+    
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    if (getaddrinfo(host, colon + 1, &hints, &result) != 0) {
+        fprintf(stderr, "Cannot resolve collector: %s\n", collector);
+        return -1;
+    }
+    
+    for (ai = result; ai != NULL; ai = ai->ai_next) {
+        sock_fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (sock_fd < 0) {
+            continue;
+        }
+        if (connect(sock_fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+            break;
+        }
+        close(sock_fd);
+        sock_fd = -1;
+    }
+    freeaddrinfo(result);
+    
+    if (sock_fd < 0) {
+        fprintf(stderr, "Cannot reach collector: %s\n", collector);
+        return -1;
+    }
+    
+    export_version = version;
+    record_size = 0;
+    if (version == IPFIX_VERSION) {
+        for (size_t i = 0; i < IPFIX_FIELD_COUNT; i++) {
+            record_size += ipfix_fields[i][1];
+        }
+    } else {
+        for (size_t i = 0; i < V9_FIELD_COUNT; i++) {
+            record_size += v9_fields[i][1];
+        }
+    }
+    start_ms = now_ms();
+    last_template = 0;
+    sequence = 0;
+    length = 0;
+    
+    return 0;
+}
+
+void ipfix_cleanup(void) {
+    if (sock_fd >= 0) {
+        send_datagram();
+        close(sock_fd);
+        sock_fd = -1;
+    }
+}
+
+// Flow table callback: append one record, sending full datagrams
+void ipfix_export_flow(const FlowRecord *flow) {
+    if (sock_fd < 0) {
+        return;
+    }
+    
+    // Leave room for v9 padding
+    if (length != 0 && length + record_size + 3 > IPFIX_MAX_DATAGRAM) {
+        send_datagram();
+    }
+    if (length == 0) {
+        begin_datagram();
+    }
+    
+    put_u32(flow->src_addr);
+    put_u32(flow->dst_addr);
+    put_u16(flow->src_port);
+    put_u16(flow->dst_port);
+    put_u8(flow->protocol);
+    put_u8(flow->tcp_flags);
+    put_u64(flow->packets);
+    put_u64(flow->bytes);
+    if (export_version == IPFIX_VERSION) {
+        put_u64(flow->first_ms);
+        put_u64(flow->last_ms);
+        put_u32(flow->handshake_rtt_usec);
+        put_u32(flow->rtt_samples > 0 ? flow->rtt_sum_usec / flow->rtt_samples : 0);
+        put_u32(flow->retransmits);
+        put_u32(flow->out_of_order);
+        put_u32(flow->zero_windows);
+    } else {
+        // Relative to sysUptime; flows older than the exporter clamp to zero
+        put_u32(flow->first_ms > start_ms ? flow->first_ms - start_ms : 0);
+        put_u32(flow->last_ms > start_ms ? flow->last_ms - start_ms : 0);
+    }
+    datagram_records++;
+}
+
+// Send a partially filled datagram once it has waited long enough
+void ipfix_flush(int force) {
+    if (sock_fd < 0 || datagram_records == 0) {
+        return;
+    }
+    
+    if (force || time(NULL) - datagram_started >= IPFIX_FLUSH_SEC) {
+        send_datagram();
+    }
+}
+
+int ipfix_enabled(void) {
+    return sock_fd >= 0;
+}
+
+unsigned long ipfix_records_sent(void) {
+    return records_sent;
+}
+
+unsigned long ipfix_datagrams_sent(void) {
+    return datagrams_sent;
+}
@@ -0,0 +1,49 @@
+#ifndef ZIM_IPFIX_H
+#define ZIM_IPFIX_H
+
+#include "flow.h"
+
+// Export protocol versions
+#define IPFIX_VERSION 10
+#define NETFLOW_V9_VERSION 9
+
+#define IPFIX_MAX_DATAGRAM 1472        // Ethernet MTU minus IPv4 and UDP headers
+#define IPFIX_TEMPLATE_ID 256
+#define IPFIX_TEMPLATE_REFRESH_SEC 30  // Resend templates, collectors may restart
+#define IPFIX_FLUSH_SEC 1              // Send a partial datagram after this long
+
+// Information elements (same numbers in NetFlow v9)
+#define IE_OCTET_DELTA_COUNT 1
+#define IE_PACKET_DELTA_COUNT 2
+#define IE_PROTOCOL_IDENTIFIER 4
+#define IE_TCP_CONTROL_BITS 6
+#define IE_SOURCE_TRANSPORT_PORT 7
+#define IE_SOURCE_IPV4_ADDRESS 8
+#define IE_DESTINATION_TRANSPORT_PORT 11
+#define IE_DESTINATION_IPV4_ADDRESS 12
+#define IE_V9_LAST_SWITCHED 21
+#define IE_V9_FIRST_SWITCHED 22
+#define IE_FLOW_START_MILLISECONDS 152
+#define IE_FLOW_END_MILLISECONDS 153
+
+// Enterprise-specific elements (IPFIX only) for the TCP analytics. The
+// enterprise number is the one RFC 5612 sets aside for documentation,
+// until Zim has one of its own.
+#define IPFIX_ENTERPRISE_BIT 0x8000
+#define ZIM_ENTERPRISE_NUMBER 32473
+#define ZIM_IE_HANDSHAKE_RTT (IPFIX_ENTERPRISE_BIT | 1)  // Microseconds, 0 if not seen
+#define ZIM_IE_MEAN_RTT      (IPFIX_ENTERPRISE_BIT | 2)  // Microseconds, 0 if no samples
+#define ZIM_IE_RETRANSMITS   (IPFIX_ENTERPRISE_BIT | 3)  // Packets
+#define ZIM_IE_OUT_OF_ORDER  (IPFIX_ENTERPRISE_BIT | 4)  // Packets
+#define ZIM_IE_ZERO_WINDOWS  (IPFIX_ENTERPRISE_BIT | 5)  // Window closures
+
+// Function prototypes
+int ipfix_init(const char *collector, int version);
+void ipfix_cleanup(void);
+void ipfix_export_flow(const FlowRecord *flow);
+void ipfix_flush(int force);
+int ipfix_enabled(void);
+unsigned long ipfix_records_sent(void);
+unsigned long ipfix_datagrams_sent(void);
+
+#endif // ZIM_IPFIX_H
@@ -3,38 +3,52 @@
 #include <string.h>
 #include <time.h>
 #include "logger.h"
+#include "io_writer.h"
+#include "tunnel.h"
+#include "config.h"
 
-static FILE *log_file = NULL;
+static IoWriter *log_file = NULL;
 
 int logger_init(const char *filename) {
-    log_file = fopen(filename, "w");
+    static const char header[] =
+        "Timestamp,Protocol,Source IP,Source Port,Destination IP,Destination Port,Size,Sample Rate,Tunnel,Tunnel ID\n";
+    
+    log_file = io_writer_open(filename, config.direct_io ? IO_WRITER_DIRECT : 0,
+                              config.compression);
     if (log_file == NULL) {
-        perror("fopen");
         return -1;
     }
     
     // Write CSV header
-    fprintf(log_file, "Timestamp,Protocol,Source IP,Source Port,Destination IP,Destination Port,Size\n");
+    io_writer_write(log_file, header, sizeof(header) - 1);
     
     return 0;
 }
 
 void logger_cleanup(void) {
     if (log_file != NULL) {
-        fclose(log_file);
+        io_writer_close(log_file);
         log_file = NULL;
     }
 }
 
+// Lines are written in large batches; this pushes out a partial one
+void logger_flush(void) {
+    if (log_file != NULL) {
+        io_writer_flush(log_file);
+    }
+}
+
 void logger_log_packet(Packet *packet) {
     if (log_file == NULL) {
         return;
     }
     
-    // Format timestamp
+    // Format timestamp; the display formats its own concurrently
     char timestamp[32];
-    struct tm *tm_info = localtime(&packet->timestamp.tv_sec);
-    strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S", tm_info);
+    struct tm tm_info;
+    localtime_r(&packet->timestamp.tv_sec, &tm_info);
+    strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S", &tm_info);
     
     // Get protocol name
     const char *proto_str;
@@ -53,14 +67,24 @@ void logger_log_packet(Packet *packet) {
             break;
     }
     
+    // Tunnel columns stay empty for plain packets
+    char tunnel_id[16] = "";
+    if (packet->tunnel != TUNNEL_NONE) {
+        snprintf(tunnel_id, sizeof(tunnel_id), "%u", packet->tunnel_id);
+    }
+    
     // Write packet info to log file in CSV format
-    fprintf(log_file, "%s.%06ld,%s,%s,%u,%s,%u,%u\n",
-            timestamp, packet->timestamp.tv_usec,
-            proto_str,
-            packet->src_ip, packet->src_port,
-            packet->dst_ip, packet->dst_port,
-            packet->size);
+    char line[256];
+    int length = snprintf(line, sizeof(line), "%s.%06ld,%s,%s,%u,%s,%u,%u,%u,%s,%s\n",
+                          timestamp, packet->timestamp.tv_usec,
+                          proto_str,
+                          packet->src_ip, packet->src_port,
+                          packet->dst_ip, packet->dst_port,
+                          packet->size, packet->sample_rate,
+                          packet->tunnel != TUNNEL_NONE ? tunnel_name(packet->tunnel) : "",
+                          tunnel_id);
     
-    // Flush to ensure data is written immediately
-    fflush(log_file);
+    if (length > 0) {
+        io_writer_write(log_file, line, length < (int)sizeof(line) ? (size_t)length : sizeof(line) - 1);
+    }
 }
\ No newline at end of file
@@ -7,5 +7,6 @@
 int logger_init(const char *filename);
 void logger_cleanup(void);
 void logger_log_packet(Packet *packet);
+void logger_flush(void);
 
 #endif // ZIM_LOGGER_H
\ No newline at end of file
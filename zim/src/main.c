@@ -4,14 +4,33 @@
 #include <unistd.h>
 #include <signal.h>
 #include <time.h>
+#include <sys/time.h>
 #include "network.h"
 #include "packet_parser.h"
 #include "display.h"
 #include "logger.h"
 #include "filter.h"
+#include "sampler.h"
+#include "capture.h"
+#include "pcap_writer.h"
+#include "store.h"
+#include "compress.h"
+#include "query.h"
+#include "replay.h"
+#include "flow.h"
+#include "ipfix.h"
+#include "detect.h"
+#include "tcpstat.h"
+#include "stats_file.h"
+#include "control.h"
+#include "pipeline.h"
+#include "placement.h"
 #include "utils.h"
 #include "config.h"
 
+// Packets displayed between keyboard and display checks
+#define MAIN_BATCH 256
+
 // Global variables
 volatile sig_atomic_t running = 1;
 ZimConfig config;
@@ -38,12 +57,37 @@ void print_welcome() {
 
 void print_usage(char *program_name) {
     printf("Usage: %s [options]\n", program_name);
+    printf("       %s query <file> [options]   (see '%s query -h')\n", program_name, program_name);
+    printf("       %s stats <file> [options]   (see '%s stats -h')\n", program_name, program_name);
+    printf("       %s attach [options]         (see '%s attach -h')\n", program_name, program_name);
     printf("Options:\n");
-    printf("  -i <interface>  Specify network interface (default: first available)\n");
-    printf("  -f <filter>     Specify BPF filter string\n");
+    printf("  -i <interfaces> Comma-separated interfaces or 'any' (default: first available)\n");
+    printf("  -f <filter>     Capture filter expression (see README)\n");
     printf("  -l <file>       Log packets to specified file\n");
+    printf("  -a <file>       Log scan and flood alerts to specified file\n");
+    printf("  -w <file>       Write raw packets to a pcap capture file\n");
+    printf("  -o <file>       Write packet records to a columnar store for 'zim query'\n");
+    printf("  -O              Write logs and captures with O_DIRECT (bypass the page cache)\n");
+#ifdef ZIM_HAVE_ZSTD
+    printf("  -z <lz4|zstd>   Compress logs, captures and record stores\n");
+#else
+    printf("  -z <lz4>        Compress logs, captures and record stores\n");
+#endif
+    printf("  -r <file>       Replay packets from a pcap capture instead of capturing\n");
+    printf("  -T <from,to>    Replay only this time range (uses the capture index)\n");
+    printf("  -H <ip>         Replay only packets to or from this host\n");
+    printf("  -P <file>       Keep statistics in a persistent file and resume from it\n");
     printf("  -c <count>      Capture only <count> packets\n");
     printf("  -p              Promiscuous mode (capture all packets)\n");
+    printf("  -S <N|auto[:N]> Sample 1-in-N packets, or shed load adaptively\n");
+    printf("  -x <host:port>  Export flow records to an IPFIX/NetFlow collector (UDP)\n");
+    printf("  -X <ipfix|v9>   Flow export protocol (default: ipfix)\n");
+    printf("  -D              Daemon mode: no terminal output, control socket enabled\n");
+    printf("  -C <path>       Control socket path (default with -D: %s)\n", CONTROL_DEFAULT_PATH);
+    printf("  -A <cpus|auto>  Pin capture threads, then the parse and output threads, to CPUs\n");
+    printf("  -B <usec>       Busy-poll capture sockets for up to <usec> microseconds\n");
+    printf("  -N              Place packet buffers on each interface's NUMA node\n");
+    printf("  -G              Back packet buffers with hugepages\n");
     printf("  -h              Show this help message\n");
 }
 
@@ -54,13 +98,31 @@ int parse_arguments(int argc, char *argv[], ZimConfig *config) {
     config->interface[0] = '\0';
     config->filter[0] = '\0';
     config->log_file[0] = '\0';
+    config->alert_file[0] = '\0';
+    config->pcap_file[0] = '\0';
+    config->store_file[0] = '\0';
+    config->replay_file[0] = '\0';
+    config->replay_window[0] = '\0';
+    config->replay_host[0] = '\0';
+    config->stats_file[0] = '\0';
     config->packet_count = 0;  // 0 means capture indefinitely
     config->promiscuous = 0;
+    config->direct_io = 0;
+    config->compression = COMPRESS_NONE;
+    config->sample_spec[0] = '\0';
+    config->flow_collector[0] = '\0';
+    config->flow_version = IPFIX_VERSION;
+    config->daemon = 0;
+    config->control_path[0] = '\0';
+    config->cpu_list[0] = '\0';
+    config->busy_poll_usec = 0;
+    config->numa = 0;
+    config->hugepages = 0;
     
-    while ((opt = getopt(argc, argv, "i:f:l:c:ph")) != -1) {
+    while ((opt = getopt(argc, argv, "i:f:l:a:w:o:Oz:r:T:H:P:c:pS:x:X:DC:A:B:NGh")) != -1) {
         switch (opt) {
             case 'i':
-                strncpy(config->interface, optarg, MAX_INTERFACE_LEN - 1);
+                strncpy(config->interface, optarg, MAX_INTERFACE_LIST_LEN - 1);
                 break;
             case 'f':
                 strncpy(config->filter, optarg, MAX_FILTER_LEN - 1);
@@ -68,12 +130,81 @@ int parse_arguments(int argc, char *argv[], ZimConfig *config) {
             case 'l':
                 strncpy(config->log_file, optarg, MAX_FILENAME_LEN - 1);
                 break;
+            case 'a':
+                strncpy(config->alert_file, optarg, MAX_FILENAME_LEN - 1);
+                break;
+            case 'w':
+                strncpy(config->pcap_file, optarg, MAX_FILENAME_LEN - 1);
+                break;
+            case 'o':
+                strncpy(config->store_file, optarg, MAX_FILENAME_LEN - 1);
+                break;
+            case 'O':
+                config->direct_io = 1;
+                break;
+            case 'z':
+                config->compression = compress_parse(optarg);
+                if (config->compression < 0) {
+                    fprintf(stderr, "Unknown or unsupported compression: %s\n", optarg);
+                    return -1;
+                }
+                break;
+            case 'r':
+                strncpy(config->replay_file, optarg, MAX_FILENAME_LEN - 1);
+                break;
+            case 'T':
+                strncpy(config->replay_window, optarg, sizeof(config->replay_window) - 1);
+                break;
+            case 'H':
+                strncpy(config->replay_host, optarg, MAX_ADDR_STR_LEN - 1);
+                break;
+            case 'P':
+                strncpy(config->stats_file, optarg, MAX_FILENAME_LEN - 1);
+                break;
             case 'c':
                 config->packet_count = atoi(optarg);
                 break;
             case 'p':
                 config->promiscuous = 1;
                 break;
+            case 'S':
+                strncpy(config->sample_spec, optarg, MAX_SPEC_LEN - 1);
+                break;
+            case 'x':
+                strncpy(config->flow_collector, optarg, MAX_FILENAME_LEN - 1);
+                break;
+            case 'X':
+                if (strcmp(optarg, "ipfix") == 0) {
+                    config->flow_version = IPFIX_VERSION;
+                } else if (strcmp(optarg, "v9") == 0) {
+                    config->flow_version = NETFLOW_V9_VERSION;
+                } else {
+                    fprintf(stderr, "Unknown flow export protocol: %s\n", optarg);
+                    return -1;
+                }
+                break;
+            case 'D':
+                config->daemon = 1;
+                break;
+            case 'C':
+                strncpy(config->control_path, optarg, MAX_FILENAME_LEN - 1);
+                break;
+            case 'A':
+                strncpy(config->cpu_list, optarg, sizeof(config->cpu_list) - 1);
+                break;
+            case 'B':
+                config->busy_poll_usec = atoi(optarg);
+                if (config->busy_poll_usec <= 0) {
+                    fprintf(stderr, "Invalid busy-poll time: %s\n", optarg);
+                    return -1;
+                }
+                break;
+            case 'N':
+                config->numa = 1;
+                break;
+            case 'G':
+                config->hugepages = 1;
+                break;
             case 'h':
                 print_usage(argv[0]);
                 return 0;
@@ -83,13 +214,80 @@ int parse_arguments(int argc, char *argv[], ZimConfig *config) {
         }
     }
     
+    if (config->daemon && config->control_path[0] == '\0') {
+        strncpy(config->control_path, CONTROL_DEFAULT_PATH, MAX_FILENAME_LEN - 1);
+    }
+    
     return 1;
 }
 
+// Swap the filter at runtime: publish the program, then replace the
+// kernel filters
+void change_filter(const char *expression) {
+    char error[128];
+    
+    if (filter_swap(expression, error, sizeof(error)) != 0) {
+        printf("%s-- filter error: %s --%s\n", COLOR_RED, error, COLOR_RESET);
+        return;
+    }
+    capture_apply_filter(filter_current());
+    
+    strncpy(config.filter, expression, MAX_FILTER_LEN - 1);
+    config.filter[MAX_FILTER_LEN - 1] = '\0';
+    printf("%s-- filter: %s --%s\n", COLOR_MAGENTA,
+           config.filter[0] != '\0' ? config.filter : "(none)", COLOR_RESET);
+}
+
+// Replay a stored capture, narrowed by -T and -H
+int open_replay(void) {
+    QueryPredicate predicate;
+    
+    memset(&predicate, 0, sizeof(predicate));
+    predicate.time_to = UINT64_MAX;
+    
+    if (config.replay_window[0] != '\0' &&
+        query_parse_time_range(config.replay_window, &predicate) != 0) {
+        fprintf(stderr, "Error: Invalid time range: %s\n", config.replay_window);
+        return -1;
+    }
+    if (config.replay_host[0] != '\0') {
+        if (parse_ipv4(config.replay_host, &predicate.addr) != 0) {
+            fprintf(stderr, "Error: Invalid host: %s\n", config.replay_host);
+            return -1;
+        }
+        predicate.has_addr = 1;
+    }
+    
+    return replay_open(config.replay_file, &predicate);
+}
+
+void cleanup_outputs(void) {
+    logger_cleanup();
+    pcap_writer_cleanup();
+    store_writer_cleanup();
+    pipeline_expire_flows(1);
+    ipfix_cleanup();
+    flow_cleanup();
+    detect_cleanup();
+    tcpstat_cleanup();
+    stats_cleanup();
+}
+
 int main(int argc, char *argv[]) {
-    int sock_fd;
     int result;
-    struct timespec sleep_time = {0, 100000000}; // 100ms
+    struct timespec idle_time = {0, 1000000};  // 1ms
+    struct timespec now, last_refresh = {0, 0};
+    
+    // Offline subcommands
+    if (argc > 1 && strcmp(argv[1], "query") == 0) {
+        return query_main(argc - 1, argv + 1);
+    }
+    if (argc > 1 && strcmp(argv[1], "stats") == 0) {
+        return stats_file_main(argc - 1, argv + 1);
+    }
+    if (argc > 1 && strcmp(argv[1], "attach") == 0) {
+        return attach_main(argc - 1, argv + 1);
+    }
     
     // Parse command line arguments
     result = parse_arguments(argc, argv, &config);
@@ -97,24 +295,58 @@ int main(int argc, char *argv[]) {
         return result == 0 ? 0 : 1;
     }
     
-    // Set up signal handler for Ctrl+C
+    // Set up signal handlers for Ctrl+C and service managers
     signal(SIGINT, signal_handler);
+    signal(SIGTERM, signal_handler);
     
-    // Display welcome message
-    print_welcome();
+    // Display welcome message and take over the terminal, unless headless
+    if (!config.daemon) {
+        print_welcome();
+        display_init();
+    }
     
-    // Initialize modules
-    display_init();
+    // Resume persistent statistics before the interfaces are named
+    if (config.stats_file[0] != '\0') {
+        if (stats_file_open(config.stats_file) != 0) {
+            display_cleanup();
+            return 1;
+        }
+        printf("Statistics file: %s (resuming at %lu packets)\n",
+               config.stats_file, stats->total_packets);
+    }
     
-    // If no interface specified, find the first available one
-    if (config.interface[0] == '\0') {
-        if (find_default_interface(config.interface, MAX_INTERFACE_LEN) != 0) {
-            fprintf(stderr, "Error: Could not find a default interface.\n");
+    if (config.replay_file[0] != '\0') {
+        // Offline replay: one pseudo-interface, no capture threads
+        if (open_replay() != 0) {
             return 1;
         }
+        stats_set_interface(0, "replay");
+        printf("Replaying: %s\n", config.replay_file);
+    } else {
+        // If no interface specified, find the first available one
+        if (config.interface[0] == '\0') {
+            if (find_default_interface(config.interface, MAX_INTERFACE_LEN) != 0) {
+                fprintf(stderr, "Error: Could not find a default interface.\n");
+                return 1;
+            }
+        }
+        
+        config.interface_count = capture_parse_interfaces(config.interface, config.interfaces,
+                                                          MAX_INTERFACES);
+        if (config.interface_count <= 0) {
+            fprintf(stderr, "Error: No usable interface in: %s\n", config.interface);
+            return 1;
+        }
+        
+        for (int i = 0; i < config.interface_count; i++) {
+            stats_set_interface(i, config.interfaces[i]);
+            printf("Using interface: %s\n", config.interfaces[i]);
+        }
     }
     
-    printf("Using interface: %s\n", config.interface);
+    if (config.compression != COMPRESS_NONE) {
+        printf("Compressing output with %s\n", compress_name(config.compression));
+    }
     
     // Initialize packet logger if log file specified
     if (config.log_file[0] != '\0') {
@@ -125,77 +357,187 @@ int main(int argc, char *argv[]) {
         printf("Logging to file: %s\n", config.log_file);
     }
     
-    // Create raw socket
-    sock_fd = create_raw_socket(config.interface, config.promiscuous);
-    if (sock_fd < 0) {
-        fprintf(stderr, "Error: Failed to create raw socket.\n");
-        logger_cleanup();
+    // Initialize capture file writer if requested
+    if (config.pcap_file[0] != '\0') {
+        if (pcap_writer_init(config.pcap_file) != 0) {
+            fprintf(stderr, "Error: Could not open capture file.\n");
+            cleanup_outputs();
+            return 1;
+        }
+        printf("Writing packets to: %s\n", config.pcap_file);
+    }
+    
+    // Scan and flood detection always runs; -a also logs its alerts
+    if (detect_init(config.alert_file) != 0) {
+        fprintf(stderr, "Error: Could not initialize detection.\n");
+        cleanup_outputs();
+        return 1;
+    }
+    if (config.alert_file[0] != '\0') {
+        printf("Logging alerts to: %s\n", config.alert_file);
+    }
+    
+    // Passive RTT and retransmission measurement
+    if (tcpstat_init() != 0) {
+        fprintf(stderr, "Error: Could not initialize TCP analytics.\n");
+        cleanup_outputs();
+        return 1;
+    }
+    
+    // Per-source counters for the top source lists
+    if (stats_init() != 0) {
+        fprintf(stderr, "Error: Could not initialize source statistics.\n");
+        cleanup_outputs();
         return 1;
     }
     
-    // Apply filter if specified
+    // Initialize columnar record store if requested
+    if (config.store_file[0] != '\0') {
+        if (store_writer_init(config.store_file) != 0) {
+            fprintf(stderr, "Error: Could not open record store.\n");
+            cleanup_outputs();
+            return 1;
+        }
+        printf("Writing records to: %s\n", config.store_file);
+    }
+    
+    // Initialize sampling / load shedding if requested
+    if (config.sample_spec[0] != '\0') {
+        if (sampler_init(config.sample_spec) != 0) {
+            cleanup_outputs();
+            return 1;
+        }
+        printf("Sampling: %s\n", config.sample_spec);
+    }
+    
+    // Initialize flow export if a collector was given
+    if (config.flow_collector[0] != '\0') {
+        if (ipfix_init(config.flow_collector, config.flow_version) != 0 ||
+            flow_init(ipfix_export_flow) != 0) {
+            cleanup_outputs();
+            return 1;
+        }
+        printf("Exporting flows to: %s (%s)\n", config.flow_collector,
+               config.flow_version == IPFIX_VERSION ? "IPFIX" : "NetFlow v9");
+    }
+    
+    // Compile the initial filter; capture_start() attaches it to the sockets
     if (config.filter[0] != '\0') {
-        if (apply_filter(sock_fd, config.filter) != 0) {
-            fprintf(stderr, "Error: Failed to apply filter: %s\n", config.filter);
-            close(sock_fd);
-            logger_cleanup();
+        char error[128];
+        if (filter_swap(config.filter, error, sizeof(error)) != 0) {
+            fprintf(stderr, "Error: Invalid filter: %s\n", error);
+            cleanup_outputs();
             return 1;
         }
         printf("Applied filter: %s\n", config.filter);
     }
     
+    // CPUs and NUMA nodes for the threads and buffers started below
+    if (placement_init(config.cpu_list, config.numa, config.hugepages, config.interfaces,
+                       config.replay_file[0] == '\0' ? config.interface_count : 0) != 0) {
+        cleanup_outputs();
+        return 1;
+    }
+    
+    // Open one socket and capture thread per interface
+    if (config.replay_file[0] == '\0' &&
+        capture_start(config.interfaces, config.interface_count, config.promiscuous,
+                      config.busy_poll_usec) != 0) {
+        cleanup_outputs();
+        return 1;
+    }
+    
+    // Accept commands on the control socket if requested
+    if (config.control_path[0] != '\0') {
+        if (control_init(config.control_path) != 0) {
+            capture_stop();
+            cleanup_outputs();
+            return 1;
+        }
+        printf("Control socket: %s\n", config.control_path);
+    }
+    
+    // Parse and output stages
+    if (pipeline_start() != 0) {
+        control_cleanup();
+        capture_stop();
+        cleanup_outputs();
+        return 1;
+    }
+    
+    // Where threads and buffers ended up, with -A, -B, -N or -G
+    placement_report(config.busy_poll_usec);
+    
     printf("Starting packet capture...\n");
     
-    // Main capture loop
-    unsigned long packet_count = 0;
+    // Main loop: keyboard, control socket and the display stage
+    int draining = 0;
+    fflush(stdout);
     while (running) {
         // Process keyboard input
-        int key = display_check_input();
-        if (key == 'q') {
-            running = 0;
-            continue;
-        } else if (key == 'h') {
-            display_help();
-        }
-        
-        // Process a packet if available
-        Packet packet;
-        if (capture_packet(sock_fd, &packet) > 0) {
-            packet_count++;
-            
-            // Parse packet
-            parse_packet(&packet);
-            
-            // Update statistics
-            update_statistics(&packet);
-            
-            // Log packet if logging enabled
-            if (config.log_file[0] != '\0') {
-                logger_log_packet(&packet);
-            }
-            
-            // Display packet info
-            display_packet(&packet);
-            
-            // Check if we've reached the capture limit
-            if (config.packet_count > 0 && packet_count >= config.packet_count) {
+        if (!config.daemon) {
+            int key = display_check_input();
+            if (key == 'q') {
                 running = 0;
+                continue;
+            } else if (key == 'h') {
+                display_help();
+            } else if (key == DISPLAY_KEY_FILTER) {
+                change_filter(display_filter_input());
             }
         }
         
-        // Update display
-        display_update();
+        // Free filter programs the parse thread can no longer be using
+        filter_reclaim();
+        
+        // Serve control clients; a drain stops capturing new packets
+        control_poll();
+        if (control_drain_requested() && !draining) {
+            printf("Draining queued packets...\n");
+            capture_quiesce();
+            pipeline_drain();
+            draining = 1;
+        }
+        
+        // Show what the output stage passed on
+        int shown = config.daemon ? 0 : pipeline_display(MAIN_BATCH);
         
-        // Sleep a bit to avoid using 100% CPU
-        nanosleep(&sleep_time, NULL);
+        // Update display at most ten times a second
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (!config.daemon &&
+            (now.tv_sec - last_refresh.tv_sec) * 1000000000L +
+            (now.tv_nsec - last_refresh.tv_nsec) >= 100000000L) {
+            display_update();
+            last_refresh = now;
+        }
+        
+        // Replay done, packet limit reached or drained, and every packet
+        // written and shown
+        if (pipeline_finished()) {
+            if (!config.daemon) {
+                display_update();
+            }
+            running = 0;
+        }
+        
+        // Sleep briefly when idle to avoid using 100% CPU
+        if (shown == 0) {
+            nanosleep(&idle_time, NULL);
+        }
     }
     
     // Clean up
-    close(sock_fd);
-    logger_cleanup();
+    control_cleanup();
+    capture_quiesce();
+    pipeline_stop();
+    capture_stop();
+    replay_close();
+    filter_cleanup();
+    cleanup_outputs();
     display_cleanup();
+    stats_file_close();
     
-    printf("\nCapture complete. Processed %lu packets.\n", packet_count);
+    printf("\nCapture complete. Processed %lu packets.\n", pipeline_packets());
     
     return 0;
-}
\ No newline at end of file
+}
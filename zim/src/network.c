@@ -1,10 +1,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stddef.h>
 #include <unistd.h>
+#include <errno.h>
 #include <arpa/inet.h>
 #include <sys/socket.h>
 #include <sys/ioctl.h>
+#include <sys/time.h>
 #include <net/if.h>
 #include <linux/if_packet.h>
 #include <net/ethernet.h>
@@ -13,6 +16,10 @@
 #include "network.h"
 #include "utils.h"
 
+#ifndef SO_PREFER_BUSY_POLL
+#define SO_PREFER_BUSY_POLL 69  // Missing from older C library headers
+#endif
+
 int find_default_interface(char *interface, size_t len) {
     struct ifaddrs *ifaddr, *ifa;
     
@@ -25,15 +32,15 @@ int find_default_interface(char *interface, size_t len) {
     for (ifa = ifaddr; ifa != NULL; ifa = ifa->ifa_next) {
         if (ifa->ifa_addr == NULL)
             continue;
-            
+        
         // Skip loopback
         if (strcmp(ifa->ifa_name, "lo") == 0)
             continue;
-            
+        
         // Check if interface is up
         if (!(ifa->ifa_flags & IFF_UP))
             continue;
-            
+        
         // Found a suitable interface
         strncpy(interface, ifa->ifa_name, len - 1);
         interface[len - 1] = '\0';
@@ -45,7 +52,36 @@ int find_default_interface(char *interface, size_t len) {
     return -1;
 }
 
-int create_raw_socket(const char *interface, int promiscuous) {
+int find_all_interfaces(char names[][MAX_INTERFACE_LEN], int max) {
+    struct ifaddrs *ifaddr, *ifa;
+    int count = 0;
+    
+    if (getifaddrs(&ifaddr) == -1) {
+        perror("getifaddrs");
+        return -1;
+    }
+    
+    // Every link appears exactly once with an AF_PACKET address
+    for (ifa = ifaddr; ifa != NULL && count < max; ifa = ifa->ifa_next) {
+        if (ifa->ifa_addr == NULL || ifa->ifa_addr->sa_family != AF_PACKET)
+            continue;
+        
+        if (strcmp(ifa->ifa_name, "lo") == 0)
+            continue;
+        
+        if (!(ifa->ifa_flags & IFF_UP))
+            continue;
+        
+        strncpy(names[count], ifa->ifa_name, MAX_INTERFACE_LEN - 1);
+        names[count][MAX_INTERFACE_LEN - 1] = '\0';
+        count++;
+    }
+    
+    freeifaddrs(ifaddr);
+    return count;
+}
+
+int create_raw_socket(const char *interface, int promiscuous, int busy_poll_usec) {
     int sock_fd;
     struct ifreq ifr;
     
@@ -103,29 +139,94 @@ int create_raw_socket(const char *interface, int promiscuous) {
         return -1;
     }
     
+    // Have the kernel receive timestamp delivered with each packet, so
+    // packets from different interfaces can be ordered against each
+    // other without a second system call per packet
+    int on = 1;
+    if (setsockopt(sock_fd, SOL_SOCKET, SO_TIMESTAMP, &on, sizeof(on)) < 0) {
+        perror("setsockopt(SO_TIMESTAMP)");
+    }
+    
+    // Poll the device queue from the receive instead of sleeping until the
+    // interrupt. Capture still works without it, just with more jitter.
+    if (busy_poll_usec > 0) {
+        int prefer = 1;
+        
+        if (setsockopt(sock_fd, SOL_SOCKET, SO_BUSY_POLL, &busy_poll_usec,
+                       sizeof(busy_poll_usec)) < 0) {
+            perror("setsockopt(SO_BUSY_POLL)");
+        } else if (setsockopt(sock_fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &prefer,
+                              sizeof(prefer)) < 0) {
+            perror("setsockopt(SO_PREFER_BUSY_POLL)");  // Linux 5.11 and later
+        }
+    }
+    
     return sock_fd;
 }
 
-int apply_filter(int sock_fd, const char *filter) {
-    // Note: This is a placeholder for BPF filtering.
-    // In a real implementation, this would use libpcap's pcap_compile and pcap_setfilter,
-    // or the Linux socket filter (BPF) directly.
-    // For simplicity, we're not implementing the actual filter here.
+// Attach a compiled filter. The kernel swaps socket filters atomically,
+// so a replacement never lets a packet through unfiltered.
+int apply_filter(int sock_fd, const FilterProgram *program) {
+    struct sock_fprog fprog;
+    
+    fprog.len = program->length;
+    fprog.filter = (struct sock_filter *)program->code;
+    
+    if (setsockopt(sock_fd, SOL_SOCKET, SO_ATTACH_FILTER, &fprog, sizeof(fprog)) < 0) {
+        perror("setsockopt(SO_ATTACH_FILTER)");
+        return -1;
+    }
     
-    // Return success to allow the program to continue
     return 0;
 }
 
-int capture_packet(int sock_fd, Packet *packet) {
+// Let every packet through, for when a new filter cannot be attached and
+// the old one must not keep rejecting what the new one accepts. Falls
+// back to attaching an accept-all program if detaching fails.
+int remove_filter(int sock_fd) {
+    struct sock_filter accept_all = BPF_STMT(BPF_RET | BPF_K, 0xffffffff);
+    struct sock_fprog fprog = {1, &accept_all};
+    int unused = 0;
+    
+    if (setsockopt(sock_fd, SOL_SOCKET, SO_DETACH_FILTER, &unused, sizeof(unused)) == 0 ||
+        errno == ENOENT) {
+        return 0;
+    }
+    
+    if (setsockopt(sock_fd, SOL_SOCKET, SO_ATTACH_FILTER, &fprog, sizeof(fprog)) < 0) {
+        perror("setsockopt(SO_ATTACH_FILTER)");
+        return -1;
+    }
+    
+    return 0;
+}
+
+int capture_packet(int sock_fd, Packet *packet, int flags) {
     int packet_size;
+    char control[CMSG_SPACE(sizeof(struct timeval))];
+    struct iovec iov = {packet->buffer, MAX_PACKET_SIZE};
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
     
-    // Initialize packet structure
-    memset(packet, 0, sizeof(Packet));
+    // Initialize packet structure. The raw buffer is overwritten by the
+    // receive, and clearing all 64 KB of it would cost more than the
+    // rest of the capture path.
+    memset(packet, 0, offsetof(Packet, pool));
+    
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
     
     // Capture a packet
-    packet_size = recvfrom(sock_fd, packet->buffer, MAX_PACKET_SIZE, 0, NULL, NULL);
+    packet_size = recvmsg(sock_fd, &msg, flags);
     if (packet_size < 0) {
-        perror("recvfrom");
+        // Receive timeouts let capture threads notice shutdown
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+            return 0;
+        }
+        // Other errors are left in errno for the caller to report
         return -1;
     }
     
@@ -134,11 +235,32 @@ int capture_packet(int sock_fd, Packet *packet) {
         return 0;
     }
     
-    // Get timestamp
-    gettimeofday(&packet->timestamp, NULL);
+    // Take the kernel receive timestamp, or the current time if the
+    // socket could not be set up to deliver one
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMP) {
+            memcpy(&packet->timestamp, CMSG_DATA(cmsg), sizeof(packet->timestamp));
+            break;
+        }
+    }
+    if (cmsg == NULL) {
+        gettimeofday(&packet->timestamp, NULL);
+    }
     
     // Set packet size
     packet->size = packet_size;
     
     return packet_size;
+}
+
+unsigned long get_socket_drops(int sock_fd) {
+    struct tpacket_stats kstats;
+    socklen_t len = sizeof(kstats);
+    
+    // Counters are reset by the kernel on every read
+    if (getsockopt(sock_fd, SOL_PACKET, PACKET_STATISTICS, &kstats, &len) < 0) {
+        return 0;
+    }
+    
+    return kstats.tp_drops;
 }
\ No newline at end of file
@@ -6,18 +6,22 @@
 #include <netinet/udp.h>
 #include <netinet/if_ether.h>
 #include "config.h"
+#include "filter.h"
 
 // Packet structure
 typedef struct {
     struct timeval timestamp;
     unsigned int size;
     unsigned int protocol;
+    int if_index;  // Index of the capturing interface (see capture.h)
     
     // Addressing information
     char src_mac[18];
     char dst_mac[18];
     char src_ip[MAX_ADDR_STR_LEN];
     char dst_ip[MAX_ADDR_STR_LEN];
+    unsigned int src_addr;  // IPv4, host byte order
+    unsigned int dst_addr;
     unsigned short src_port;
     unsigned short dst_port;
     
@@ -31,14 +35,37 @@ typedef struct {
     unsigned char payload[MAX_PAYLOAD_SIZE];
     unsigned int payload_size;
     
+    // Load shedding (see sampler.h)
+    unsigned int shed;         // Stages skipped for this packet
+    unsigned int sample_rate;  // Packets this record stands for
+    
+    // Generation of the kernel filter that admitted it, 0 if unknown
+    unsigned long filter_generation;
+    
+    // Innermost tunnel the addressing above was taken from (see tunnel.h)
+    unsigned int tunnel;
+    unsigned int tunnel_id;       // VNI or GRE key
+    unsigned int outer_src_addr;  // Outermost IPv4 header, host byte order
+    unsigned int outer_dst_addr;
+    
+    // TCP analytics of this packet (see tcpstat.h)
+    unsigned int tcp_events;
+    unsigned int rtt_usec;
+    
+    // Descriptor pool the packet belongs to (see pool.h); kept across reuse
+    struct PacketPool *pool;
+    
     // Raw packet data
     unsigned char buffer[MAX_PACKET_SIZE];
 } Packet;
 
 // Function prototypes
 int find_default_interface(char *interface, size_t len);
-int create_raw_socket(const char *interface, int promiscuous);
-int apply_filter(int sock_fd, const char *filter);
-int capture_packet(int sock_fd, Packet *packet);
+int find_all_interfaces(char names[][MAX_INTERFACE_LEN], int max);
+int create_raw_socket(const char *interface, int promiscuous, int busy_poll_usec);
+int apply_filter(int sock_fd, const FilterProgram *program);
+int remove_filter(int sock_fd);
+int capture_packet(int sock_fd, Packet *packet, int flags);
+unsigned long get_socket_drops(int sock_fd);
 
 #endif // ZIM_NETWORK_H
\ No newline at end of file
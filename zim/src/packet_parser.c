@@ -4,10 +4,40 @@
 #include <arpa/inet.h>
 #include <netinet/ip_icmp.h>
 #include "packet_parser.h"
+#include "sampler.h"
+#include "tunnel.h"
 #include "utils.h"
 
 // Initialize global statistics
-PacketStats stats = {0};
+static PacketStats local_stats;
+PacketStats *stats = &local_stats;  // Points into the stats file with -P
+
+// Per-source counters behind the top lists
+static TopKIndex *sources = NULL;
+
+// Call once the statistics block is in place (see stats_file_open()), so
+// the busiest sources of a resumed file carry on where they left off
+int stats_init(void) {
+    sources = topk_create(STATS_SOURCE_CAPACITY);
+    if (sources == NULL) {
+        return -1;
+    }
+    
+    for (int i = 0; i < STATS_TOP_SOURCES; i++) {
+        unsigned int addr;
+        
+        if (stats->top_sources[i].ip[0] != '\0' &&
+            parse_ipv4(stats->top_sources[i].ip, &addr) == 0) {
+            topk_seed(sources, addr, stats->top_sources[i].count, 0);
+        }
+    }
+    return 0;
+}
+
+void stats_cleanup(void) {
+    topk_free(sources);
+    sources = NULL;
+}
 
 void parse_ethernet_header(Packet *packet) {
     struct ethhdr *eth_header = (struct ethhdr *)packet->buffer;
@@ -18,24 +48,36 @@ void parse_ethernet_header(Packet *packet) {
             eth_header->h_source[0], eth_header->h_source[1],
             eth_header->h_source[2], eth_header->h_source[3],
             eth_header->h_source[4], eth_header->h_source[5]);
-            
+    
     sprintf(packet->dst_mac, "%02X:%02X:%02X:%02X:%02X:%02X",
             eth_header->h_dest[0], eth_header->h_dest[1],
             eth_header->h_dest[2], eth_header->h_dest[3],
             eth_header->h_dest[4], eth_header->h_dest[5]);
 }
 
-void parse_ip_header(Packet *packet) {
-    struct iphdr *ip_header = (struct iphdr *)(packet->buffer + sizeof(struct ethhdr));
+// Returns -1, leaving the packet without an IP header, when the header
+// does not fit in the captured frame
+int parse_ip_header(Packet *packet, unsigned int offset) {
+    struct iphdr *ip_header = (struct iphdr *)(packet->buffer + offset);
+    
+    if (offset + sizeof(struct iphdr) > packet->size || ip_header->ihl < 5 ||
+        offset + ip_header->ihl * 4 > packet->size) {
+        return -1;
+    }
     packet->ip_header = ip_header;
     
     // Set protocol
     packet->protocol = ip_header->protocol;
-    
-    // Convert IP addresses to string format
+    packet->src_addr = ntohl(ip_header->saddr);
+    packet->dst_addr = ntohl(ip_header->daddr);
+    return 0;
+}
+
+// Address strings are only needed for the innermost header
+static void format_ip_addresses(Packet *packet) {
     struct in_addr src_addr, dst_addr;
-    src_addr.s_addr = ip_header->saddr;
-    dst_addr.s_addr = ip_header->daddr;
+    src_addr.s_addr = packet->ip_header->saddr;
+    dst_addr.s_addr = packet->ip_header->daddr;
     
     strncpy(packet->src_ip, inet_ntoa(src_addr), MAX_ADDR_STR_LEN - 1);
     packet->src_ip[MAX_ADDR_STR_LEN - 1] = '\0';
@@ -45,9 +87,15 @@ void parse_ip_header(Packet *packet) {
 }
 
 void parse_tcp_header(Packet *packet) {
-    struct tcphdr *tcp_header = (struct tcphdr *)(packet->buffer + 
-                                sizeof(struct ethhdr) + 
-                                (packet->ip_header->ihl * 4));
+    // Transport header follows the (innermost) IP header
+    int ip_end = ((unsigned char *)packet->ip_header - packet->buffer) + (packet->ip_header->ihl * 4);
+    struct tcphdr *tcp_header = (struct tcphdr *)(packet->buffer + ip_end);
+    
+    // A truncated segment is counted but its header is not trusted
+    if (ip_end + sizeof(struct tcphdr) > packet->size || tcp_header->doff < 5 ||
+        ip_end + tcp_header->doff * 4U > packet->size) {
+        return;
+    }
     packet->tcp_header = tcp_header;
     
     // Set ports
@@ -55,9 +103,9 @@ void parse_tcp_header(Packet *packet) {
     packet->dst_port = ntohs(tcp_header->dest);
     
     // Extract payload
-    int header_size = sizeof(struct ethhdr) + (packet->ip_header->ihl * 4) + (tcp_header->doff * 4);
+    int header_size = ip_end + (tcp_header->doff * 4);
     
-    if (packet->size > header_size) {
+    if (packet->size > header_size && !(packet->shed & SHED_STAGE_PAYLOAD)) {
         packet->payload_size = packet->size - header_size;
         if (packet->payload_size > MAX_PAYLOAD_SIZE) {
             packet->payload_size = MAX_PAYLOAD_SIZE;
@@ -67,9 +115,13 @@ void parse_tcp_header(Packet *packet) {
 }
 
 void parse_udp_header(Packet *packet) {
-    struct udphdr *udp_header = (struct udphdr *)(packet->buffer + 
-                                sizeof(struct ethhdr) + 
-                                (packet->ip_header->ihl * 4));
+    // Transport header follows the (innermost) IP header
+    int ip_end = ((unsigned char *)packet->ip_header - packet->buffer) + (packet->ip_header->ihl * 4);
+    struct udphdr *udp_header = (struct udphdr *)(packet->buffer + ip_end);
+    
+    if (ip_end + sizeof(struct udphdr) > packet->size) {
+        return;
+    }
     packet->udp_header = udp_header;
     
     // Set ports
@@ -77,9 +129,9 @@ void parse_udp_header(Packet *packet) {
     packet->dst_port = ntohs(udp_header->dest);
     
     // Extract payload
-    int header_size = sizeof(struct ethhdr) + (packet->ip_header->ihl * 4) + sizeof(struct udphdr);
+    int header_size = ip_end + sizeof(struct udphdr);
     
-    if (packet->size > header_size) {
+    if (packet->size > header_size && !(packet->shed & SHED_STAGE_PAYLOAD)) {
         packet->payload_size = packet->size - header_size;
         if (packet->payload_size > MAX_PAYLOAD_SIZE) {
             packet->payload_size = MAX_PAYLOAD_SIZE;
@@ -88,14 +140,38 @@ void parse_udp_header(Packet *packet) {
     }
 }
 
+// Capture does not clear the buffer, so every header is checked against
+// the captured size before it is read; a runt frame would otherwise be
+// parsed from whatever the previous packet left behind
 void parse_packet(Packet *packet) {
+    if (packet->size < sizeof(struct ethhdr)) {
+        return;
+    }
+    
     // Parse ethernet header
     parse_ethernet_header(packet);
     
     // Check if it's an IP packet
     if (ntohs(packet->eth_header->h_proto) == ETH_P_IP) {
+        unsigned int offset = sizeof(struct ethhdr);
+        
         // Parse IP header
-        parse_ip_header(packet);
+        if (parse_ip_header(packet, offset) < 0) {
+            return;
+        }
+        packet->outer_src_addr = packet->src_addr;
+        packet->outer_dst_addr = packet->dst_addr;
+        
+        // Start over on the inner packet of a tunnel
+        for (int depth = 0; depth < TUNNEL_MAX_DEPTH; depth++) {
+            offset = tunnel_decap(packet->buffer, packet->size, offset,
+                                  &packet->tunnel, &packet->tunnel_id);
+            if (offset == 0) {
+                break;
+            }
+            parse_ip_header(packet, offset);
+        }
+        format_ip_addresses(packet);
         
         // Parse protocol-specific headers
         switch (packet->protocol) {
@@ -116,46 +192,94 @@ void parse_packet(Packet *packet) {
 }
 
 void update_statistics(Packet *packet) {
-    stats.total_packets++;
-    stats.total_bytes += packet->size;
+    stats->total_packets++;
+    stats->total_bytes += packet->size;
+    
+    if (packet->if_index >= 0 && packet->if_index < stats->interface_count) {
+        stats->interfaces[packet->if_index].packets++;
+        stats->interfaces[packet->if_index].bytes += packet->size;
+    }
     
     // Update protocol-specific counts
+    int size_class;
     switch (packet->protocol) {
         case PROTO_TCP:
-            stats.tcp_packets++;
+            stats->tcp_packets++;
+            size_class = STATS_CLASS_TCP;
             break;
         case PROTO_UDP:
-            stats.udp_packets++;
+            stats->udp_packets++;
+            size_class = STATS_CLASS_UDP;
             break;
         case PROTO_ICMP:
-            stats.icmp_packets++;
+            stats->icmp_packets++;
+            size_class = STATS_CLASS_ICMP;
             break;
         default:
-            stats.other_packets++;
+            stats->other_packets++;
+            size_class = STATS_CLASS_OTHER;
             break;
     }
     
-    // Update source IP statistics for graph display
-    if (packet->src_ip[0] != '\0') {
-        int found = 0;
-        int empty_slot = -1;
-        
-        // Look for existing entry or empty slot
-        for (int i = 0; i < 10; i++) {
-            if (stats.top_sources[i].ip[0] == '\0' && empty_slot == -1) {
-                empty_slot = i;
-            } else if (strcmp(stats.top_sources[i].ip, packet->src_ip) == 0) {
-                stats.top_sources[i].count++;
-                found = 1;
-                break;
-            }
-        }
+    loghist_add(&stats->sizes[size_class], packet->size);
+    
+    if (packet->tunnel != TUNNEL_NONE) {
+        stats->tunnel_packets[packet->tunnel]++;
+        stats->tunnel_bytes[packet->tunnel] += packet->size;
+    }
+    
+    // Cardinality sketches
+    if (packet->ip_header != NULL) {
+        uint64_t ports = ((uint64_t)packet->src_port << 24) | ((uint64_t)packet->dst_port << 8) |
+                         (packet->protocol & 0xff);
+        uint64_t flow = sketch_hash(((uint64_t)packet->src_addr << 32) | packet->dst_addr) ^
+                        sketch_hash(ports);
         
-        // Add new entry if not found and empty slot available
-        if (!found && empty_slot != -1) {
-            strncpy(stats.top_sources[empty_slot].ip, packet->src_ip, MAX_ADDR_STR_LEN - 1);
-            stats.top_sources[empty_slot].ip[MAX_ADDR_STR_LEN - 1] = '\0';
-            stats.top_sources[empty_slot].count = 1;
-        }
+        hll_add(stats->unique_sources, STATS_HLL_PRECISION, sketch_hash(packet->src_addr));
+        hll_add(stats->unique_destinations, STATS_HLL_PRECISION, sketch_hash(packet->dst_addr));
+        hll_add(stats->unique_flows, STATS_HLL_PRECISION, sketch_hash(flow));
     }
-}
\ No newline at end of file
+    
+    // Source addresses for the top lists
+    if (sources != NULL && packet->ip_header != NULL) {
+        uint64_t now = (uint64_t)packet->timestamp.tv_sec * 1000000 + packet->timestamp.tv_usec;
+        topk_add(sources, packet->src_addr, packet->size, now);
+    }
+}
+
+// The largest sources by one sort key (TOPK_PACKETS, ...), largest first
+int stats_top_sources(int sort, TopKItem *items, int max) {
+    return sources != NULL ? topk_list(sources, sort, items, max) : 0;
+}
+
+unsigned long stats_sources_tracked(void) {
+    return sources != NULL ? topk_entries(sources) : 0;
+}
+
+// Copy the busiest sources into the statistics block, so the statistics
+// file carries them too
+void stats_refresh_sources(void) {
+    TopKItem items[STATS_TOP_SOURCES];
+    int count;
+    
+    if (sources == NULL) {
+        return;
+    }
+    
+    count = topk_list(sources, TOPK_PACKETS, items, STATS_TOP_SOURCES);
+    memset(stats->top_sources, 0, sizeof(stats->top_sources));
+    for (int i = 0; i < count; i++) {
+        format_ipv4(items[i].key, stats->top_sources[i].ip, MAX_ADDR_STR_LEN);
+        stats->top_sources[i].count = items[i].packets;
+    }
+}
+
+// Name interface slots, in index order. Counters resumed from a
+// statistics file are kept only if the slot still names the same interface.
+void stats_set_interface(int index, const char *name) {
+    if (strncmp(stats->interfaces[index].name, name, MAX_INTERFACE_LEN) != 0) {
+        memset(&stats->interfaces[index], 0, sizeof(stats->interfaces[index]));
+        strncpy(stats->interfaces[index].name, name, MAX_INTERFACE_LEN - 1);
+    }
+    stats->interface_count = index + 1;
+}
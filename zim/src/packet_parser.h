@@ -1,11 +1,26 @@
 #ifndef ZIM_PACKET_PARSER_H
 #define ZIM_PACKET_PARSER_H
 
+#include <stdint.h>
 #include "network.h"
+#include "sketch.h"
+#include "tunnel.h"
+#include "topk.h"
 
-// Function prototypes
-void parse_packet(Packet *packet);
-void update_statistics(Packet *packet);
+// Cardinality sketch precision: 4096 registers each, ~1.6% error
+#define STATS_HLL_PRECISION 12
+
+// Packet size histograms are kept per protocol class
+#define STATS_CLASS_TCP   0
+#define STATS_CLASS_UDP   1
+#define STATS_CLASS_ICMP  2
+#define STATS_CLASS_OTHER 3
+#define STATS_CLASSES     4
+
+// Source addresses tracked for the top lists, and how many are kept in
+// the statistics block
+#define STATS_SOURCE_CAPACITY (1 << 20)
+#define STATS_TOP_SOURCES 10
 
 // Statistics structure
 typedef struct {
@@ -15,15 +30,46 @@ typedef struct {
     unsigned long icmp_packets;
     unsigned long other_packets;
     unsigned long total_bytes;
+    unsigned long dropped_packets;  // Dropped before reaching the parser
+    
+    // Encapsulated packets by tunnel type, counted once for the innermost
+    unsigned long tunnel_packets[TUNNEL_TYPES];
+    unsigned long tunnel_bytes[TUNNEL_TYPES];
     
-    // Source IP tracking for graph display
+    // Per-interface counters; the totals above are the aggregate
+    struct {
+        char name[MAX_INTERFACE_LEN];
+        unsigned long packets;
+        unsigned long bytes;
+        unsigned long dropped;
+        unsigned long errors;  // Failed receives
+    } interfaces[MAX_INTERFACES];
+    int interface_count;
+    
+    // Busiest sources by packets, refreshed from the source index
     struct {
         char ip[MAX_ADDR_STR_LEN];
         unsigned long count;
-    } top_sources[10];
+    } top_sources[STATS_TOP_SOURCES];
+    
+    // Streaming sketches; mergeable with hll_merge() and loghist_merge()
+    uint8_t unique_sources[HLL_REGISTERS(STATS_HLL_PRECISION)];
+    uint8_t unique_destinations[HLL_REGISTERS(STATS_HLL_PRECISION)];
+    uint8_t unique_flows[HLL_REGISTERS(STATS_HLL_PRECISION)];
+    LogHistogram sizes[STATS_CLASSES];
 } PacketStats;
 
+// Function prototypes
+int stats_init(void);
+void stats_cleanup(void);
+void parse_packet(Packet *packet);
+void update_statistics(Packet *packet);
+int stats_top_sources(int sort, TopKItem *items, int max);
+unsigned long stats_sources_tracked(void);
+void stats_refresh_sources(void);
+void stats_set_interface(int index, const char *name);
+
 // Global statistics object
-extern PacketStats stats;
+extern PacketStats *stats;
 
 #endif // ZIM_PACKET_PARSER_H
\ No newline at end of file
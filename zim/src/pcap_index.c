@@ -0,0 +1,222 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "pcap_index.h"
+#include "tunnel.h"
+#include "config.h"
+
+// Bloom keys are tagged so an address never collides with a port
+#define BLOOM_TAG_ADDR 0x0100000000ULL
+#define BLOOM_TAG_PORT 0x0200000000ULL
+
+static FILE *index_file = NULL;
+static PcapIndexSegment current;
+static int segment_open = 0;
+
+static uint64_t bloom_hash(uint64_t key) {
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53ULL;
+    key ^= key >> 33;
+    return key;
+}
+
+// Double hashing: probe i is h1 + i * h2
+static void bloom_add(uint8_t *bloom, uint64_t key) {
+    uint64_t hash = bloom_hash(key);
+    uint32_t h1 = hash, h2 = (hash >> 32) | 1;
+    
+    for (uint32_t i = 0; i < PCAP_INDEX_BLOOM_HASHES; i++) {
+        uint32_t bit = (h1 + i * h2) % (PCAP_INDEX_BLOOM_BYTES * 8);
+        bloom[bit >> 3] |= 1 << (bit & 7);
+    }
+}
+
+static int bloom_contains(const uint8_t *bloom, uint64_t key) {
+    uint64_t hash = bloom_hash(key);
+    uint32_t h1 = hash, h2 = (hash >> 32) | 1;
+    
+    for (uint32_t i = 0; i < PCAP_INDEX_BLOOM_HASHES; i++) {
+        uint32_t bit = (h1 + i * h2) % (PCAP_INDEX_BLOOM_BYTES * 8);
+        if (!(bloom[bit >> 3] & (1 << (bit & 7)))) {
+            return 0;
+        }
+    }
+    
+    return 1;
+}
+
+static void index_path(const char *capture_filename, char *path, size_t size) {
+    snprintf(path, size, "%s%s", capture_filename, PCAP_INDEX_SUFFIX);
+}
+
+// Segments are appended and flushed as they close, so the index of a
+// capture that is still being written is usable
+static void flush_segment(void) {
+    if (index_file == NULL || !segment_open) {
+        return;
+    }
+    
+    fwrite(&current, sizeof(current), 1, index_file);
+    fflush(index_file);
+    segment_open = 0;
+}
+
+int pcap_index_init(const char *capture_filename) {
+    char path[MAX_FILENAME_LEN + sizeof(PCAP_INDEX_SUFFIX)];
+    PcapIndexHeader header;
+    
+    index_path(capture_filename, path, sizeof(path));
+    index_file = fopen(path, "wb");
+    if (index_file == NULL) {
+        perror("fopen");
+        return -1;
+    }
+    
+    memset(&header, 0, sizeof(header));
+    header.magic = PCAP_INDEX_MAGIC;
+    header.version = PCAP_INDEX_VERSION;
+    header.bloom_bytes = PCAP_INDEX_BLOOM_BYTES;
+    fwrite(&header, sizeof(header), 1, index_file);
+    
+    segment_open = 0;
+    return 0;
+}
+
+void pcap_index_cleanup(void) {
+    if (index_file != NULL) {
+        flush_segment();
+        fclose(index_file);
+        index_file = NULL;
+    }
+}
+
+// Called by the pcap writer with the offset the packet's record starts at
+static void add_tuple(unsigned int src_addr, unsigned int dst_addr, unsigned short src_port,
+                      unsigned short dst_port, unsigned int protocol) {
+    current.protocols[(protocol & 0xff) >> 3] |= 1 << (protocol & 7);
+    bloom_add(current.bloom, BLOOM_TAG_ADDR | src_addr);
+    bloom_add(current.bloom, BLOOM_TAG_ADDR | dst_addr);
+    if (protocol == PROTO_TCP || protocol == PROTO_UDP) {
+        bloom_add(current.bloom, BLOOM_TAG_PORT | src_port);
+        bloom_add(current.bloom, BLOOM_TAG_PORT | dst_port);
+    }
+}
+
+void pcap_index_add_packet(Packet *packet, uint64_t offset) {
+    uint64_t time;
+    
+    if (index_file == NULL) {
+        return;
+    }
+    
+    time = (uint64_t)packet->timestamp.tv_sec * 1000000 + packet->timestamp.tv_usec;
+    
+    if (segment_open && (current.packets >= PCAP_INDEX_SEGMENT_PACKETS ||
+                         time >= current.first_time + PCAP_INDEX_SEGMENT_USEC)) {
+        flush_segment();
+    }
+    
+    if (!segment_open) {
+        memset(&current, 0, sizeof(current));
+        current.offset = offset;
+        current.first_time = time;
+        segment_open = 1;
+    }
+    
+    current.packets++;
+    if (time > current.last_time) {
+        current.last_time = time;
+    }
+    // The merge window can deliver slightly older packets
+    if (time < current.first_time) {
+        current.first_time = time;
+    }
+    
+    if (packet->tunnel != TUNNEL_NONE) {
+        // Replay matches any layer, so every one has to be in the summary
+        TunnelLayer layers[TUNNEL_MAX_DEPTH + 1];
+        int count = tunnel_layers(packet->buffer, packet->size, layers, TUNNEL_MAX_DEPTH + 1);
+        for (int i = 0; i < count; i++) {
+            add_tuple(layers[i].src_addr, layers[i].dst_addr, layers[i].src_port,
+                      layers[i].dst_port, layers[i].protocol);
+        }
+    } else if (packet->ip_header != NULL) {
+        add_tuple(packet->src_addr, packet->dst_addr, packet->src_port, packet->dst_port,
+                  packet->protocol);
+    }
+}
+
+int pcap_index_open(const char *capture_filename, PcapIndex *index) {
+    char path[MAX_FILENAME_LEN + sizeof(PCAP_INDEX_SUFFIX)];
+    PcapIndexHeader header;
+    struct stat st;
+    FILE *file;
+    
+    memset(index, 0, sizeof(*index));
+    
+    index_path(capture_filename, path, sizeof(path));
+    file = fopen(path, "rb");
+    if (file == NULL) {
+        return -1;
+    }
+    
+    if (fstat(fileno(file), &st) < 0 ||
+        fread(&header, sizeof(header), 1, file) != 1 ||
+        header.magic != PCAP_INDEX_MAGIC || header.version != PCAP_INDEX_VERSION ||
+        header.bloom_bytes != PCAP_INDEX_BLOOM_BYTES) {
+        fprintf(stderr, "%s: not a usable capture index\n", path);
+        fclose(file);
+        return -1;
+    }
+    
+    // A trailing partial segment (writer still running) is ignored
+    index->count = (st.st_size - sizeof(header)) / sizeof(PcapIndexSegment);
+    if (index->count == 0) {
+        fclose(file);
+        return 0;
+    }
+    index->segments = malloc(index->count * sizeof(PcapIndexSegment));
+    if (index->segments == NULL ||
+        fread(index->segments, sizeof(PcapIndexSegment), index->count, file) != index->count) {
+        fprintf(stderr, "%s: truncated capture index\n", path);
+        pcap_index_close(index);
+        fclose(file);
+        return -1;
+    }
+    
+    fclose(file);
+    return 0;
+}
+
+void pcap_index_close(PcapIndex *index) {
+    free(index->segments);
+    index->segments = NULL;
+    index->count = 0;
+}
+
+int pcap_index_segment_may_match(const PcapIndexSegment *segment, const QueryPredicate *predicate) {
+    if (segment->last_time < predicate->time_from || segment->first_time > predicate->time_to) {
+        return 0;
+    }
+    if (predicate->has_src && !bloom_contains(segment->bloom, BLOOM_TAG_ADDR | predicate->src_addr)) {
+        return 0;
+    }
+    if (predicate->has_dst && !bloom_contains(segment->bloom, BLOOM_TAG_ADDR | predicate->dst_addr)) {
+        return 0;
+    }
+    if (predicate->has_addr && !bloom_contains(segment->bloom, BLOOM_TAG_ADDR | predicate->addr)) {
+        return 0;
+    }
+    if (predicate->has_port && !bloom_contains(segment->bloom, BLOOM_TAG_PORT | predicate->port)) {
+        return 0;
+    }
+    if (predicate->has_protocol &&
+        !(segment->protocols[(predicate->protocol & 0xff) >> 3] & (1 << (predicate->protocol & 7)))) {
+        return 0;
+    }
+    
+    return 1;
+}
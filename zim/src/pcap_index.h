@@ -0,0 +1,54 @@
+#ifndef ZIM_PCAP_INDEX_H
+#define ZIM_PCAP_INDEX_H
+
+#include <stdint.h>
+#include "network.h"
+#include "query.h"
+
+// Sidecar index for pcap captures, written next to the capture as
+// "<capture>.zidx". The capture is cut into segments; each segment
+// records where it starts, the time span it covers and a bloom filter
+// over the addresses and ports it contains, so readers can seek straight
+// to the segments that may hold what they are looking for.
+//
+//   PcapIndexHeader, PcapIndexSegment x N   (appended as segments close)
+#define PCAP_INDEX_SUFFIX ".zidx"
+#define PCAP_INDEX_MAGIC 0x5849505a  // "ZPIX"
+#define PCAP_INDEX_VERSION 1
+#define PCAP_INDEX_SEGMENT_PACKETS 4096   // Close a segment after this many packets
+#define PCAP_INDEX_SEGMENT_USEC 10000000  // ...or after this much capture time
+#define PCAP_INDEX_BLOOM_BYTES 4096
+#define PCAP_INDEX_BLOOM_HASHES 3
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t bloom_bytes;
+    uint32_t reserved;
+} PcapIndexHeader;
+
+typedef struct {
+    uint64_t offset;      // Capture file offset of the first record
+    uint64_t first_time;  // Microseconds since the epoch
+    uint64_t last_time;
+    uint32_t packets;
+    uint32_t reserved;
+    uint8_t protocols[32];                    // Bitmap of IP protocols seen
+    uint8_t bloom[PCAP_INDEX_BLOOM_BYTES];    // Addresses and ports seen
+} PcapIndexSegment;
+
+typedef struct {
+    PcapIndexSegment *segments;
+    uint32_t count;
+} PcapIndex;
+
+// Function prototypes
+int pcap_index_init(const char *capture_filename);
+void pcap_index_cleanup(void);
+void pcap_index_add_packet(Packet *packet, uint64_t offset);
+
+int pcap_index_open(const char *capture_filename, PcapIndex *index);
+void pcap_index_close(PcapIndex *index);
+int pcap_index_segment_may_match(const PcapIndexSegment *segment, const QueryPredicate *predicate);
+
+#endif // ZIM_PCAP_INDEX_H
@@ -0,0 +1,72 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pcap_writer.h"
+#include "pcap_index.h"
+#include "io_writer.h"
+#include "config.h"
+
+static IoWriter *pcap_file = NULL;
+
+int pcap_writer_init(const char *filename) {
+    PcapFileHeader header;
+    
+    pcap_file = io_writer_open(filename, config.direct_io ? IO_WRITER_DIRECT : 0,
+                               config.compression);
+    if (pcap_file == NULL) {
+        return -1;
+    }
+    
+    memset(&header, 0, sizeof(header));
+    header.magic = PCAP_MAGIC;
+    header.version_major = PCAP_VERSION_MAJOR;
+    header.version_minor = PCAP_VERSION_MINOR;
+    header.snaplen = MAX_PACKET_SIZE;
+    header.linktype = PCAP_LINKTYPE_ETHERNET;
+    
+    io_writer_write(pcap_file, &header, sizeof(header));
+    
+    // Sidecar time/address index for fast seeks (see pcap_index.h)
+    if (pcap_index_init(filename) != 0) {
+        io_writer_close(pcap_file);
+        pcap_file = NULL;
+        return -1;
+    }
+    
+    return 0;
+}
+
+void pcap_writer_cleanup(void) {
+    pcap_index_cleanup();
+    
+    if (pcap_file != NULL) {
+        io_writer_close(pcap_file);
+        pcap_file = NULL;
+    }
+}
+
+// Records are written in large batches; this pushes out a partial one
+void pcap_writer_flush(void) {
+    if (pcap_file != NULL) {
+        io_writer_flush(pcap_file);
+    }
+}
+
+// Packets must arrive in timestamp order (see capture_next())
+void pcap_writer_write_packet(Packet *packet) {
+    PcapRecordHeader record;
+    
+    if (pcap_file == NULL) {
+        return;
+    }
+    
+    record.ts_sec = packet->timestamp.tv_sec;
+    record.ts_usec = packet->timestamp.tv_usec;
+    record.caplen = packet->size;
+    record.len = packet->size;
+    
+    pcap_index_add_packet(packet, io_writer_size(pcap_file));
+    
+    io_writer_write(pcap_file, &record, sizeof(record));
+    io_writer_write(pcap_file, packet->buffer, packet->size);
+}
@@ -0,0 +1,35 @@
+#ifndef ZIM_PCAP_WRITER_H
+#define ZIM_PCAP_WRITER_H
+
+#include "network.h"
+
+// Classic libpcap file format
+#define PCAP_MAGIC 0xa1b2c3d4
+#define PCAP_VERSION_MAJOR 2
+#define PCAP_VERSION_MINOR 4
+#define PCAP_LINKTYPE_ETHERNET 1
+
+typedef struct {
+    unsigned int magic;
+    unsigned short version_major;
+    unsigned short version_minor;
+    int thiszone;
+    unsigned int sigfigs;
+    unsigned int snaplen;
+    unsigned int linktype;
+} PcapFileHeader;
+
+typedef struct {
+    unsigned int ts_sec;
+    unsigned int ts_usec;
+    unsigned int caplen;
+    unsigned int len;
+} PcapRecordHeader;
+
+// Function prototypes
+int pcap_writer_init(const char *filename);
+void pcap_writer_cleanup(void);
+void pcap_writer_write_packet(Packet *packet);
+void pcap_writer_flush(void);
+
+#endif // ZIM_PCAP_WRITER_H
@@ -0,0 +1,524 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/time.h>
+#include "pipeline.h"
+#include "pool.h"
+#include "spsc.h"
+#include "placement.h"
+#include "capture.h"
+#include "replay.h"
+#include "filter.h"
+#include "qsbr.h"
+#include "packet_parser.h"
+#include "sampler.h"
+#include "logger.h"
+#include "store.h"
+#include "pcap_writer.h"
+#include "io_writer.h"
+#include "flow.h"
+#include "ipfix.h"
+#include "detect.h"
+#include "tcpstat.h"
+#include "stats_file.h"
+#include "display.h"
+#include "config.h"
+
+#define PIPELINE_IDLE_NSEC 100000       // Sleep when a stage finds no work
+#define PIPELINE_PUBLISH_NSEC 100000000L  // Display snapshot refresh
+
+static pthread_t parse_thread;
+static pthread_t output_thread;
+static int threads_running = 0;
+static atomic_int parse_stopping = 0;
+static atomic_int output_stopping = 0;
+static atomic_int draining = 0;
+static atomic_int finished = 0;
+
+static SpscQueue output_queue;
+static SpscQueue display_queue;
+static PacketPool *replay_pool = NULL;
+static pthread_mutex_t writers_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static atomic_ulong in_flight = 0;  // Past parse and not yet released
+static atomic_ulong packets = 0;    // Admitted by the filter
+static atomic_ulong output_stalls = 0;
+static atomic_ulong display_skipped = 0;
+
+static const struct timespec idle_time = {0, PIPELINE_IDLE_NSEC};
+
+// Close idle and long-running flows. Replays run on capture time.
+void pipeline_expire_flows(int force) {
+    uint64_t now;
+    
+    if (config.flow_collector[0] == '\0') {
+        return;
+    }
+    
+    if (config.replay_file[0] != '\0') {
+        now = flow_last_packet_ms();
+    } else {
+        struct timeval tv;
+        gettimeofday(&tv, NULL);
+        now = (uint64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+    }
+    
+    flow_expire(now, force);
+    ipfix_flush(force);
+}
+
+// Packets admitted by an older kernel filter (or none, when replaying)
+// are checked against the current program in user space
+static int filter_admits(const Packet *packet) {
+    const FilterProgram *program = filter_current();
+    
+    if (packet->filter_generation == program->generation) {
+        return 1;
+    }
+    return filter_run(program, packet->buffer, packet->size) > 0;
+}
+
+// Move per-interface drop and receive error counts into the statistics
+// and return the total drops
+static unsigned long collect_drops(void) {
+    unsigned long total = 0;
+    
+    for (int i = 0; i < config.interface_count; i++) {
+        unsigned long drops = capture_take_drops(i);
+        stats->interfaces[i].dropped += drops;
+        stats->interfaces[i].errors += capture_take_errors(i);
+        total += drops;
+    }
+    
+    stats->dropped_packets += total;
+    return total;
+}
+
+// Fill level of the fullest lossless queue, 0.0 to 1.0
+static double occupancy(void) {
+    double capture = capture_occupancy();
+    double output = (double)spsc_depth(&output_queue) / spsc_capacity(&output_queue);
+    
+    return capture > output ? capture : output;
+}
+
+// Next packet in timestamp order, from the live capture or a replay.
+// Sets *done once the input is exhausted.
+static Packet *next_packet(int *done) {
+    if (config.replay_file[0] == '\0') {
+        // Drains start with the capture threads already stopped, so once
+        // the flag is seen everything they queued is visible
+        int drain = atomic_load(&draining);
+        Packet *packet = capture_next();
+        
+        if (packet == NULL && drain) {
+            *done = 1;
+        }
+        return packet;
+    }
+    
+    if (atomic_load(&draining)) {
+        *done = 1;
+        return NULL;
+    }
+    
+    // NULL without done while every descriptor is downstream
+    Packet *packet = pool_get(replay_pool);
+    if (packet != NULL && !replay_next(packet)) {
+        pool_put(replay_pool, packet);
+        packet = NULL;
+        *done = 1;
+    }
+    return packet;
+}
+
+// Statistics, TCP analytics, flow accounting and detection see every
+// admitted packet
+static void parse_stage(Packet *packet) {
+    struct timespec start, end;
+    
+    // Decide which expensive stages this packet may skip
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    sampler_classify(packet);
+    
+    parse_packet(packet);
+    update_statistics(packet);
+    tcpstat_packet(packet);
+    flow_update(packet);
+    detect_packet(packet);
+    
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    sampler_record_cost((end.tv_sec - start.tv_sec) * 1000000000UL +
+                        end.tv_nsec - start.tv_nsec);
+}
+
+// Queue a batch for the output stage, waiting while it is full
+static void hand_off(void **batch, unsigned int count) {
+    unsigned int sent = 0;
+    
+    atomic_fetch_add(&in_flight, count);
+    for (;;) {
+        sent += spsc_push(&output_queue, batch + sent, count - sent);
+        if (sent == count) {
+            break;
+        }
+        
+        // Shutting down: the rest is not worth waiting for
+        if (atomic_load(&parse_stopping)) {
+            for (unsigned int i = sent; i < count; i++) {
+                pool_release(batch[i], POOL_RELEASER_PARSE);
+            }
+            atomic_fetch_sub(&in_flight, count - sent);
+            break;
+        }
+        
+        atomic_fetch_add(&output_stalls, 1);
+        pool_flush(POOL_RELEASER_PARSE);
+        nanosleep(&idle_time, NULL);
+    }
+}
+
+static long elapsed_nsec(const struct timespec *from, const struct timespec *to) {
+    return (to->tv_sec - from->tv_sec) * 1000000000L + (to->tv_nsec - from->tv_nsec);
+}
+
+static void *parse_main(void *arg) {
+    void *batch[PIPELINE_BATCH];
+    unsigned int count = 0;
+    struct timespec now, last_publish = {0, 0}, last_expire = {0, 0};
+    int done = 0;
+    int reader = qsbr_register();
+    
+    (void)arg;
+    
+    while (!atomic_load(&parse_stopping)) {
+        Packet *packet;
+        int processed = 0;
+        
+        while (!done && processed < PIPELINE_PARSE_PASS && (packet = next_packet(&done)) != NULL) {
+            processed++;
+            if (!filter_admits(packet)) {
+                pool_release(packet, POOL_RELEASER_PARSE);
+                continue;
+            }
+            
+            parse_stage(packet);
+            batch[count++] = packet;
+            if (count == PIPELINE_BATCH) {
+                hand_off(batch, count);
+                count = 0;
+            }
+            
+            // Check if we've reached the capture limit
+            unsigned long total = atomic_fetch_add(&packets, 1) + 1;
+            if (config.packet_count > 0 && total >= config.packet_count) {
+                done = 1;
+            }
+        }
+        
+        // Never hold packets back while the input is quiet
+        if (count > 0) {
+            hand_off(batch, count);
+            count = 0;
+        }
+        pool_flush(POOL_RELEASER_PARSE);
+        
+        // No filter program is referenced past this point
+        qsbr_quiescent(reader);
+        
+        // Account drops and let the sampler react to them
+        unsigned long drops = collect_drops();
+        sampler_update(drops, occupancy());
+        
+        // Refresh the display snapshot and the statistics file; publish
+        // once more when the input ends so the final numbers are complete
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (elapsed_nsec(&last_publish, &now) >= PIPELINE_PUBLISH_NSEC ||
+            (done && !atomic_load(&finished))) {
+            stats_refresh_sources();
+            display_publish();
+            last_publish = now;
+        }
+        stats_file_publish();
+        
+        // Walk the flow table once a second
+        if (now.tv_sec != last_expire.tv_sec) {
+            pipeline_expire_flows(0);
+            last_expire = now;
+        }
+        
+        if (done) {
+            atomic_store(&finished, 1);
+        }
+        
+        // Sleep briefly when idle to avoid using 100% CPU
+        if (processed == 0) {
+            nanosleep(&idle_time, NULL);
+        }
+    }
+    
+    qsbr_unregister(reader);
+    return NULL;
+}
+
+// Capture files, CSV log and record store
+static void output_stage(Packet *packet) {
+    if (!(packet->shed & SHED_STAGE_LOG)) {
+        if (config.log_file[0] != '\0') {
+            logger_log_packet(packet);
+        }
+        if (config.store_file[0] != '\0') {
+            store_writer_write_packet(packet);
+        }
+    }
+    
+    // Write the raw frame if a capture file was requested
+    if (config.pcap_file[0] != '\0') {
+        pcap_writer_write_packet(packet);
+    }
+}
+
+// Push out partly filled write buffers every IO_WRITER_FLUSH_MSEC, so a
+// slow trickle of packets still reaches the files
+static void flush_writers(struct timespec *last_flush) {
+    struct timespec now;
+    
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (elapsed_nsec(last_flush, &now) < IO_WRITER_FLUSH_MSEC * 1000000L) {
+        return;
+    }
+    
+    pthread_mutex_lock(&writers_lock);
+    logger_flush();
+    pcap_writer_flush();
+    store_writer_flush();
+    pthread_mutex_unlock(&writers_lock);
+    *last_flush = now;
+}
+
+static void *output_main(void *arg) {
+    void *batch[PIPELINE_BATCH];
+    void *shown[PIPELINE_BATCH];
+    int replaying = config.replay_file[0] != '\0';
+    struct timespec last_flush;
+    
+    (void)arg;
+    clock_gettime(CLOCK_MONOTONIC, &last_flush);
+    
+    for (;;) {
+        // Read the flag first: once parse has stopped, an empty queue
+        // stays empty
+        int stopping = atomic_load(&output_stopping);
+        unsigned int count = spsc_pop(&output_queue, batch, PIPELINE_BATCH);
+        
+        if (count == 0) {
+            pool_flush(POOL_RELEASER_OUTPUT);
+            if (stopping) {
+                break;
+            }
+            
+            flush_writers(&last_flush);
+            nanosleep(&idle_time, NULL);
+            continue;
+        }
+        
+        // Writers can be started and stopped from the control socket
+        pthread_mutex_lock(&writers_lock);
+        for (unsigned int i = 0; i < count; i++) {
+            output_stage(batch[i]);
+        }
+        pthread_mutex_unlock(&writers_lock);
+        flush_writers(&last_flush);
+        
+        // Pass the packets on to the display, or release them here
+        unsigned int wanted = 0;
+        for (unsigned int i = 0; i < count; i++) {
+            Packet *packet = batch[i];
+            
+            if (!config.daemon && !(packet->shed & SHED_STAGE_DISPLAY)) {
+                shown[wanted++] = packet;
+            } else {
+                pool_release(packet, POOL_RELEASER_OUTPUT);
+                atomic_fetch_sub(&in_flight, 1);
+            }
+        }
+        
+        // A replay has no packets to lose, so it waits for the display
+        unsigned int queued = spsc_push(&display_queue, shown, wanted);
+        while (replaying && queued < wanted && !atomic_load(&parse_stopping)) {
+            nanosleep(&idle_time, NULL);
+            queued += spsc_push(&display_queue, shown + queued, wanted - queued);
+        }
+        for (unsigned int i = queued; i < wanted; i++) {
+            pool_release(shown[i], POOL_RELEASER_OUTPUT);
+            atomic_fetch_sub(&in_flight, 1);
+        }
+        if (queued < wanted) {
+            atomic_fetch_add(&display_skipped, wanted - queued);
+        }
+    }
+    
+    return NULL;
+}
+
+// Start the parse and output threads. Capture (if live) must already run.
+int pipeline_start(void) {
+    if (spsc_init(&output_queue, PIPELINE_OUTPUT_QUEUE, placement_home_node()) != 0 ||
+        spsc_init(&display_queue, PIPELINE_DISPLAY_QUEUE, placement_home_node()) != 0) {
+        spsc_free(&output_queue);
+        return -1;
+    }
+    
+    if (config.replay_file[0] != '\0') {
+        replay_pool = pool_create(PIPELINE_REPLAY_POOL, PLACEMENT_ANY);
+        if (replay_pool == NULL) {
+            spsc_free(&output_queue);
+            spsc_free(&display_queue);
+            return -1;
+        }
+    }
+    
+    atomic_store(&parse_stopping, 0);
+    atomic_store(&output_stopping, 0);
+    
+    // CPUs from -A go to the parse thread first, then the output thread
+    pthread_attr_t parse_attr, output_attr;
+    placement_thread_attr(&parse_attr, "parse");
+    placement_thread_attr(&output_attr, "output");
+    
+    if (pthread_create(&output_thread, &output_attr, output_main, NULL) != 0) {
+        fprintf(stderr, "Error: Failed to start output thread\n");
+        pthread_attr_destroy(&parse_attr);
+        pthread_attr_destroy(&output_attr);
+        pool_destroy(replay_pool);
+        replay_pool = NULL;
+        spsc_free(&output_queue);
+        spsc_free(&display_queue);
+        return -1;
+    }
+    if (pthread_create(&parse_thread, &parse_attr, parse_main, NULL) != 0) {
+        fprintf(stderr, "Error: Failed to start parse thread\n");
+        pthread_attr_destroy(&parse_attr);
+        pthread_attr_destroy(&output_attr);
+        atomic_store(&output_stopping, 1);
+        pthread_join(output_thread, NULL);
+        pool_destroy(replay_pool);
+        replay_pool = NULL;
+        spsc_free(&output_queue);
+        spsc_free(&display_queue);
+        return -1;
+    }
+    pthread_attr_destroy(&parse_attr);
+    pthread_attr_destroy(&output_attr);
+    
+    threads_running = 1;
+    return 0;
+}
+
+// Stop upstream first so every packet already parsed is still written
+void pipeline_stop(void) {
+    void *batch[PIPELINE_BATCH];
+    unsigned int count;
+    
+    if (!threads_running) {
+        return;
+    }
+    
+    atomic_store(&parse_stopping, 1);
+    pthread_join(parse_thread, NULL);
+    atomic_store(&output_stopping, 1);
+    pthread_join(output_thread, NULL);
+    threads_running = 0;
+    
+    // Packets the display never got to
+    while ((count = spsc_pop(&display_queue, batch, PIPELINE_BATCH)) > 0) {
+        for (unsigned int i = 0; i < count; i++) {
+            pool_release(batch[i], POOL_RELEASER_DISPLAY);
+        }
+        atomic_fetch_sub(&in_flight, count);
+    }
+    
+    spsc_free(&output_queue);
+    spsc_free(&display_queue);
+    pool_destroy(replay_pool);
+    replay_pool = NULL;
+}
+
+// Finish what has been captured, then report finished. Live capture
+// must be quiesced first.
+void pipeline_drain(void) {
+    atomic_store(&draining, 1);
+}
+
+// The input ended (replay done, packet limit reached or drained) and
+// every packet made it through the output and display stages
+int pipeline_finished(void) {
+    return atomic_load(&finished) && atomic_load(&in_flight) == 0;
+}
+
+// Display stage, run by the main thread. Returns the packets shown.
+int pipeline_display(int max) {
+    void *batch[PIPELINE_BATCH];
+    int shown = 0;
+    
+    while (shown < max) {
+        unsigned int want = max - shown < PIPELINE_BATCH ? max - shown : PIPELINE_BATCH;
+        unsigned int count = spsc_pop(&display_queue, batch, want);
+        
+        if (count == 0) {
+            break;
+        }
+        for (unsigned int i = 0; i < count; i++) {
+            display_packet(batch[i]);
+            pool_release(batch[i], POOL_RELEASER_DISPLAY);
+        }
+        atomic_fetch_sub(&in_flight, count);
+        shown += count;
+    }
+    
+    pool_flush(POOL_RELEASER_DISPLAY);
+    return shown;
+}
+
+unsigned long pipeline_packets(void) {
+    return atomic_load(&packets);
+}
+
+void pipeline_stats(PipelineStats *out) {
+    memset(out, 0, sizeof(*out));
+    
+    if (config.replay_file[0] == '\0') {
+        out->capture_depth = capture_queue_depth();
+        out->capture_capacity = CAPTURE_POOL_SIZE;
+        out->capture_overruns = capture_overruns();
+        out->reorder_waited = capture_reorder_waited();
+        out->reorder_forced = capture_reorder_forced();
+    }
+    out->output_depth = spsc_depth(&output_queue);
+    out->output_capacity = spsc_capacity(&output_queue);
+    out->output_stalls = atomic_load(&output_stalls);
+    if (!config.daemon) {
+        out->display_depth = spsc_depth(&display_queue);
+        out->display_capacity = spsc_capacity(&display_queue);
+        out->display_skipped = atomic_load(&display_skipped);
+    }
+    out->descriptors_used = pool_in_use();
+    out->descriptors = pool_capacity();
+    out->write_backend = io_writer_backend();
+    out->write_direct = io_writer_direct();
+    out->write_bytes = io_writer_bytes_written();
+    out->write_rate = io_writer_bandwidth();
+    out->write_codec = io_writer_codec();
+    out->write_ratio = io_writer_ratio();
+}
+
+void pipeline_lock_writers(void) {
+    pthread_mutex_lock(&writers_lock);
+}
+
+void pipeline_unlock_writers(void) {
+    pthread_mutex_unlock(&writers_lock);
+}
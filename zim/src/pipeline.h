@@ -0,0 +1,56 @@
+#ifndef ZIM_PIPELINE_H
+#define ZIM_PIPELINE_H
+
+// Packet processing stages, each on its own thread and linked by
+// single-producer/single-consumer queues of packet descriptors:
+//
+//   capture (one per interface) -> parse -> output -> display (main thread)
+//
+// Parse merges the interfaces in timestamp order, filters, parses and
+// feeds the statistics, flow table and detection. Output runs the file
+// writers. On live capture the display is best effort: when it falls
+// behind, packets skip it instead of holding up the writers. Every other
+// full queue makes its producer wait, until capture runs out of
+// descriptors and drops.
+#define PIPELINE_BATCH 32           // Packets moved between stages at a time
+#define PIPELINE_PARSE_PASS 256     // Packets parsed between housekeeping checks
+#define PIPELINE_OUTPUT_QUEUE 512
+#define PIPELINE_DISPLAY_QUEUE 256
+#define PIPELINE_REPLAY_POOL 128    // Descriptors for packets read by -r
+
+// Queue depths and backpressure per stage
+typedef struct {
+    unsigned long capture_depth;     // Deepest interface queue
+    unsigned long capture_capacity;
+    unsigned long capture_overruns;  // Dropped for want of a free descriptor
+    unsigned long reorder_waited;    // Held for the whole reorder window
+    unsigned long reorder_forced;    // Released early to free descriptors
+    unsigned long output_depth;
+    unsigned long output_capacity;
+    unsigned long output_stalls;     // Times parse waited for room
+    unsigned long display_depth;
+    unsigned long display_capacity;  // 0 when nothing is displayed
+    unsigned long display_skipped;   // Not shown because the display fell behind
+    unsigned long descriptors_used;
+    unsigned long descriptors;
+    int write_backend;               // IO_WRITER_NONE until a log or capture opens
+    int write_direct;
+    unsigned long write_bytes;
+    double write_rate;               // Bytes per second
+    int write_codec;                 // COMPRESS_NONE unless -z
+    double write_ratio;              // Uncompressed to compressed
+} PipelineStats;
+
+// Function prototypes
+int pipeline_start(void);
+void pipeline_stop(void);
+void pipeline_drain(void);
+int pipeline_finished(void);
+int pipeline_display(int max);
+unsigned long pipeline_packets(void);
+void pipeline_stats(PipelineStats *out);
+void pipeline_lock_writers(void);
+void pipeline_unlock_writers(void);
+void pipeline_expire_flows(int force);
+
+#endif // ZIM_PIPELINE_H
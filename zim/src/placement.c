@@ -0,0 +1,441 @@
+#define _GNU_SOURCE  // CPU sets, pthread_attr_setaffinity_np
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <dirent.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include "placement.h"
+#include "utils.h"
+
+typedef struct {
+    char name[MAX_INTERFACE_LEN + 8];
+    int cpu;
+} PlacedThread;
+
+// CPUs for the threads, in start order
+static int cpu_list[PLACEMENT_MAX_CPUS];
+static int cpu_count = 0;
+static int next_cpu = 0;
+static int share_cpus = 0;  // Wrap around when threads outnumber CPUs (auto)
+
+static int use_numa = 0;
+static int use_hugepages = 0;
+static char interfaces[MAX_INTERFACES][MAX_INTERFACE_LEN];
+static int interface_nodes[MAX_INTERFACES];
+static int interface_count = 0;
+
+// What was placed, for the report. Threads are started and buffers
+// allocated from the main thread only.
+static PlacedThread threads[PLACEMENT_MAX_THREADS];
+static int thread_count = 0;
+static size_t hugetlb_bytes = 0;  // Reserved hugepages
+static size_t thp_bytes = 0;      // Transparent hugepages requested
+static size_t small_bytes = 0;
+static size_t bound_bytes = 0;    // Bound to a NUMA node
+static int bind_error = 0;        // First mbind() failure
+
+static int read_line(const char *path, char *buffer, size_t size) {
+    FILE *file = fopen(path, "r");
+    
+    if (file == NULL) {
+        return -1;
+    }
+    if (fgets(buffer, size, file) == NULL) {
+        fclose(file);
+        return -1;
+    }
+    fclose(file);
+    
+    buffer[strcspn(buffer, "\n")] = '\0';
+    return 0;
+}
+
+// "0-3,8" into CPU numbers, in order. Returns the count, -1 if malformed.
+static int parse_cpu_list(const char *list, int *cpus, int max) {
+    const char *p = list;
+    int count = 0;
+    
+    while (*p != '\0') {
+        char *end;
+        long first = strtol(p, &end, 10), last;
+        
+        if (end == p || first < 0 || first >= PLACEMENT_MAX_CPUS) {
+            return -1;
+        }
+        last = first;
+        p = end;
+        if (*p == '-') {
+            last = strtol(p + 1, &end, 10);
+            if (end == p + 1 || last < first || last >= PLACEMENT_MAX_CPUS) {
+                return -1;
+            }
+            p = end;
+        }
+        
+        for (long cpu = first; cpu <= last && count < max; cpu++) {
+            cpus[count++] = cpu;
+        }
+        
+        if (*p == ',') {
+            p++;
+        } else if (*p != '\0') {
+            return -1;
+        }
+    }
+    
+    return count;
+}
+
+// The reverse, for the report
+static void format_cpu_set(const cpu_set_t *set, char *buffer, size_t size) {
+    size_t used = 0;
+    
+    buffer[0] = '\0';
+    for (int cpu = 0; cpu < PLACEMENT_MAX_CPUS && used < size; cpu++) {
+        if (!CPU_ISSET(cpu, set)) {
+            continue;
+        }
+        
+        int last = cpu;
+        while (last + 1 < PLACEMENT_MAX_CPUS && CPU_ISSET(last + 1, set)) {
+            last++;
+        }
+        used += snprintf(buffer + used, size - used, last > cpu ? "%s%d-%d" : "%s%d",
+                         used > 0 ? "," : "", cpu, last);
+        cpu = last;
+    }
+}
+
+// NUMA node of a network device, PLACEMENT_ANY for virtual devices and
+// machines without NUMA
+int placement_interface_node(const char *interface) {
+    char path[128], line[32];
+    
+    snprintf(path, sizeof(path), "/sys/class/net/%s/device/numa_node", interface);
+    if (read_line(path, line, sizeof(line)) != 0) {
+        return PLACEMENT_ANY;
+    }
+    
+    int node = atoi(line);
+    return node >= 0 && node < PLACEMENT_MAX_NODES ? node : PLACEMENT_ANY;
+}
+
+static int cpu_node(int cpu) {
+    char path[96];
+    
+    for (int node = 0; node < PLACEMENT_MAX_NODES; node++) {
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpu%d", node, cpu);
+        if (access(path, F_OK) == 0) {
+            return node;
+        }
+    }
+    return PLACEMENT_ANY;
+}
+
+// CPUs the device's MSI interrupts are delivered to. Returns the number
+// of interrupts found.
+static int interface_irq_cpus(const char *interface, cpu_set_t *set) {
+    char path[128], line[256];
+    int cpus[PLACEMENT_MAX_CPUS];
+    int irqs = 0;
+    
+    CPU_ZERO(set);
+    snprintf(path, sizeof(path), "/sys/class/net/%s/device/msi_irqs", interface);
+    DIR *dir = opendir(path);
+    if (dir == NULL) {
+        return 0;
+    }
+    
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+        
+        // Where the interrupt really goes, when the kernel says
+        snprintf(path, sizeof(path), "/proc/irq/%.16s/effective_affinity_list", entry->d_name);
+        if (read_line(path, line, sizeof(line)) != 0 || line[0] == '\0') {
+            snprintf(path, sizeof(path), "/proc/irq/%.16s/smp_affinity_list", entry->d_name);
+            if (read_line(path, line, sizeof(line)) != 0) {
+                continue;
+            }
+        }
+        
+        int count = parse_cpu_list(line, cpus, PLACEMENT_MAX_CPUS);
+        for (int i = 0; i < count; i++) {
+            CPU_SET(cpus[i], set);
+        }
+        irqs++;
+    }
+    
+    closedir(dir);
+    return irqs;
+}
+
+static int first_interface_node(void) {
+    for (int i = 0; i < interface_count; i++) {
+        if (interface_nodes[i] != PLACEMENT_ANY) {
+            return interface_nodes[i];
+        }
+    }
+    return PLACEMENT_ANY;
+}
+
+// -A auto: the CPUs of the first interface's node, leaving out those its
+// interrupts are delivered to while enough others remain
+static int auto_cpus(const cpu_set_t *allowed) {
+    int candidates[PLACEMENT_MAX_CPUS];
+    int node = first_interface_node();
+    int total = 0, kept = 0;
+    cpu_set_t interrupts, set;
+    char path[96], line[256];
+    
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+    if (node != PLACEMENT_ANY && read_line(path, line, sizeof(line)) == 0) {
+        total = parse_cpu_list(line, candidates, PLACEMENT_MAX_CPUS);
+    }
+    if (total <= 0) {
+        total = 0;
+        for (int cpu = 0; cpu < PLACEMENT_MAX_CPUS; cpu++) {
+            if (CPU_ISSET(cpu, allowed)) {
+                candidates[total++] = cpu;
+            }
+        }
+    }
+    
+    CPU_ZERO(&interrupts);
+    for (int i = 0; i < interface_count; i++) {
+        interface_irq_cpus(interfaces[i], &set);
+        CPU_OR(&interrupts, &interrupts, &set);
+    }
+    
+    for (int i = 0; i < total; i++) {
+        if (CPU_ISSET(candidates[i], allowed) && !CPU_ISSET(candidates[i], &interrupts)) {
+            cpu_list[kept++] = candidates[i];
+        }
+    }
+    if (kept < interface_count + 2) {
+        kept = 0;
+        for (int i = 0; i < total; i++) {
+            if (CPU_ISSET(candidates[i], allowed)) {
+                cpu_list[kept++] = candidates[i];
+            }
+        }
+    }
+    
+    return kept;
+}
+
+// cpus is an -A list, "auto" or empty. Interfaces are those about to be
+// captured on; none when replaying.
+int placement_init(const char *cpus, int numa, int hugepages,
+                   char names[][MAX_INTERFACE_LEN], int count) {
+    cpu_set_t allowed;
+    
+    use_numa = numa;
+    use_hugepages = hugepages;
+    interface_count = count;
+    for (int i = 0; i < count; i++) {
+        strncpy(interfaces[i], names[i], MAX_INTERFACE_LEN - 1);
+        interfaces[i][MAX_INTERFACE_LEN - 1] = '\0';
+        interface_nodes[i] = placement_interface_node(names[i]);
+    }
+    
+    if (cpus[0] == '\0') {
+        return 0;
+    }
+    
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        perror("sched_getaffinity");
+        return -1;
+    }
+    
+    if (strcmp(cpus, "auto") == 0) {
+        cpu_count = auto_cpus(&allowed);
+        share_cpus = 1;
+    } else {
+        cpu_count = parse_cpu_list(cpus, cpu_list, PLACEMENT_MAX_CPUS);
+        if (cpu_count < 0) {
+            fprintf(stderr, "Invalid CPU list: %s\n", cpus);
+            return -1;
+        }
+        for (int i = 0; i < cpu_count; i++) {
+            if (!CPU_ISSET(cpu_list[i], &allowed)) {
+                fprintf(stderr, "CPU %d is not available to Zim\n", cpu_list[i]);
+                return -1;
+            }
+        }
+    }
+    
+    if (cpu_count <= 0) {
+        fprintf(stderr, "No CPUs to pin threads to: %s\n", cpus);
+        return -1;
+    }
+    return 0;
+}
+
+// Node for the buffers of interface index (capture order), PLACEMENT_ANY
+// without -N
+int placement_node(int index) {
+    return use_numa && index >= 0 && index < interface_count ? interface_nodes[index]
+                                                             : PLACEMENT_ANY;
+}
+
+// Node for buffers shared by all interfaces: the first one's
+int placement_home_node(void) {
+    return use_numa ? first_interface_node() : PLACEMENT_ANY;
+}
+
+// Attributes for the next thread to start, pinned to the next CPU of the
+// list if one is left. With -A auto threads share the node's CPUs rather
+// than leave it. The caller destroys them after pthread_create().
+void placement_thread_attr(pthread_attr_t *attr, const char *name) {
+    int cpu = PLACEMENT_ANY;
+    
+    if (cpu_count > 0 && (next_cpu < cpu_count || share_cpus)) {
+        cpu = cpu_list[next_cpu++ % cpu_count];
+    }
+    
+    pthread_attr_init(attr);
+    if (cpu != PLACEMENT_ANY) {
+        cpu_set_t set;
+        
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        pthread_attr_setaffinity_np(attr, sizeof(set), &set);
+    }
+    
+    if (thread_count < PLACEMENT_MAX_THREADS) {
+        PlacedThread *thread = &threads[thread_count++];
+        
+        strncpy(thread->name, name, sizeof(thread->name) - 1);
+        thread->name[sizeof(thread->name) - 1] = '\0';
+        thread->cpu = cpu;
+    }
+}
+
+// Zeroed memory for packet buffers or queues, bound to node unless it is
+// PLACEMENT_ANY. huge asks for hugepages when -G is on. size is rounded
+// up to whole pages and must be passed back to placement_free().
+void *placement_alloc(size_t *size, int node, int huge) {
+    size_t page = sysconf(_SC_PAGESIZE);
+    void *memory = MAP_FAILED;
+    
+    if (huge && use_hugepages) {
+        size_t rounded = (*size + PLACEMENT_HUGEPAGE_SIZE - 1) & ~(PLACEMENT_HUGEPAGE_SIZE - 1);
+        
+        memory = mmap(NULL, rounded, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (memory != MAP_FAILED) {
+            *size = rounded;
+            hugetlb_bytes += rounded;
+        }
+    }
+    
+    // No reserved hugepages (or none wanted): ordinary pages, which the
+    // kernel may still merge into transparent hugepages
+    if (memory == MAP_FAILED) {
+        *size = (*size + page - 1) & ~(page - 1);
+        memory = mmap(NULL, *size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (memory == MAP_FAILED) {
+            perror("mmap");
+            return NULL;
+        }
+        if (huge && use_hugepages && madvise(memory, *size, MADV_HUGEPAGE) == 0) {
+            thp_bytes += *size;
+        } else {
+            small_bytes += *size;
+        }
+    }
+    
+    // Nothing is touched yet, so every page is allocated on the node
+    if (node != PLACEMENT_ANY) {
+        unsigned long mask = 1UL << node;
+        
+        if (syscall(__NR_mbind, memory, *size, MPOL_BIND, &mask, sizeof(mask) * 8 + 1, 0) == 0) {
+            bound_bytes += *size;
+        } else if (bind_error == 0) {
+            bind_error = errno;
+        }
+    }
+    
+    return memory;
+}
+
+void placement_free(void *memory, size_t size) {
+    if (memory != NULL) {
+        munmap(memory, size);
+    }
+}
+
+static void format_node(int node, char *buffer, size_t size) {
+    if (node == PLACEMENT_ANY) {
+        snprintf(buffer, size, "unknown");
+    } else {
+        snprintf(buffer, size, "%d", node);
+    }
+}
+
+// Where the interfaces, threads and buffers ended up. Printed only when
+// a placement option was given; call once every thread has started.
+void placement_report(int busy_poll_usec) {
+    char node[16], cpus[256], bytes[32];
+    
+    if (cpu_count == 0 && !use_numa && !use_hugepages && busy_poll_usec == 0) {
+        return;
+    }
+    
+    printf("Placement:\n");
+    for (int i = 0; i < interface_count; i++) {
+        cpu_set_t interrupts;
+        int irqs = interface_irq_cpus(interfaces[i], &interrupts);
+        
+        format_node(interface_nodes[i], node, sizeof(node));
+        format_cpu_set(&interrupts, cpus, sizeof(cpus));
+        printf("  %-16s NUMA node %s", interfaces[i], node);
+        if (irqs > 0) {
+            printf(", %d IRQs on CPUs %s", irqs, cpus);
+        }
+        if (busy_poll_usec > 0) {
+            printf(", busy poll %d us", busy_poll_usec);
+        }
+        printf("\n");
+    }
+    
+    for (int i = 0; i < thread_count; i++) {
+        if (threads[i].cpu == PLACEMENT_ANY) {
+            printf("  %-16s any CPU\n", threads[i].name);
+        } else {
+            format_node(cpu_node(threads[i].cpu), node, sizeof(node));
+            printf("  %-16s CPU %d, NUMA node %s\n", threads[i].name, threads[i].cpu, node);
+        }
+    }
+    
+    if (hugetlb_bytes > 0) {
+        format_bytes(hugetlb_bytes, bytes, sizeof(bytes));
+        printf("  Buffers          %s on reserved hugepages\n", bytes);
+    }
+    if (thp_bytes > 0) {
+        format_bytes(thp_bytes, bytes, sizeof(bytes));
+        printf("  Buffers          %s on transparent hugepages (none reserved)\n", bytes);
+    }
+    if (small_bytes > 0) {
+        format_bytes(small_bytes, bytes, sizeof(bytes));
+        printf("  Buffers          %s on %ld KB pages\n", bytes, sysconf(_SC_PAGESIZE) / 1024);
+    }
+    if (use_numa) {
+        format_bytes(bound_bytes, bytes, sizeof(bytes));
+        printf("  NUMA binding     %s bound to interface nodes", bytes);
+        if (bind_error != 0) {
+            printf(" (mbind: %s)", strerror(bind_error));
+        } else if (first_interface_node() == PLACEMENT_ANY) {
+            printf(" (no interface reports a node)");
+        }
+        printf("\n");
+    }
+}
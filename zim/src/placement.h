@@ -0,0 +1,32 @@
+#ifndef ZIM_PLACEMENT_H
+#define ZIM_PLACEMENT_H
+
+#include <stddef.h>
+#include <pthread.h>
+#include "config.h"
+
+// Thread and memory placement for dedicated sensors. Threads take CPUs
+// from the -A list in the order they are started: one capture thread per
+// interface, then the parse and output threads; threads beyond the list
+// are left to the scheduler. With -N packet buffers and queues are bound
+// to the NUMA node of the interface they serve (mbind, no libnuma), and
+// with -G the descriptor pools are backed by hugepages: reserved 2 MB
+// pages when the system has them, transparent hugepages otherwise.
+#define PLACEMENT_MAX_CPUS 1024
+#define PLACEMENT_MAX_NODES 64
+#define PLACEMENT_MAX_THREADS (MAX_INTERFACES + 2)
+#define PLACEMENT_HUGEPAGE_SIZE (2UL << 20)
+#define PLACEMENT_ANY -1  // No CPU or node preference
+
+// Function prototypes
+int placement_init(const char *cpus, int numa, int hugepages,
+                   char names[][MAX_INTERFACE_LEN], int count);
+int placement_interface_node(const char *interface);
+int placement_node(int index);
+int placement_home_node(void);
+void placement_thread_attr(pthread_attr_t *attr, const char *name);
+void *placement_alloc(size_t *size, int node, int huge);
+void placement_free(void *memory, size_t size);
+void placement_report(int busy_poll_usec);
+
+#endif // ZIM_PLACEMENT_H
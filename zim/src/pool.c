@@ -0,0 +1,168 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "pool.h"
+#include "placement.h"
+
+// Every pool is registered so a releasing stage can flush its batches
+// without knowing where the descriptors came from
+#define POOL_MAX (MAX_INTERFACES + 1)
+
+static PacketPool *pools[POOL_MAX];
+static pthread_mutex_t pools_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// The descriptors are only reserved here; the owner thread touches them
+// first, so their pages end up on the owner's NUMA node unless node
+// names one (see placement.h). They may be backed by hugepages.
+PacketPool *pool_create(unsigned int size, int node) {
+    PacketPool *pool = calloc(1, sizeof(PacketPool));
+    int slot = -1;
+    
+    if (pool == NULL) {
+        perror("calloc");
+        return NULL;
+    }
+    
+    pool->size = size;
+    pool->packets_size = (size_t)size * sizeof(Packet);
+    pool->packets = placement_alloc(&pool->packets_size, node, 1);
+    if (pool->packets == NULL) {
+        pool_destroy(pool);
+        return NULL;
+    }
+    
+    pool->free = malloc(size * sizeof(void *));
+    if (pool->free == NULL) {
+        perror("malloc");
+        pool_destroy(pool);
+        return NULL;
+    }
+    
+    for (int i = 0; i < POOL_RELEASERS; i++) {
+        if (spsc_init(&pool->returned[i], size, node) != 0) {
+            pool_destroy(pool);
+            return NULL;
+        }
+    }
+    
+    for (unsigned int i = 0; i < size; i++) {
+        pool->free[i] = &pool->packets[size - 1 - i];
+    }
+    pool->free_count = size;
+    
+    pthread_mutex_lock(&pools_lock);
+    for (int i = 0; i < POOL_MAX && slot < 0; i++) {
+        if (pools[i] == NULL) {
+            pools[i] = pool;
+            slot = i;
+        }
+    }
+    pthread_mutex_unlock(&pools_lock);
+    
+    if (slot < 0) {
+        fprintf(stderr, "Too many packet pools (max %d)\n", POOL_MAX);
+        pool_destroy(pool);
+        return NULL;
+    }
+    
+    return pool;
+}
+
+// Only once no stage holds descriptors any more
+void pool_destroy(PacketPool *pool) {
+    if (pool == NULL) {
+        return;
+    }
+    
+    pthread_mutex_lock(&pools_lock);
+    for (int i = 0; i < POOL_MAX; i++) {
+        if (pools[i] == pool) {
+            pools[i] = NULL;
+        }
+    }
+    pthread_mutex_unlock(&pools_lock);
+    
+    for (int i = 0; i < POOL_RELEASERS; i++) {
+        spsc_free(&pool->returned[i]);
+    }
+    free(pool->free);
+    placement_free(pool->packets, pool->packets_size);
+    free(pool);
+}
+
+// Owner only. NULL when every descriptor is somewhere in the pipeline.
+Packet *pool_get(PacketPool *pool) {
+    if (pool->free_count == 0) {
+        for (int i = 0; i < POOL_RELEASERS; i++) {
+            pool->free_count += spsc_pop(&pool->returned[i], pool->free + pool->free_count,
+                                         pool->size - pool->free_count);
+        }
+        if (pool->free_count == 0) {
+            return NULL;
+        }
+    }
+    
+    Packet *packet = pool->free[--pool->free_count];
+    packet->pool = pool;
+    atomic_fetch_add_explicit(&pool->in_use, 1, memory_order_relaxed);
+    return packet;
+}
+
+// Owner only: give back a descriptor that was never handed on
+void pool_put(PacketPool *pool, Packet *packet) {
+    pool->free[pool->free_count++] = packet;
+    atomic_fetch_sub_explicit(&pool->in_use, 1, memory_order_relaxed);
+}
+
+static void flush_pending(PacketPool *pool, int releaser) {
+    unsigned int count = pool->pending[releaser].count;
+    
+    // The queue holds every descriptor of the pool, so this always fits
+    spsc_push(&pool->returned[releaser], pool->pending[releaser].items, count);
+    atomic_fetch_sub_explicit(&pool->in_use, count, memory_order_relaxed);
+    pool->pending[releaser].count = 0;
+}
+
+// Called by the stage that is done with the packet
+void pool_release(Packet *packet, int releaser) {
+    PacketPool *pool = packet->pool;
+    
+    pool->pending[releaser].items[pool->pending[releaser].count++] = packet;
+    if (pool->pending[releaser].count == POOL_BATCH) {
+        flush_pending(pool, releaser);
+    }
+}
+
+// Send back partial batches; stages call this before going idle
+void pool_flush(int releaser) {
+    for (int i = 0; i < POOL_MAX; i++) {
+        if (pools[i] != NULL && pools[i]->pending[releaser].count > 0) {
+            flush_pending(pools[i], releaser);
+        }
+    }
+}
+
+unsigned long pool_in_use(void) {
+    unsigned long total = 0;
+    
+    for (int i = 0; i < POOL_MAX; i++) {
+        if (pools[i] != NULL) {
+            total += atomic_load_explicit(&pools[i]->in_use, memory_order_relaxed);
+        }
+    }
+    
+    return total;
+}
+
+unsigned long pool_capacity(void) {
+    unsigned long total = 0;
+    
+    for (int i = 0; i < POOL_MAX; i++) {
+        if (pools[i] != NULL) {
+            total += pools[i]->size;
+        }
+    }
+    
+    return total;
+}
@@ -0,0 +1,52 @@
+#ifndef ZIM_POOL_H
+#define ZIM_POOL_H
+
+#include "network.h"
+#include "spsc.h"
+
+// Preallocated packet descriptors. A pool is owned by the thread that
+// fills its descriptors (a capture thread, or the parse thread when
+// replaying); descriptors come back from the pipeline stages that finish
+// with them. Every stage hands descriptors back on its own SPSC queue and
+// in batches, so neither side ever takes a lock.
+#define POOL_BATCH 32
+
+// Pools are created before the pipeline starts and destroyed after it
+// stops, so the stages can walk the list without locking.
+
+// Stages that release descriptors
+#define POOL_RELEASER_PARSE   0  // Filtered out
+#define POOL_RELEASER_OUTPUT  1  // Written, not displayed
+#define POOL_RELEASER_DISPLAY 2  // Shown in the packet list
+#define POOL_RELEASERS        3
+
+typedef struct PacketPool {
+    Packet *packets;
+    size_t packets_size;  // Bytes mapped for the descriptors
+    unsigned int size;
+    
+    // Owner side: descriptors ready to be filled
+    void **free;
+    unsigned int free_count;
+    
+    // One return queue per releasing stage, plus that stage's unsent batch
+    SpscQueue returned[POOL_RELEASERS];
+    struct {
+        void *items[POOL_BATCH];
+        unsigned int count;
+    } pending[POOL_RELEASERS];
+    
+    atomic_ulong in_use;  // Handed out and not yet returned
+} PacketPool;
+
+// Function prototypes
+PacketPool *pool_create(unsigned int size, int node);
+void pool_destroy(PacketPool *pool);
+Packet *pool_get(PacketPool *pool);
+void pool_put(PacketPool *pool, Packet *packet);
+void pool_release(Packet *packet, int releaser);
+void pool_flush(int releaser);
+unsigned long pool_in_use(void);
+unsigned long pool_capacity(void);
+
+#endif // ZIM_POOL_H
@@ -0,0 +1,90 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <stdatomic.h>
+#include "qsbr.h"
+
+typedef struct {
+    void *pointer;
+    void (*release)(void *);
+    unsigned long seen[QSBR_MAX_THREADS];  // Reader counters at retire time
+} QsbrRetired;
+
+// Sequentially consistent throughout: a reader that passes a quiescent
+// state after a swap is guaranteed to load the new pointer afterwards
+static atomic_ulong counters[QSBR_MAX_THREADS];
+static atomic_int online[QSBR_MAX_THREADS];
+static QsbrRetired retired[QSBR_MAX_RETIRED];
+static int retired_count = 0;
+
+int qsbr_register(void) {
+    for (int i = 0; i < QSBR_MAX_THREADS; i++) {
+        int expected = 0;
+        if (atomic_compare_exchange_strong(&online[i], &expected, 1)) {
+            atomic_fetch_add(&counters[i], 1);
+            return i;
+        }
+    }
+    
+    fprintf(stderr, "Too many reader threads (max %d)\n", QSBR_MAX_THREADS);
+    return -1;
+}
+
+// An offline reader holds no references and is never waited for
+void qsbr_unregister(int id) {
+    if (id >= 0) {
+        atomic_store(&online[id], 0);
+    }
+}
+
+void qsbr_quiescent(int id) {
+    if (id >= 0) {
+        atomic_fetch_add(&counters[id], 1);
+    }
+}
+
+static int grace_period_over(const QsbrRetired *entry) {
+    for (int i = 0; i < QSBR_MAX_THREADS; i++) {
+        if (atomic_load(&online[i]) && atomic_load(&counters[i]) == entry->seen[i]) {
+            return 0;
+        }
+    }
+    
+    return 1;
+}
+
+// Free every retired object no reader can still see
+void qsbr_reclaim(void) {
+    int kept = 0;
+    
+    for (int i = 0; i < retired_count; i++) {
+        if (grace_period_over(&retired[i])) {
+            retired[i].release(retired[i].pointer);
+        } else {
+            retired[kept++] = retired[i];
+        }
+    }
+    
+    retired_count = kept;
+}
+
+// Called by the publishing thread after the pointer has been swapped
+void qsbr_retire(void *pointer, void (*release)(void *)) {
+    struct timespec pause = {0, 1000000};  // 1ms
+    
+    // Readers pass quiescent states at least once per pass over their
+    // input, so a full list drains quickly
+    qsbr_reclaim();
+    while (retired_count == QSBR_MAX_RETIRED) {
+        nanosleep(&pause, NULL);
+        qsbr_reclaim();
+    }
+    
+    QsbrRetired *entry = &retired[retired_count++];
+    entry->pointer = pointer;
+    entry->release = release;
+    for (int i = 0; i < QSBR_MAX_THREADS; i++) {
+        entry->seen[i] = atomic_load(&counters[i]);
+    }
+}
@@ -0,0 +1,19 @@
+#ifndef ZIM_QSBR_H
+#define ZIM_QSBR_H
+
+// Quiescent-state-based reclamation for RCU-style pointer publication.
+// Reader threads register and report a quiescent state whenever they hold
+// no reference to published data (e.g. once per loop). The publishing
+// thread swaps the pointer atomically and retires the old object, which
+// is freed once every registered reader has passed a quiescent state.
+#define QSBR_MAX_THREADS 32
+#define QSBR_MAX_RETIRED 16
+
+// Function prototypes
+int qsbr_register(void);
+void qsbr_unregister(int id);
+void qsbr_quiescent(int id);
+void qsbr_retire(void *pointer, void (*release)(void *));
+void qsbr_reclaim(void);
+
+#endif // ZIM_QSBR_H
@@ -0,0 +1,570 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "query.h"
+#include "store.h"
+#include "config.h"
+#include "utils.h"
+#include "replay.h"
+#include "pcap_writer.h"
+#include "packet_parser.h"
+#include "io_reader.h"
+
+#define QUERY_DEFAULT_TOP 10
+#define QUERY_TABLE_INITIAL 1024
+
+// One aggregation bucket
+typedef struct {
+    uint64_t key;
+    unsigned long records;
+    unsigned long packets;  // Scaled by the sample rate
+    unsigned long bytes;    // Scaled by the sample rate
+    int used;
+} QueryGroup;
+
+// Open-addressing hash table of groups, one per worker
+typedef struct {
+    QueryGroup *slots;
+    uint32_t capacity;
+    uint32_t count;
+} QueryTable;
+
+typedef struct {
+    pthread_t thread;
+    QueryTable table;
+    StoreChunk chunk;
+    unsigned long chunks_scanned;
+    unsigned long chunks_skipped;
+    int failed;
+} QueryWorker;
+
+// Shared, read-only while workers run
+static StoreReader reader;
+static QueryPredicate predicate;
+static int group_by = QUERY_GROUP_NONE;
+static atomic_uint next_chunk;
+static int sort_by_packets = 0;
+
+static void print_query_usage(void) {
+    printf("Usage: zim query <file> [options]\n");
+    printf("<file> is a record store (-o) or a pcap capture (-w) with its index\n");
+    printf("Options:\n");
+    printf("  -t <from,to>    Time range (epoch, 'YYYY-MM-DD HH:MM[:SS]' or 'HH:MM[:SS]')\n");
+    printf("  -s <ip>         Source address\n");
+    printf("  -d <ip>         Destination address\n");
+    printf("  -a <ip>         Source or destination address\n");
+    printf("  -p <port>       Source or destination port\n");
+    printf("  -P <protocol>   tcp, udp, icmp or a protocol number\n");
+    printf("  -g <key>        Group by src, dst, sport, dport or proto\n");
+    printf("  -n <count>      Show the top <count> groups (default: %d)\n", QUERY_DEFAULT_TOP);
+    printf("  -k <key>        Rank groups by bytes (default) or packets\n");
+    printf("  -j <threads>    Worker threads (default: all cores)\n");
+}
+
+static uint64_t hash_key(uint64_t key) {
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53ULL;
+    key ^= key >> 33;
+    return key;
+}
+
+static int table_init(QueryTable *table, uint32_t capacity) {
+    table->slots = calloc(capacity, sizeof(QueryGroup));
+    table->capacity = capacity;
+    table->count = 0;
+    return table->slots == NULL ? -1 : 0;
+}
+
+static QueryGroup *table_find(QueryTable *table, uint64_t key) {
+    uint32_t mask = table->capacity - 1;
+    uint32_t slot = hash_key(key) & mask;
+    
+    while (table->slots[slot].used && table->slots[slot].key != key) {
+        slot = (slot + 1) & mask;
+    }
+    
+    return &table->slots[slot];
+}
+
+static int table_add(QueryTable *table, uint64_t key, unsigned long records,
+                     unsigned long packets, unsigned long bytes) {
+    // Keep the load factor under one half
+    if ((table->count + 1) * 2 > table->capacity) {
+        QueryTable grown;
+        if (table_init(&grown, table->capacity * 2) != 0) {
+            return -1;
+        }
+        for (uint32_t i = 0; i < table->capacity; i++) {
+            if (table->slots[i].used) {
+                *table_find(&grown, table->slots[i].key) = table->slots[i];
+            }
+        }
+        grown.count = table->count;
+        free(table->slots);
+        *table = grown;
+    }
+    
+    QueryGroup *group = table_find(table, key);
+    if (!group->used) {
+        group->used = 1;
+        group->key = key;
+        table->count++;
+    }
+    group->records += records;
+    group->packets += packets;
+    group->bytes += bytes;
+    
+    return 0;
+}
+
+static int range_contains(const StoreColumnInfo *info, uint64_t value) {
+    return value >= info->min && value <= info->max;
+}
+
+// Chunk-level pruning on the per-column min/max ranges
+static int chunk_may_match(const StoreChunkHeader *header) {
+    const StoreColumnInfo *columns = header->columns;
+    
+    if (columns[STORE_COL_TIME].max < predicate.time_from ||
+        columns[STORE_COL_TIME].min > predicate.time_to) {
+        return 0;
+    }
+    if (predicate.has_src && !range_contains(&columns[STORE_COL_SRC_ADDR], predicate.src_addr)) {
+        return 0;
+    }
+    if (predicate.has_dst && !range_contains(&columns[STORE_COL_DST_ADDR], predicate.dst_addr)) {
+        return 0;
+    }
+    if (predicate.has_addr &&
+        !range_contains(&columns[STORE_COL_SRC_ADDR], predicate.addr) &&
+        !range_contains(&columns[STORE_COL_DST_ADDR], predicate.addr)) {
+        return 0;
+    }
+    if (predicate.has_port &&
+        !range_contains(&columns[STORE_COL_SRC_PORT], predicate.port) &&
+        !range_contains(&columns[STORE_COL_DST_PORT], predicate.port)) {
+        return 0;
+    }
+    if (predicate.has_protocol && !range_contains(&columns[STORE_COL_PROTO], predicate.protocol)) {
+        return 0;
+    }
+    
+    return 1;
+}
+
+int query_record_matches(const QueryPredicate *filter, uint64_t time,
+                         unsigned int src_addr, unsigned int dst_addr,
+                         unsigned int src_port, unsigned int dst_port,
+                         unsigned int protocol) {
+    if (time < filter->time_from || time > filter->time_to) {
+        return 0;
+    }
+    if (filter->has_src && src_addr != filter->src_addr) {
+        return 0;
+    }
+    if (filter->has_dst && dst_addr != filter->dst_addr) {
+        return 0;
+    }
+    if (filter->has_addr && src_addr != filter->addr && dst_addr != filter->addr) {
+        return 0;
+    }
+    if (filter->has_port && src_port != filter->port && dst_port != filter->port) {
+        return 0;
+    }
+    if (filter->has_protocol && protocol != filter->protocol) {
+        return 0;
+    }
+    
+    return 1;
+}
+
+static int row_matches(uint64_t **columns, uint32_t row) {
+    return query_record_matches(&predicate, columns[STORE_COL_TIME][row],
+                                columns[STORE_COL_SRC_ADDR][row], columns[STORE_COL_DST_ADDR][row],
+                                columns[STORE_COL_SRC_PORT][row], columns[STORE_COL_DST_PORT][row],
+                                columns[STORE_COL_PROTO][row]);
+}
+
+static uint64_t group_key(uint64_t **columns, uint32_t row) {
+    switch (group_by) {
+        case QUERY_GROUP_SRC:   return columns[STORE_COL_SRC_ADDR][row];
+        case QUERY_GROUP_DST:   return columns[STORE_COL_DST_ADDR][row];
+        case QUERY_GROUP_SPORT: return columns[STORE_COL_SRC_PORT][row];
+        case QUERY_GROUP_DPORT: return columns[STORE_COL_DST_PORT][row];
+        case QUERY_GROUP_PROTO: return columns[STORE_COL_PROTO][row];
+        default:                return 0;
+    }
+}
+
+// Workers claim chunks one at a time from a shared counter
+static void *query_worker(void *arg) {
+    QueryWorker *worker = arg;
+    unsigned int index;
+    
+    while ((index = atomic_fetch_add(&next_chunk, 1)) < reader.chunk_count) {
+        StoreIndexEntry *entry = &reader.index[index];
+        StoreChunkHeader header;
+        
+        // Time pruning needs only the index
+        if (entry->max_time < predicate.time_from || entry->min_time > predicate.time_to) {
+            worker->chunks_skipped++;
+            continue;
+        }
+        
+        if (store_read_chunk_header(&reader, index, &header) != 0) {
+            worker->failed = 1;
+            break;
+        }
+        if (!chunk_may_match(&header)) {
+            worker->chunks_skipped++;
+            continue;
+        }
+        
+        if (store_read_chunk(&reader, index, &worker->chunk) != 0) {
+            worker->failed = 1;
+            break;
+        }
+        worker->chunks_scanned++;
+        
+        uint64_t **columns = worker->chunk.columns;
+        for (uint32_t row = 0; row < worker->chunk.header.rows; row++) {
+            if (!row_matches(columns, row)) {
+                continue;
+            }
+            
+            uint64_t rate = columns[STORE_COL_RATE][row] ? columns[STORE_COL_RATE][row] : 1;
+            if (table_add(&worker->table, group_key(columns, row), 1, rate,
+                          rate * columns[STORE_COL_SIZE][row]) != 0) {
+                worker->failed = 1;
+                return NULL;
+            }
+        }
+    }
+    
+    return NULL;
+}
+
+static int compare_groups(const void *a, const void *b) {
+    const QueryGroup *left = a, *right = b;
+    unsigned long lv = sort_by_packets ? left->packets : left->bytes;
+    unsigned long rv = sort_by_packets ? right->packets : right->bytes;
+    
+    return lv < rv ? 1 : lv > rv ? -1 : 0;
+}
+
+static void format_group_key(uint64_t key, char *buffer, size_t size) {
+    switch (group_by) {
+        case QUERY_GROUP_SRC:
+        case QUERY_GROUP_DST:
+            format_ipv4(key, buffer, size);
+            break;
+        case QUERY_GROUP_PROTO:
+            if (key == PROTO_TCP) snprintf(buffer, size, "TCP");
+            else if (key == PROTO_UDP) snprintf(buffer, size, "UDP");
+            else if (key == PROTO_ICMP) snprintf(buffer, size, "ICMP");
+            else snprintf(buffer, size, "%llu", (unsigned long long)key);
+            break;
+        default:
+            snprintf(buffer, size, "%llu", (unsigned long long)key);
+            break;
+    }
+}
+
+static int parse_protocol(const char *str, unsigned int *protocol) {
+    if (strcmp(str, "tcp") == 0) *protocol = PROTO_TCP;
+    else if (strcmp(str, "udp") == 0) *protocol = PROTO_UDP;
+    else if (strcmp(str, "icmp") == 0) *protocol = PROTO_ICMP;
+    else {
+        char *end;
+        long value = strtol(str, &end, 10);
+        if (end == str || *end != '\0' || value < 0 || value > 255) {
+            return -1;
+        }
+        *protocol = value;
+    }
+    return 0;
+}
+
+int query_parse_time_range(const char *spec, QueryPredicate *range) {
+    char from[64];
+    const char *comma = strchr(spec, ',');
+    time_t start, end;
+    
+    if (comma == NULL || (size_t)(comma - spec) >= sizeof(from)) {
+        return -1;
+    }
+    memcpy(from, spec, comma - spec);
+    from[comma - spec] = '\0';
+    
+    if (parse_time_spec(from, &start) != 0 || parse_time_spec(comma + 1, &end) != 0) {
+        return -1;
+    }
+    
+    range->time_from = (uint64_t)start * 1000000;
+    range->time_to = (uint64_t)end * 1000000 + 999999;
+    return 0;
+}
+
+// Print the totals and, when grouping, the top groups. Reorders the table.
+static void print_results(QueryTable *result, const char *unit, unsigned long total,
+                          unsigned long scanned, unsigned long skipped, int top) {
+    unsigned long records = 0, packets = 0, bytes = 0;
+    char bytes_str[32];
+    
+    // Compact the used slots for sorting
+    uint32_t count = 0;
+    for (uint32_t s = 0; s < result->capacity; s++) {
+        if (result->slots[s].used) {
+            records += result->slots[s].records;
+            packets += result->slots[s].packets;
+            bytes += result->slots[s].bytes;
+            result->slots[count++] = result->slots[s];
+        }
+    }
+    
+    format_bytes(bytes, bytes_str, sizeof(bytes_str));
+    printf("%s: %lu total, %lu scanned, %lu skipped by index\n", unit, total, scanned, skipped);
+    printf("Matched: %lu records, %lu packets, %s (scaled by sample rate)\n",
+           records, packets, bytes_str);
+    
+    if (group_by != QUERY_GROUP_NONE && count > 0) {
+        qsort(result->slots, count, sizeof(QueryGroup), compare_groups);
+        
+        printf("\n%-20s %12s %12s %14s\n", "Key", "Records", "Packets", "Bytes");
+        for (uint32_t g = 0; g < count && (int)g < top; g++) {
+            char key_str[MAX_ADDR_STR_LEN];
+            format_group_key(result->slots[g].key, key_str, sizeof(key_str));
+            printf("%-20s %12lu %12lu %14lu\n", key_str, result->slots[g].records,
+                   result->slots[g].packets, result->slots[g].bytes);
+        }
+    }
+}
+
+// Scan a columnar store on several threads
+static int query_store(const char *filename, long threads, int top) {
+    if (store_open(filename, &reader) != 0) {
+        return 1;
+    }
+    
+    QueryWorker *workers = calloc(threads, sizeof(QueryWorker));
+    if (workers == NULL) {
+        perror("calloc");
+        store_close(&reader);
+        return 1;
+    }
+    
+    int failed = 0;
+    atomic_store(&next_chunk, 0);
+    for (long i = 0; i < threads; i++) {
+        if (table_init(&workers[i].table, QUERY_TABLE_INITIAL) != 0 ||
+            pthread_create(&workers[i].thread, NULL, query_worker, &workers[i]) != 0) {
+            fprintf(stderr, "Error: Failed to start query worker\n");
+            free(workers[i].table.slots);
+            threads = i;
+            failed = 1;
+            break;
+        }
+    }
+    
+    // Merge per-worker tables into the first
+    unsigned long scanned = 0, skipped = 0;
+    for (long i = 0; i < threads; i++) {
+        pthread_join(workers[i].thread, NULL);
+        failed |= workers[i].failed;
+        scanned += workers[i].chunks_scanned;
+        skipped += workers[i].chunks_skipped;
+        store_chunk_free(&workers[i].chunk);
+        
+        if (i == 0) {
+            continue;
+        }
+        for (uint32_t s = 0; s < workers[i].table.capacity; s++) {
+            QueryGroup *group = &workers[i].table.slots[s];
+            if (group->used && table_add(&workers[0].table, group->key, group->records,
+                                         group->packets, group->bytes) != 0) {
+                failed = 1;
+            }
+        }
+        free(workers[i].table.slots);
+    }
+    
+    if (!failed) {
+        print_results(&workers[0].table, "Chunks", reader.chunk_count, scanned, skipped, top);
+    }
+    
+    if (threads > 0) {
+        free(workers[0].table.slots);
+    }
+    free(workers);
+    store_close(&reader);
+    
+    return failed ? 1 : 0;
+}
+
+// Scan a pcap capture, seeking through its sidecar index when present
+static int query_capture(const char *filename, int top) {
+    QueryTable table;
+    Packet *packet = malloc(sizeof(Packet));
+    unsigned long total, scanned, skipped;
+    int failed = 0;
+    
+    if (packet == NULL) {
+        perror("malloc");
+        return 1;
+    }
+    if (replay_open(filename, &predicate) != 0) {
+        free(packet);
+        return 1;
+    }
+    if (table_init(&table, QUERY_TABLE_INITIAL) != 0) {
+        perror("calloc");
+        replay_close();
+        free(packet);
+        return 1;
+    }
+    
+    // Packets returned by the replay already match the predicate
+    while (replay_next(packet)) {
+        uint64_t values[STORE_COLUMNS];
+        uint64_t *columns[STORE_COLUMNS];
+        
+        parse_packet(packet);
+        values[STORE_COL_SRC_ADDR] = packet->src_addr;
+        values[STORE_COL_DST_ADDR] = packet->dst_addr;
+        values[STORE_COL_SRC_PORT] = packet->src_port;
+        values[STORE_COL_DST_PORT] = packet->dst_port;
+        values[STORE_COL_PROTO] = packet->protocol;
+        for (int c = 0; c < STORE_COLUMNS; c++) {
+            columns[c] = &values[c];
+        }
+        
+        if (table_add(&table, group_key(columns, 0), 1, 1, packet->size) != 0) {
+            failed = 1;
+            break;
+        }
+    }
+    
+    replay_segment_counts(&total, &scanned, &skipped);
+    if (!failed) {
+        print_results(&table, "Segments", total, scanned, skipped, top);
+    }
+    
+    free(table.slots);
+    free(packet);
+    replay_close();
+    
+    return failed ? 1 : 0;
+}
+
+// Looks through compression. Returns -1 (reported) if unreadable.
+static int is_capture_file(const char *filename) {
+    unsigned int magic = 0;
+    IoReader *file = io_reader_open(filename);
+    
+    if (file == NULL) {
+        return -1;
+    }
+    if (io_reader_pread(file, &magic, sizeof(magic), 0) != sizeof(magic)) {
+        magic = 0;
+    }
+    io_reader_close(file);
+    
+    return magic == PCAP_MAGIC;
+}
+
+int query_main(int argc, char *argv[]) {
+    int opt;
+    int top = QUERY_DEFAULT_TOP;
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+    
+    memset(&predicate, 0, sizeof(predicate));
+    predicate.time_to = UINT64_MAX;
+    group_by = QUERY_GROUP_NONE;
+    
+    optind = 1;
+    while ((opt = getopt(argc, argv, "t:s:d:a:p:P:g:n:k:j:h")) != -1) {
+        switch (opt) {
+            case 't':
+                if (query_parse_time_range(optarg, &predicate) != 0) {
+                    fprintf(stderr, "Invalid time range: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 's':
+                predicate.has_src = parse_ipv4(optarg, &predicate.src_addr) == 0;
+                if (!predicate.has_src) goto bad_address;
+                break;
+            case 'd':
+                predicate.has_dst = parse_ipv4(optarg, &predicate.dst_addr) == 0;
+                if (!predicate.has_dst) goto bad_address;
+                break;
+            case 'a':
+                predicate.has_addr = parse_ipv4(optarg, &predicate.addr) == 0;
+                if (!predicate.has_addr) goto bad_address;
+                break;
+            case 'p':
+                predicate.has_port = 1;
+                predicate.port = atoi(optarg);
+                break;
+            case 'P':
+                predicate.has_protocol = 1;
+                if (parse_protocol(optarg, &predicate.protocol) != 0) {
+                    fprintf(stderr, "Invalid protocol: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'g':
+                if (strcmp(optarg, "src") == 0) group_by = QUERY_GROUP_SRC;
+                else if (strcmp(optarg, "dst") == 0) group_by = QUERY_GROUP_DST;
+                else if (strcmp(optarg, "sport") == 0) group_by = QUERY_GROUP_SPORT;
+                else if (strcmp(optarg, "dport") == 0) group_by = QUERY_GROUP_DPORT;
+                else if (strcmp(optarg, "proto") == 0) group_by = QUERY_GROUP_PROTO;
+                else {
+                    fprintf(stderr, "Invalid group key: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'n':
+                top = atoi(optarg);
+                break;
+            case 'k':
+                sort_by_packets = strcmp(optarg, "packets") == 0;
+                break;
+            case 'j':
+                threads = atol(optarg);
+                break;
+            case 'h':
+                print_query_usage();
+                return 0;
+            default:
+                print_query_usage();
+                return 1;
+        }
+    }
+    
+    if (optind >= argc) {
+        print_query_usage();
+        return 1;
+    }
+    if (threads < 1) {
+        threads = 1;
+    }
+    
+    int capture = is_capture_file(argv[optind]);
+    if (capture < 0) {
+        return 1;
+    }
+    if (capture) {
+        return query_capture(argv[optind], top);
+    }
+    return query_store(argv[optind], threads, top);
+
+bad_address:
+    fprintf(stderr, "Invalid address: %s\n", optarg);
+    return 1;
+}
@@ -0,0 +1,34 @@
+#ifndef ZIM_QUERY_H
+#define ZIM_QUERY_H
+
+#include <stdint.h>
+
+// Group-by keys
+#define QUERY_GROUP_NONE  0
+#define QUERY_GROUP_SRC   1
+#define QUERY_GROUP_DST   2
+#define QUERY_GROUP_SPORT 3
+#define QUERY_GROUP_DPORT 4
+#define QUERY_GROUP_PROTO 5
+
+// Row predicate; every condition that is set must hold
+typedef struct {
+    uint64_t time_from;  // Microseconds since the epoch, inclusive
+    uint64_t time_to;
+    int has_src, has_dst, has_addr, has_port, has_protocol;
+    unsigned int src_addr;
+    unsigned int dst_addr;
+    unsigned int addr;   // Either side
+    unsigned int port;   // Either side
+    unsigned int protocol;
+} QueryPredicate;
+
+// Function prototypes
+int query_main(int argc, char *argv[]);
+int query_parse_time_range(const char *spec, QueryPredicate *predicate);
+int query_record_matches(const QueryPredicate *predicate, uint64_t time,
+                         unsigned int src_addr, unsigned int dst_addr,
+                         unsigned int src_port, unsigned int dst_port,
+                         unsigned int protocol);
+
+#endif // ZIM_QUERY_H
@@ -0,0 +1,179 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include "replay.h"
+#include "pcap_writer.h"
+#include "pcap_index.h"
+#include "io_reader.h"
+#include "tunnel.h"
+
+#define REPLAY_WINDOW (1 << 20)  // Bytes read from the capture at a time
+
+static IoReader *replay_file = NULL;
+static char *window = NULL;
+static uint64_t window_start = 0;
+static size_t window_length = 0;
+static PcapIndex capture_index;
+static int has_index = 0;
+static QueryPredicate predicate;
+
+// Read position and the end of the segment being read
+static uint32_t next_segment = 0;
+static uint64_t position = 0;
+static uint64_t segment_end = 0;
+static unsigned long segments_read = 0;
+static unsigned long segments_skipped = 0;
+
+int replay_open(const char *filename, const QueryPredicate *filter) {
+    PcapFileHeader header;
+    
+    // Compressed captures are read the same way, see io_reader.h
+    replay_file = io_reader_open(filename);
+    window = malloc(REPLAY_WINDOW);
+    if (replay_file == NULL || window == NULL) {
+        replay_close();
+        return -1;
+    }
+    window_start = window_length = 0;
+    
+    if (io_reader_pread(replay_file, &header, sizeof(header), 0) != sizeof(header) ||
+        header.magic != PCAP_MAGIC || header.linktype != PCAP_LINKTYPE_ETHERNET) {
+        fprintf(stderr, "%s: not an Ethernet pcap file\n", filename);
+        replay_close();
+        return -1;
+    }
+    
+    predicate = *filter;
+    has_index = pcap_index_open(filename, &capture_index) == 0;
+    if (has_index && capture_index.count == 0) {
+        pcap_index_close(&capture_index);
+        has_index = 0;
+    }
+    next_segment = 0;
+    position = sizeof(header);
+    segment_end = has_index ? position : UINT64_MAX;
+    segments_read = segments_skipped = 0;
+    
+    return 0;
+}
+
+void replay_close(void) {
+    io_reader_close(replay_file);
+    replay_file = NULL;
+    free(window);
+    window = NULL;
+    if (has_index) {
+        pcap_index_close(&capture_index);
+        has_index = 0;
+    }
+}
+
+// Seek to the next segment the index says may match. The last indexed
+// segment is always read through to the end of the file, which also
+// covers records written after the index was last flushed.
+static int advance_segment(void) {
+    while (next_segment < capture_index.count) {
+        uint32_t current = next_segment++;
+        int last = next_segment == capture_index.count;
+        
+        if (!last && !pcap_index_segment_may_match(&capture_index.segments[current], &predicate)) {
+            segments_skipped++;
+            continue;
+        }
+        
+        position = capture_index.segments[current].offset;
+        segment_end = last ? UINT64_MAX : capture_index.segments[next_segment].offset;
+        segments_read++;
+        
+        return 1;
+    }
+    
+    return 0;
+}
+
+// Read from the current position through the window, so records cost
+// no system call. Returns 0 at the end of the capture.
+static int read_bytes(void *data, size_t size) {
+    if (position < window_start || position + size > window_start + window_length) {
+        ssize_t length = io_reader_pread(replay_file, window, REPLAY_WINDOW, position);
+        
+        if (length < 0) {
+            return 0;
+        }
+        window_start = position;
+        window_length = length;
+        if (size > window_length) {
+            return 0;
+        }
+    }
+    
+    memcpy(data, window + (position - window_start), size);
+    position += size;
+    return 1;
+}
+
+// Check the predicate against the raw frame without a full parse
+static int frame_matches(const Packet *packet, uint64_t time) {
+    TunnelLayer layers[TUNNEL_MAX_DEPTH + 1];
+    int count = tunnel_layers(packet->buffer, packet->size, layers, TUNNEL_MAX_DEPTH + 1);
+    
+    if (count == 0) {
+        return query_record_matches(&predicate, time, 0, 0, 0, 0, PROTO_UNKNOWN);
+    }
+    
+    // A tunneled packet matches on its outer or any inner header
+    for (int i = 0; i < count; i++) {
+        if (query_record_matches(&predicate, time, layers[i].src_addr, layers[i].dst_addr,
+                                 layers[i].src_port, layers[i].dst_port, layers[i].protocol)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Read the next stored packet that matches the predicate into packet.
+// Returns 0 at the end of the capture.
+int replay_next(Packet *packet) {
+    PcapRecordHeader record;
+    
+    if (replay_file == NULL) {
+        return 0;
+    }
+    
+    for (;;) {
+        if (position >= segment_end && !advance_segment()) {
+            return 0;
+        }
+        
+        if (!read_bytes(&record, sizeof(record))) {
+            return 0;
+        }
+        if (record.caplen > MAX_PACKET_SIZE) {
+            fprintf(stderr, "Corrupt capture record at offset %llu\n",
+                    (unsigned long long)(position - sizeof(record)));
+            return 0;
+        }
+        
+        // Reset everything but the pool link and the raw buffer, which is
+        // overwritten below
+        memset(packet, 0, offsetof(Packet, pool));
+        if (!read_bytes(packet->buffer, record.caplen)) {
+            return 0;
+        }
+        
+        packet->timestamp.tv_sec = record.ts_sec;
+        packet->timestamp.tv_usec = record.ts_usec;
+        packet->size = record.caplen;
+        
+        if (frame_matches(packet, (uint64_t)record.ts_sec * 1000000 + record.ts_usec)) {
+            return 1;
+        }
+    }
+}
+
+void replay_segment_counts(unsigned long *total, unsigned long *read, unsigned long *skipped) {
+    *total = has_index ? capture_index.count : 0;
+    *read = segments_read;
+    *skipped = segments_skipped;
+}
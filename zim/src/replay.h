@@ -0,0 +1,13 @@
+#ifndef ZIM_REPLAY_H
+#define ZIM_REPLAY_H
+
+#include "network.h"
+#include "query.h"
+
+// Function prototypes
+int replay_open(const char *filename, const QueryPredicate *predicate);
+int replay_next(Packet *packet);
+void replay_close(void);
+void replay_segment_counts(unsigned long *total, unsigned long *read, unsigned long *skipped);
+
+#endif // ZIM_REPLAY_H
@@ -0,0 +1,151 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "sampler.h"
+
+// Adaptive controller tuning
+#define SAMPLER_DEFAULT_RATE   16
+#define SAMPLER_INTERVAL_NS    250000000UL  // Re-evaluate every 250ms
+#define SAMPLER_HIGH_LOAD      0.80         // Escalate above this utilization
+#define SAMPLER_LOW_LOAD       0.30         // Relax below this utilization
+#define SAMPLER_HIGH_OCCUPANCY 0.50         // Escalate above this ring fill level
+#define SAMPLER_CALM_INTERVALS 8            // Calm intervals before relaxing
+
+static int enabled = 0;
+static int adaptive = 0;
+static int level = SHED_NONE;
+static unsigned int rate = 1;
+static unsigned long sequence = 0;
+
+// Load measurement for the current interval
+static double avg_cost_ns = 0.0;
+static unsigned long interval_packets = 0;
+static struct timespec interval_start;
+static int calm_intervals = 0;
+
+static const char *level_names[] = {
+    "none", "detail", "payload", "log", "display"
+};
+
+static unsigned long elapsed_ns(const struct timespec *start, const struct timespec *end) {
+    return (end->tv_sec - start->tv_sec) * 1000000000UL + end->tv_nsec - start->tv_nsec;
+}
+
+// Parse "<N>" for fixed 1-in-N sampling or "auto[:<N>]" for adaptive shedding
+int sampler_init(const char *spec) {
+    const char *rate_str = spec;
+    
+    if (strncmp(spec, "auto", 4) == 0) {
+        adaptive = 1;
+        rate_str = spec[4] == ':' ? spec + 5 : NULL;
+    } else if (spec[0] == '\0') {
+        rate_str = NULL;
+    }
+    
+    rate = SAMPLER_DEFAULT_RATE;
+    if (rate_str != NULL) {
+        char *end;
+        long value = strtol(rate_str, &end, 10);
+        if (end == rate_str || *end != '\0' || value < 1) {
+            fprintf(stderr, "Invalid sampling spec: %s\n", spec);
+            return -1;
+        }
+        rate = value;
+    }
+    
+    // Fixed sampling sheds every expensive stage for unsampled packets
+    level = adaptive ? SHED_NONE : SHED_MAX;
+    enabled = 1;
+    clock_gettime(CLOCK_MONOTONIC, &interval_start);
+    
+    return 0;
+}
+
+int sampler_enabled(void) {
+    return enabled;
+}
+
+// Decide which stages this packet skips. Statistics are never shed.
+void sampler_classify(Packet *packet) {
+    packet->shed = 0;
+    packet->sample_rate = 1;
+    interval_packets++;
+    
+    if (!enabled || level == SHED_NONE) {
+        return;
+    }
+    
+    // Deterministic 1-in-N; sampled packets keep every stage
+    if (sequence++ % rate == 0) {
+        if (level >= SHED_LOG) {
+            packet->sample_rate = rate;
+        }
+        return;
+    }
+    
+    if (level >= SHED_DETAIL) packet->shed |= SHED_STAGE_DETAIL;
+    if (level >= SHED_PAYLOAD) packet->shed |= SHED_STAGE_PAYLOAD;
+    if (level >= SHED_LOG) packet->shed |= SHED_STAGE_LOG;
+    if (level >= SHED_DISPLAY) packet->shed |= SHED_STAGE_DISPLAY;
+}
+
+// Feed the measured processing time of one packet (exponential moving average)
+void sampler_record_cost(unsigned long nsec) {
+    if (avg_cost_ns == 0.0) {
+        avg_cost_ns = nsec;
+    } else {
+        avg_cost_ns = avg_cost_ns * 0.99 + nsec * 0.01;
+    }
+}
+
+// Periodically adjust the shed level from drops, capture ring occupancy
+// and estimated utilization
+void sampler_update(unsigned long drops, double occupancy) {
+    struct timespec now;
+    
+    if (!enabled || !adaptive) {
+        return;
+    }
+    
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    unsigned long interval = elapsed_ns(&interval_start, &now);
+    if (interval < SAMPLER_INTERVAL_NS) {
+        return;
+    }
+    
+    double utilization = (avg_cost_ns * interval_packets) / interval;
+    
+    if (drops > 0 || occupancy > SAMPLER_HIGH_OCCUPANCY || utilization > SAMPLER_HIGH_LOAD) {
+        if (level < SHED_MAX) {
+            level++;
+        }
+        calm_intervals = 0;
+    } else if (utilization < SAMPLER_LOW_LOAD && occupancy < SAMPLER_HIGH_OCCUPANCY / 2) {
+        // Relax one stage at a time so the level does not oscillate
+        if (++calm_intervals >= SAMPLER_CALM_INTERVALS && level > SHED_NONE) {
+            level--;
+            calm_intervals = 0;
+        }
+    } else {
+        calm_intervals = 0;
+    }
+    
+    interval_packets = 0;
+    interval_start = now;
+}
+
+int sampler_level(void) {
+    return level;
+}
+
+unsigned int sampler_rate(void) {
+    return rate;
+}
+
+const char *sampler_level_name(int shed_level) {
+    if (shed_level < SHED_NONE || shed_level > SHED_MAX) {
+        return "unknown";
+    }
+    return level_names[shed_level];
+}
@@ -0,0 +1,31 @@
+#ifndef ZIM_SAMPLER_H
+#define ZIM_SAMPLER_H
+
+#include "network.h"
+
+// Shed levels, cheapest loss first. At level N every stage up to and
+// including N is skipped for packets that are not sampled.
+#define SHED_NONE    0
+#define SHED_DETAIL  1  // Detailed packet view
+#define SHED_PAYLOAD 2  // Payload extraction
+#define SHED_LOG     3  // Packet logging
+#define SHED_DISPLAY 4  // Packet list display
+#define SHED_MAX     SHED_DISPLAY
+
+// Per-packet stage bits stored in Packet.shed
+#define SHED_STAGE_DETAIL  0x01
+#define SHED_STAGE_PAYLOAD 0x02
+#define SHED_STAGE_LOG     0x04
+#define SHED_STAGE_DISPLAY 0x08
+
+// Function prototypes
+int sampler_init(const char *spec);
+int sampler_enabled(void);
+void sampler_classify(Packet *packet);
+void sampler_record_cost(unsigned long nsec);
+void sampler_update(unsigned long drops, double occupancy);
+int sampler_level(void);
+unsigned int sampler_rate(void);
+const char *sampler_level_name(int level);
+
+#endif // ZIM_SAMPLER_H
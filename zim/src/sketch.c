@@ -0,0 +1,149 @@
+#include <math.h>
+#include "sketch.h"
+
+// 64-bit finalizer from MurmurHash3
+uint64_t sketch_hash(uint64_t key) {
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53ULL;
+    key ^= key >> 33;
+    return key;
+}
+
+// The top bits pick a register; the register keeps the longest run of
+// leading zeros (plus one) seen in the remaining bits. Returns 1 when a
+// register grew, i.e. when the estimate may have changed.
+int hll_add(uint8_t *registers, int precision, uint64_t hash) {
+    uint32_t index = hash >> (64 - precision);
+    uint64_t rest = hash << precision;
+    uint8_t rank = 1;
+    
+    while (rank <= 64 - precision && !(rest & 0x8000000000000000ULL)) {
+        rest <<= 1;
+        rank++;
+    }
+    
+    if (rank > registers[index]) {
+        registers[index] = rank;
+        return 1;
+    }
+    
+    return 0;
+}
+
+double hll_estimate(const uint8_t *registers, int precision) {
+    uint32_t m = HLL_REGISTERS(precision);
+    uint32_t zeros = 0;
+    double sum = 0.0;
+    double alpha;
+    
+    switch (m) {
+        case 16:
+            alpha = 0.673;
+            break;
+        case 32:
+            alpha = 0.697;
+            break;
+        case 64:
+            alpha = 0.709;
+            break;
+        default:
+            alpha = 0.7213 / (1.0 + 1.079 / m);
+            break;
+    }
+    
+    for (uint32_t i = 0; i < m; i++) {
+        sum += ldexp(1.0, -registers[i]);
+        if (registers[i] == 0) {
+            zeros++;
+        }
+    }
+    
+    double estimate = alpha * m * m / sum;
+    
+    // Small range correction: linear counting is more accurate here
+    if (estimate <= 2.5 * m && zeros > 0) {
+        estimate = m * log((double)m / zeros);
+    }
+    
+    return estimate;
+}
+
+// Union of two sketches of the same precision
+void hll_merge(uint8_t *dest, const uint8_t *src, int precision) {
+    uint32_t m = HLL_REGISTERS(precision);
+    
+    for (uint32_t i = 0; i < m; i++) {
+        if (src[i] > dest[i]) {
+            dest[i] = src[i];
+        }
+    }
+}
+
+static unsigned int loghist_bucket(unsigned long value) {
+    if (value < LOGHIST_SUB_BUCKETS) {
+        return value;
+    }
+    
+    unsigned int msb = 63 - __builtin_clzll(value);
+    unsigned int sub = (value >> (msb - LOGHIST_SUB_BITS)) & (LOGHIST_SUB_BUCKETS - 1);
+    unsigned int bucket = (msb - LOGHIST_SUB_BITS + 1) * LOGHIST_SUB_BUCKETS + sub;
+    
+    return bucket < LOGHIST_BUCKETS ? bucket : LOGHIST_BUCKETS - 1;
+}
+
+// Smallest value that falls in bucket
+static unsigned long loghist_lower_bound(unsigned int bucket) {
+    if (bucket < LOGHIST_SUB_BUCKETS) {
+        return bucket;
+    }
+    
+    unsigned int msb = bucket / LOGHIST_SUB_BUCKETS + LOGHIST_SUB_BITS - 1;
+    unsigned int sub = bucket % LOGHIST_SUB_BUCKETS;
+    
+    return (unsigned long)(LOGHIST_SUB_BUCKETS + sub) << (msb - LOGHIST_SUB_BITS);
+}
+
+void loghist_add(LogHistogram *histogram, unsigned long value) {
+    histogram->buckets[loghist_bucket(value)]++;
+    histogram->count++;
+    if (value > histogram->max) {
+        histogram->max = value;
+    }
+}
+
+// Upper bound of the bucket holding the given percentile (0-100)
+unsigned long loghist_percentile(const LogHistogram *histogram, double percentile) {
+    unsigned long rank, seen = 0;
+    
+    if (histogram->count == 0) {
+        return 0;
+    }
+    
+    rank = (unsigned long)(percentile / 100.0 * histogram->count + 0.5);
+    if (rank == 0) {
+        rank = 1;
+    }
+    
+    for (unsigned int i = 0; i < LOGHIST_BUCKETS; i++) {
+        seen += histogram->buckets[i];
+        if (seen >= rank) {
+            unsigned long upper = i + 1 < LOGHIST_BUCKETS ? loghist_lower_bound(i + 1) - 1
+                                                          : histogram->max;
+            return upper < histogram->max ? upper : histogram->max;
+        }
+    }
+    
+    return histogram->max;
+}
+
+void loghist_merge(LogHistogram *dest, const LogHistogram *src) {
+    for (unsigned int i = 0; i < LOGHIST_BUCKETS; i++) {
+        dest->buckets[i] += src->buckets[i];
+    }
+    dest->count += src->count;
+    if (src->max > dest->max) {
+        dest->max = src->max;
+    }
+}
@@ -0,0 +1,38 @@
+#ifndef ZIM_SKETCH_H
+#define ZIM_SKETCH_H
+
+#include <stdint.h>
+
+// Streaming sketches shared by the statistics and detection stages.
+//
+// HyperLogLog cardinality sketches. Registers are plain byte arrays of
+// 1 << precision entries owned by the caller, so sketches can be embedded
+// in fixed-size tables and merged with a byte-wise max.
+#define HLL_MIN_PRECISION 4
+#define HLL_MAX_PRECISION 16
+#define HLL_REGISTERS(precision) (1u << (precision))
+
+// Log-bucketed histogram: LOGHIST_SUB_BUCKETS linear buckets per power of
+// two, so every bucket spans at most 1/8 of its lower bound. Values past
+// the last bucket are counted in it.
+#define LOGHIST_SUB_BITS 3
+#define LOGHIST_SUB_BUCKETS (1 << LOGHIST_SUB_BITS)
+#define LOGHIST_MAX_BITS 17  // Exact buckets up to 2^17 - 1
+#define LOGHIST_BUCKETS ((LOGHIST_MAX_BITS - LOGHIST_SUB_BITS + 1) * LOGHIST_SUB_BUCKETS)
+
+typedef struct {
+    unsigned long count;
+    unsigned long max;
+    unsigned long buckets[LOGHIST_BUCKETS];
+} LogHistogram;
+
+// Function prototypes
+uint64_t sketch_hash(uint64_t key);
+int hll_add(uint8_t *registers, int precision, uint64_t hash);
+double hll_estimate(const uint8_t *registers, int precision);
+void hll_merge(uint8_t *dest, const uint8_t *src, int precision);
+void loghist_add(LogHistogram *histogram, unsigned long value);
+unsigned long loghist_percentile(const LogHistogram *histogram, double percentile);
+void loghist_merge(LogHistogram *dest, const LogHistogram *src);
+
+#endif // ZIM_SKETCH_H
@@ -0,0 +1,82 @@
+#include <string.h>
+#include "spsc.h"
+#include "placement.h"
+
+// Capacity is rounded up to a power of two. The slots go on node, or
+// anywhere with PLACEMENT_ANY.
+int spsc_init(SpscQueue *queue, unsigned long capacity, int node) {
+    unsigned long size = 1;
+    
+    while (size < capacity) {
+        size <<= 1;
+    }
+    
+    memset(queue, 0, sizeof(*queue));
+    queue->size = size * sizeof(void *);
+    queue->slots = placement_alloc(&queue->size, node, 0);
+    if (queue->slots == NULL) {
+        return -1;
+    }
+    queue->mask = size - 1;
+    
+    return 0;
+}
+
+void spsc_free(SpscQueue *queue) {
+    placement_free(queue->slots, queue->size);
+    queue->slots = NULL;
+}
+
+// Producer only. Returns how many items fit.
+unsigned int spsc_push(SpscQueue *queue, void *const *items, unsigned int count) {
+    unsigned long head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    unsigned long room = queue->mask + 1 - (head - queue->cached_tail);
+    
+    if (room < count) {
+        queue->cached_tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+        room = queue->mask + 1 - (head - queue->cached_tail);
+        if (count > room) {
+            count = room;
+        }
+    }
+    
+    for (unsigned int i = 0; i < count; i++) {
+        queue->slots[(head + i) & queue->mask] = items[i];
+    }
+    atomic_store_explicit(&queue->head, head + count, memory_order_release);
+    
+    return count;
+}
+
+// Consumer only. Returns how many items were taken.
+unsigned int spsc_pop(SpscQueue *queue, void **items, unsigned int max) {
+    unsigned long tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    unsigned long ready = queue->cached_head - tail;
+    
+    if (ready < max) {
+        queue->cached_head = atomic_load_explicit(&queue->head, memory_order_acquire);
+        ready = queue->cached_head - tail;
+        if (max > ready) {
+            max = ready;
+        }
+    }
+    
+    for (unsigned int i = 0; i < max; i++) {
+        items[i] = queue->slots[(tail + i) & queue->mask];
+    }
+    atomic_store_explicit(&queue->tail, tail + max, memory_order_release);
+    
+    return max;
+}
+
+// Approximate when read from a third thread
+unsigned long spsc_depth(SpscQueue *queue) {
+    unsigned long tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    unsigned long head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    
+    return head - tail;
+}
+
+unsigned long spsc_capacity(const SpscQueue *queue) {
+    return queue->mask + 1;
+}
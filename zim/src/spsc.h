@@ -0,0 +1,35 @@
+#ifndef ZIM_SPSC_H
+#define ZIM_SPSC_H
+
+#include <stddef.h>
+#include <stdatomic.h>
+
+// Lock-free single-producer/single-consumer queue of pointers. Each side
+// keeps a private copy of the other side's index and only re-reads the
+// shared one when the copy says the queue is full (or empty), so a batch
+// push or pop touches the other side's cache line at most once.
+#define SPSC_CACHE_LINE 64
+
+typedef struct {
+    void **slots;
+    size_t size;         // Bytes mapped for the slots
+    unsigned long mask;  // Capacity - 1, capacity is a power of two
+    
+    // Producer side
+    _Alignas(SPSC_CACHE_LINE) atomic_ulong head;
+    unsigned long cached_tail;
+    
+    // Consumer side
+    _Alignas(SPSC_CACHE_LINE) atomic_ulong tail;
+    unsigned long cached_head;
+} SpscQueue;
+
+// Function prototypes
+int spsc_init(SpscQueue *queue, unsigned long capacity, int node);
+void spsc_free(SpscQueue *queue);
+unsigned int spsc_push(SpscQueue *queue, void *const *items, unsigned int count);
+unsigned int spsc_pop(SpscQueue *queue, void **items, unsigned int max);
+unsigned long spsc_depth(SpscQueue *queue);
+unsigned long spsc_capacity(const SpscQueue *queue);
+
+#endif // ZIM_SPSC_H
@@ -0,0 +1,370 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "stats_file.h"
+#include "utils.h"
+
+#define STATS_DEFAULT_MINUTES 15
+#define STATS_READ_RETRIES 1000
+
+static StatsFile *mapped = NULL;
+static int map_fd = -1;
+static struct timespec last_publish = {0, 0};
+static time_t last_sync = 0;
+
+// Writer side of the sequence lock: the count is odd while the snapshot
+// and the series are in flux
+static void write_snapshot(void) {
+    StatsFileHeader *header = &mapped->header;
+    uint64_t sequence = atomic_load_explicit(&header->sequence, memory_order_relaxed);
+    time_t now = time(NULL);
+    
+    atomic_store_explicit(&header->sequence, sequence + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    
+    memcpy(&mapped->snapshot, &mapped->live, sizeof(PacketStats));
+    
+    StatsSample *sample = &mapped->series[(now / 60) % STATS_SERIES_MINUTES];
+    sample->minute = now / 60;
+    sample->packets = mapped->live.total_packets;
+    sample->bytes = mapped->live.total_bytes;
+    sample->dropped = mapped->live.dropped_packets;
+    header->published = now;
+    
+    atomic_store_explicit(&header->sequence, sequence + 2, memory_order_release);
+    
+    if (now - last_sync >= STATS_SYNC_SEC) {
+        msync(mapped, sizeof(StatsFile), MS_ASYNC);
+        last_sync = now;
+    }
+}
+
+// Map the statistics file, creating it if needed, and point the global
+// statistics at it. Existing counters are resumed.
+int stats_file_open(const char *filename) {
+    struct stat st;
+    int created = 0;
+    
+    map_fd = open(filename, O_RDWR | O_CREAT, 0644);
+    if (map_fd < 0) {
+        perror("open");
+        return -1;
+    }
+    
+    // One writer per file; readers never take the lock
+    if (flock(map_fd, LOCK_EX | LOCK_NB) != 0) {
+        fprintf(stderr, "%s: in use by another Zim process\n", filename);
+        stats_file_close();
+        return -1;
+    }
+    
+    if (fstat(map_fd, &st) != 0) {
+        perror("fstat");
+        stats_file_close();
+        return -1;
+    }
+    
+    if (st.st_size == 0) {
+        if (ftruncate(map_fd, sizeof(StatsFile)) != 0) {
+            perror("ftruncate");
+            stats_file_close();
+            return -1;
+        }
+        created = 1;
+    } else if ((size_t)st.st_size != sizeof(StatsFile)) {
+        fprintf(stderr, "%s: not a statistics file for this version of Zim\n", filename);
+        stats_file_close();
+        return -1;
+    }
+    
+    mapped = mmap(NULL, sizeof(StatsFile), PROT_READ | PROT_WRITE, MAP_SHARED, map_fd, 0);
+    if (mapped == MAP_FAILED) {
+        perror("mmap");
+        mapped = NULL;
+        stats_file_close();
+        return -1;
+    }
+    
+    if (created) {
+        mapped->header.version = STATS_FILE_VERSION;
+        mapped->header.stats_size = sizeof(PacketStats);
+        mapped->header.series_minutes = STATS_SERIES_MINUTES;
+        mapped->header.created = time(NULL);
+        atomic_store(&mapped->header.sequence, 0);
+        // Readers ignore the file until the magic is in place
+        atomic_thread_fence(memory_order_release);
+        mapped->header.magic = STATS_FILE_MAGIC;
+    } else if (mapped->header.magic != STATS_FILE_MAGIC ||
+               mapped->header.version != STATS_FILE_VERSION ||
+               mapped->header.stats_size != sizeof(PacketStats) ||
+               mapped->header.series_minutes != STATS_SERIES_MINUTES) {
+        fprintf(stderr, "%s: not a statistics file for this version of Zim\n", filename);
+        stats_file_close();
+        return -1;
+    }
+    
+    // An odd count means a previous writer died mid-snapshot
+    uint64_t sequence = atomic_load(&mapped->header.sequence);
+    atomic_store(&mapped->header.sequence, sequence + (sequence & 1));
+    
+    stats = &mapped->live;
+    write_snapshot();
+    
+    return 0;
+}
+
+// Publish the final snapshot and write everything back. The file must
+// be closed after the last use of the global statistics.
+void stats_file_close(void) {
+    if (mapped != NULL) {
+        write_snapshot();
+        msync(mapped, sizeof(StatsFile), MS_SYNC);
+        munmap(mapped, sizeof(StatsFile));
+        mapped = NULL;
+    }
+    if (map_fd >= 0) {
+        close(map_fd);
+        map_fd = -1;
+    }
+}
+
+// Called from the main loop; snapshots at most every STATS_PUBLISH_MSEC
+void stats_file_publish(void) {
+    struct timespec now;
+    
+    if (mapped == NULL) {
+        return;
+    }
+    
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if ((now.tv_sec - last_publish.tv_sec) * 1000 +
+        (now.tv_nsec - last_publish.tv_nsec) / 1000000 < STATS_PUBLISH_MSEC) {
+        return;
+    }
+    last_publish = now;
+    
+    write_snapshot();
+}
+
+// Reader side: copy the snapshot and retry if a writer got in between
+static int read_snapshot(StatsFile *file, PacketStats *snapshot, StatsSample *series,
+                         uint64_t *published) {
+    struct timespec pause = {0, 1000000};  // 1ms
+    
+    for (int tries = 0; tries < STATS_READ_RETRIES; tries++) {
+        uint64_t before = atomic_load_explicit(&file->header.sequence, memory_order_acquire);
+        
+        if (before & 1) {
+            nanosleep(&pause, NULL);
+            continue;
+        }
+        
+        memcpy(snapshot, &file->snapshot, sizeof(PacketStats));
+        memcpy(series, file->series, sizeof(file->series));
+        *published = file->header.published;
+        
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&file->header.sequence, memory_order_relaxed) == before) {
+            return 0;
+        }
+    }
+    
+    return -1;
+}
+
+static void print_stats_usage(void) {
+    printf("Usage: zim stats <file> [options]\n");
+    printf("<file> is a statistics file written with -P (safe to read while Zim runs)\n");
+    printf("Options:\n");
+    printf("  -m <minutes>    Show the last <minutes> of per-minute totals (default: %d)\n",
+           STATS_DEFAULT_MINUTES);
+}
+
+static void print_snapshot(const PacketStats *snapshot) {
+    char bytes_str[32];
+    const unsigned long *counts[] = {&snapshot->tcp_packets, &snapshot->udp_packets,
+                                     &snapshot->icmp_packets, &snapshot->other_packets};
+    static const char *names[STATS_CLASSES] = {"TCP", "UDP", "ICMP", "Other"};
+    
+    format_bytes(snapshot->total_bytes, bytes_str, sizeof(bytes_str));
+    printf("Packets: %lu  Bytes: %s  Dropped: %lu\n", snapshot->total_packets, bytes_str,
+           snapshot->dropped_packets);
+    printf("Unique sources: %.0f  destinations: %.0f  flows: %.0f (estimated)\n",
+           hll_estimate(snapshot->unique_sources, STATS_HLL_PRECISION),
+           hll_estimate(snapshot->unique_destinations, STATS_HLL_PRECISION),
+           hll_estimate(snapshot->unique_flows, STATS_HLL_PRECISION));
+    
+    printf("\n%-12s %12s %7s %6s %6s %6s %6s\n", "Protocol", "Packets", "Share", "p50", "p90", "p99", "max");
+    for (int i = 0; i < STATS_CLASSES; i++) {
+        const LogHistogram *sizes = &snapshot->sizes[i];
+        printf("%-12s %12lu %6.1f%% %6lu %6lu %6lu %6lu\n", names[i], *counts[i],
+               snapshot->total_packets > 0 ? *counts[i] * 100.0 / snapshot->total_packets : 0,
+               loghist_percentile(sizes, 50), loghist_percentile(sizes, 90),
+               loghist_percentile(sizes, 99), sizes->max);
+    }
+    
+    if (snapshot->interface_count > 0) {
+        printf("\n%-12s %12s %14s %10s %8s\n", "Interface", "Packets", "Bytes", "Dropped", "Errors");
+        for (int i = 0; i < snapshot->interface_count && i < MAX_INTERFACES; i++) {
+            printf("%-12s %12lu %14lu %10lu %8lu\n", snapshot->interfaces[i].name,
+                   snapshot->interfaces[i].packets, snapshot->interfaces[i].bytes,
+                   snapshot->interfaces[i].dropped, snapshot->interfaces[i].errors);
+        }
+    }
+    
+    int tunneled = 0;
+    for (int i = 1; i < TUNNEL_TYPES; i++) {
+        if (snapshot->tunnel_packets[i] == 0) {
+            continue;
+        }
+        if (!tunneled++) {
+            printf("\n%-12s %12s %14s\n", "Tunnel", "Packets", "Bytes");
+        }
+        printf("%-12s %12lu %14lu\n", tunnel_name(i), snapshot->tunnel_packets[i],
+               snapshot->tunnel_bytes[i]);
+    }
+    
+    // Top sources, largest first
+    int order[STATS_TOP_SOURCES], shown = 0;
+    for (int i = 0; i < STATS_TOP_SOURCES; i++) {
+        if (snapshot->top_sources[i].ip[0] != '\0') {
+            int j = shown++;
+            while (j > 0 && snapshot->top_sources[order[j - 1]].count < snapshot->top_sources[i].count) {
+                order[j] = order[j - 1];
+                j--;
+            }
+            order[j] = i;
+        }
+    }
+    if (shown > 0) {
+        printf("\n%-16s %12s\n", "Top Sources", "Packets");
+        for (int i = 0; i < shown; i++) {
+            printf("%-16.*s %12lu\n", MAX_ADDR_STR_LEN, snapshot->top_sources[order[i]].ip,
+                   snapshot->top_sources[order[i]].count);
+        }
+    }
+}
+
+// Per-minute rates from the cumulative samples
+static void print_series(const StatsSample *series, uint64_t published, int minutes) {
+    uint64_t last = published / 60;
+    
+    printf("\n%-8s %12s %14s %10s %10s\n", "Minute", "Packets", "Bytes", "Dropped", "Pkts/s");
+    for (uint64_t minute = last - minutes + 1; minute <= last; minute++) {
+        const StatsSample *sample = &series[minute % STATS_SERIES_MINUTES];
+        const StatsSample *previous = &series[(minute - 1) % STATS_SERIES_MINUTES];
+        time_t start = minute * 60;
+        char time_str[16];
+        
+        if (sample->minute != minute) {
+            continue;
+        }
+        
+        // The first sample after a gap has no baseline; show its totals
+        uint64_t packets = sample->packets, bytes = sample->bytes, dropped = sample->dropped;
+        if (previous->minute == minute - 1 && previous->packets <= packets) {
+            packets -= previous->packets;
+            bytes -= previous->bytes;
+            dropped -= previous->dropped;
+        }
+        
+        strftime(time_str, sizeof(time_str), "%H:%M", localtime(&start));
+        printf("%-8s %12lu %14lu %10lu %10.1f\n", time_str, (unsigned long)packets,
+               (unsigned long)bytes, (unsigned long)dropped, packets / 60.0);
+    }
+}
+
+// "zim stats <file>": print a snapshot without disturbing the writer
+int stats_file_main(int argc, char *argv[]) {
+    int opt;
+    int minutes = STATS_DEFAULT_MINUTES;
+    
+    optind = 1;
+    while ((opt = getopt(argc, argv, "m:h")) != -1) {
+        switch (opt) {
+            case 'm':
+                minutes = atoi(optarg);
+                break;
+            case 'h':
+                print_stats_usage();
+                return 0;
+            default:
+                print_stats_usage();
+                return 1;
+        }
+    }
+    
+    if (optind >= argc) {
+        print_stats_usage();
+        return 1;
+    }
+    if (minutes < 0) {
+        minutes = 0;
+    } else if (minutes > STATS_SERIES_MINUTES) {
+        minutes = STATS_SERIES_MINUTES;
+    }
+    
+    const char *filename = argv[optind];
+    int fd = open(filename, O_RDONLY);
+    struct stat st;
+    
+    if (fd < 0) {
+        perror(filename);
+        return 1;
+    }
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size != sizeof(StatsFile)) {
+        fprintf(stderr, "%s: not a statistics file for this version of Zim\n", filename);
+        close(fd);
+        return 1;
+    }
+    
+    StatsFile *file = mmap(NULL, sizeof(StatsFile), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (file == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+    
+    if (file->header.magic != STATS_FILE_MAGIC || file->header.version != STATS_FILE_VERSION ||
+        file->header.stats_size != sizeof(PacketStats)) {
+        fprintf(stderr, "%s: not a statistics file for this version of Zim\n", filename);
+        munmap(file, sizeof(StatsFile));
+        return 1;
+    }
+    
+    PacketStats *snapshot = malloc(sizeof(PacketStats));
+    StatsSample *series = malloc(sizeof(file->series));
+    uint64_t published = 0;
+    int result = 1;
+    
+    if (snapshot == NULL || series == NULL) {
+        perror("malloc");
+    } else if (read_snapshot(file, snapshot, series, &published) != 0) {
+        fprintf(stderr, "%s: could not get a consistent snapshot\n", filename);
+    } else {
+        time_t created = file->header.created, updated = published;
+        char created_str[32], updated_str[32];
+        
+        strftime(created_str, sizeof(created_str), "%Y-%m-%d %H:%M:%S", localtime(&created));
+        strftime(updated_str, sizeof(updated_str), "%Y-%m-%d %H:%M:%S", localtime(&updated));
+        printf("Statistics file: %s\n", filename);
+        printf("Created: %s  Updated: %s\n\n", created_str, updated_str);
+        
+        print_snapshot(snapshot);
+        if (minutes > 0) {
+            print_series(series, published, minutes);
+        }
+        result = 0;
+    }
+    
+    free(snapshot);
+    free(series);
+    munmap(file, sizeof(StatsFile));
+    return result;
+}
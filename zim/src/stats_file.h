@@ -0,0 +1,54 @@
+#ifndef ZIM_STATS_FILE_H
+#define ZIM_STATS_FILE_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include "packet_parser.h"
+
+// Persistent statistics. With -P the live PacketStats is placed in a
+// memory-mapped file and updated in place, so counters, top sources and
+// sketches survive restarts. Other processes read the file read-only:
+// the capture thread periodically copies the live block into a snapshot
+// guarded by a sequence lock, which readers copy and validate without
+// ever blocking the writer.
+//
+//   StatsFileHeader | PacketStats live | PacketStats snapshot |
+//   StatsSample x STATS_SERIES_MINUTES
+#define STATS_FILE_MAGIC 0x534d495a  // "ZIMS"
+#define STATS_FILE_VERSION 3
+#define STATS_SERIES_MINUTES 1440    // One day of per-minute samples
+#define STATS_PUBLISH_MSEC 100       // Snapshot interval
+#define STATS_SYNC_SEC 5             // msync interval
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t stats_size;       // sizeof(PacketStats), guards layout changes
+    uint32_t series_minutes;
+    uint64_t created;          // Seconds since the epoch
+    uint64_t published;        // Time of the latest snapshot
+    _Atomic uint64_t sequence; // Odd while the snapshot is being written
+} StatsFileHeader;
+
+// Cumulative totals at the end of a minute; rates come from differences
+typedef struct {
+    uint64_t minute;  // Minutes since the epoch, 0 if unused
+    uint64_t packets;
+    uint64_t bytes;
+    uint64_t dropped;
+} StatsSample;
+
+typedef struct {
+    StatsFileHeader header;
+    PacketStats live;
+    PacketStats snapshot;
+    StatsSample series[STATS_SERIES_MINUTES];
+} StatsFile;
+
+// Function prototypes
+int stats_file_open(const char *filename);
+void stats_file_close(void);
+void stats_file_publish(void);
+int stats_file_main(int argc, char *argv[]);
+
+#endif // ZIM_STATS_FILE_H
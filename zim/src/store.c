@@ -0,0 +1,457 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "store.h"
+#include "io_writer.h"
+#include "config.h"
+
+// Decoding reads whole 64-bit words, so keep slack past the data
+#define STORE_READ_SLACK 8
+
+// Writer state
+static IoWriter *store_file = NULL;
+static uint64_t *rows[STORE_COLUMNS];
+static uint32_t row_count = 0;
+static uint64_t file_offset = 0;
+static unsigned char *encode_buffer = NULL;
+static StoreIndexEntry *index_entries = NULL;
+static uint32_t index_count = 0;
+static uint32_t index_capacity = 0;
+static int index_lost = 0;  // An entry could not be kept; no footer is written
+
+static int bit_width(uint64_t value) {
+    int width = 0;
+    while (value != 0) {
+        width++;
+        value >>= 1;
+    }
+    return width;
+}
+
+static uint64_t zigzag(int64_t value) {
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static int64_t unzigzag(uint64_t value) {
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+// Append values as a little-endian bit stream of fixed width
+static uint32_t pack_bits(const uint64_t *values, uint32_t count, int width, unsigned char *out) {
+    uint64_t acc = 0;
+    int bits = 0;
+    uint32_t pos = 0;
+    
+    if (width == 0) {
+        return 0;
+    }
+    
+    for (uint32_t i = 0; i < count; i++) {
+        uint64_t value = values[i];
+        int remaining = width;
+        
+        while (remaining > 0) {
+            int take = 64 - bits < remaining ? 64 - bits : remaining;
+            uint64_t part = take == 64 ? value : (value & ((1ULL << take) - 1));
+            
+            acc |= part << bits;
+            bits += take;
+            value = take == 64 ? 0 : value >> take;
+            remaining -= take;
+            
+            if (bits == 64) {
+                for (int b = 0; b < 8; b++) {
+                    out[pos++] = acc >> (b * 8);
+                }
+                acc = 0;
+                bits = 0;
+            }
+        }
+    }
+    
+    for (int b = 0; b < bits; b += 8) {
+        out[pos++] = acc >> b;
+    }
+    
+    return pos;
+}
+
+static void unpack_bits(const unsigned char *in, uint32_t count, int width, uint64_t *values) {
+    uint64_t mask = width == 64 ? ~0ULL : (1ULL << width) - 1;
+    uint64_t bit = 0;
+    
+    if (width == 0) {
+        memset(values, 0, count * sizeof(uint64_t));
+        return;
+    }
+    
+    for (uint32_t i = 0; i < count; i++, bit += width) {
+        uint64_t word;
+        int shift = bit & 7;
+        
+        memcpy(&word, in + (bit >> 3), sizeof(word));
+        uint64_t value = word >> shift;
+        
+        // Values straddling more than eight bytes need the ninth
+        if (width + shift > 64) {
+            value |= (uint64_t)in[(bit >> 3) + 8] << (64 - shift);
+        }
+        
+        values[i] = value & mask;
+    }
+}
+
+static void flush_chunk(void) {
+    StoreChunkHeader header;
+    uint32_t data_size = 0;
+    
+    if (store_file == NULL || row_count == 0) {
+        return;
+    }
+    
+    memset(&header, 0, sizeof(header));
+    header.magic = STORE_CHUNK_MAGIC;
+    header.rows = row_count;
+    
+    for (int c = 0; c < STORE_COLUMNS; c++) {
+        StoreColumnInfo *info = &header.columns[c];
+        uint64_t *values = rows[c];
+        uint64_t min = values[0], max = values[0];
+        
+        for (uint32_t i = 1; i < row_count; i++) {
+            if (values[i] < min) min = values[i];
+            if (values[i] > max) max = values[i];
+        }
+        info->min = min;
+        info->max = max;
+        
+        // Timestamps are near-sorted: encode the gap to the previous row.
+        // Rewriting in place is fine, the rows are discarded after this.
+        if (c == STORE_COL_TIME) {
+            uint64_t previous = min, widest = 0;
+            for (uint32_t i = 0; i < row_count; i++) {
+                uint64_t current = values[i];
+                values[i] = zigzag((int64_t)(current - previous));
+                if (values[i] > widest) widest = values[i];
+                previous = current;
+            }
+            info->encoding = STORE_ENC_DELTA;
+            info->width = bit_width(widest);
+        } else {
+            for (uint32_t i = 0; i < row_count; i++) {
+                values[i] -= min;
+            }
+            info->encoding = STORE_ENC_FOR;
+            info->width = bit_width(max - min);
+        }
+        
+        info->size = pack_bits(values, row_count, info->width, encode_buffer + data_size);
+        data_size += info->size;
+    }
+    
+    header.data_size = data_size;
+    
+    io_writer_write(store_file, &header, sizeof(header));
+    io_writer_write(store_file, encode_buffer, data_size);
+    
+    // Remember the chunk for the footer index. A footer missing a chunk
+    // would hide its rows from queries, so if the index cannot grow the
+    // store is closed without one and readers walk the chunks instead.
+    if (!index_lost && index_count == index_capacity) {
+        uint32_t capacity = index_capacity ? index_capacity * 2 : 64;
+        StoreIndexEntry *grown = realloc(index_entries, capacity * sizeof(StoreIndexEntry));
+        if (grown != NULL) {
+            index_entries = grown;
+            index_capacity = capacity;
+        } else {
+            perror("realloc");
+            fprintf(stderr, "Record store index dropped; queries will scan every chunk\n");
+            index_lost = 1;
+        }
+    }
+    if (!index_lost) {
+        StoreIndexEntry *entry = &index_entries[index_count++];
+        memset(entry, 0, sizeof(*entry));
+        entry->offset = file_offset;
+        entry->min_time = header.columns[STORE_COL_TIME].min;
+        entry->max_time = header.columns[STORE_COL_TIME].max;
+        entry->rows = row_count;
+    }
+    
+    file_offset += sizeof(header) + data_size;
+    row_count = 0;
+}
+
+int store_writer_init(const char *filename) {
+    StoreFileHeader header;
+    
+    for (int c = 0; c < STORE_COLUMNS; c++) {
+        rows[c] = malloc(STORE_CHUNK_ROWS * sizeof(uint64_t));
+        if (rows[c] == NULL) {
+            perror("malloc");
+            store_writer_cleanup();
+            return -1;
+        }
+    }
+    
+    // Worst case every column is 64 bits wide
+    encode_buffer = malloc(STORE_COLUMNS * STORE_CHUNK_ROWS * sizeof(uint64_t));
+    if (encode_buffer == NULL) {
+        perror("malloc");
+        store_writer_cleanup();
+        return -1;
+    }
+    
+    store_file = io_writer_open(filename, config.direct_io ? IO_WRITER_DIRECT : 0,
+                                config.compression);
+    if (store_file == NULL) {
+        store_writer_cleanup();
+        return -1;
+    }
+    
+    memset(&header, 0, sizeof(header));
+    header.magic = STORE_MAGIC;
+    header.version = STORE_VERSION;
+    header.columns = STORE_COLUMNS;
+    header.chunk_rows = STORE_CHUNK_ROWS;
+    io_writer_write(store_file, &header, sizeof(header));
+    file_offset = sizeof(header);
+    
+    return 0;
+}
+
+void store_writer_cleanup(void) {
+    if (store_file != NULL) {
+        StoreFooter footer;
+        
+        flush_chunk();
+        
+        if (!index_lost) {
+            footer.count = index_count;
+            footer.magic = STORE_FOOTER_MAGIC;
+            io_writer_write(store_file, index_entries, index_count * sizeof(StoreIndexEntry));
+            io_writer_write(store_file, &footer, sizeof(footer));
+        }
+        
+        io_writer_close(store_file);
+        store_file = NULL;
+    }
+    
+    for (int c = 0; c < STORE_COLUMNS; c++) {
+        free(rows[c]);
+        rows[c] = NULL;
+    }
+    free(encode_buffer);
+    encode_buffer = NULL;
+    free(index_entries);
+    index_entries = NULL;
+    index_count = index_capacity = 0;
+    index_lost = 0;
+    row_count = 0;
+}
+
+// Chunks are written in large batches; this pushes out a partial one
+void store_writer_flush(void) {
+    if (store_file != NULL) {
+        io_writer_flush(store_file);
+    }
+}
+
+void store_writer_write_packet(Packet *packet) {
+    if (store_file == NULL) {
+        return;
+    }
+    
+    rows[STORE_COL_TIME][row_count] = (uint64_t)packet->timestamp.tv_sec * 1000000 +
+                                      packet->timestamp.tv_usec;
+    rows[STORE_COL_SRC_ADDR][row_count] = packet->src_addr;
+    rows[STORE_COL_DST_ADDR][row_count] = packet->dst_addr;
+    rows[STORE_COL_SRC_PORT][row_count] = packet->src_port;
+    rows[STORE_COL_DST_PORT][row_count] = packet->dst_port;
+    rows[STORE_COL_PROTO][row_count] = packet->protocol;
+    rows[STORE_COL_SIZE][row_count] = packet->size;
+    rows[STORE_COL_RATE][row_count] = packet->sample_rate;
+    
+    if (++row_count == STORE_CHUNK_ROWS) {
+        flush_chunk();
+    }
+}
+
+// Rebuild the index from chunk headers when the footer is missing
+static int store_scan_chunks(StoreReader *reader, uint64_t file_size) {
+    uint32_t capacity = 0;
+    uint64_t offset = sizeof(StoreFileHeader);
+    StoreChunkHeader header;
+    
+    while (offset + sizeof(header) <= file_size) {
+        if (io_reader_pread(reader->file, &header, sizeof(header), offset) != sizeof(header) ||
+            header.magic != STORE_CHUNK_MAGIC ||
+            offset + sizeof(header) + header.data_size > file_size) {
+            break;
+        }
+        
+        if (reader->chunk_count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            StoreIndexEntry *grown = realloc(reader->index, capacity * sizeof(StoreIndexEntry));
+            if (grown == NULL) {
+                perror("realloc");
+                return -1;
+            }
+            reader->index = grown;
+        }
+        
+        StoreIndexEntry *entry = &reader->index[reader->chunk_count++];
+        memset(entry, 0, sizeof(*entry));
+        entry->offset = offset;
+        entry->min_time = header.columns[STORE_COL_TIME].min;
+        entry->max_time = header.columns[STORE_COL_TIME].max;
+        entry->rows = header.rows;
+        
+        offset += sizeof(header) + header.data_size;
+    }
+    
+    return 0;
+}
+
+int store_open(const char *filename, StoreReader *reader) {
+    StoreFileHeader header;
+    StoreFooter footer;
+    
+    memset(reader, 0, sizeof(*reader));
+    
+    reader->file = io_reader_open(filename);
+    if (reader->file == NULL) {
+        return -1;
+    }
+    uint64_t file_size = io_reader_size(reader->file);
+    
+    if (io_reader_pread(reader->file, &header, sizeof(header), 0) != sizeof(header) ||
+        header.magic != STORE_MAGIC || header.version != STORE_VERSION ||
+        header.columns != STORE_COLUMNS) {
+        fprintf(stderr, "%s: not a Zim record store\n", filename);
+        store_close(reader);
+        return -1;
+    }
+    
+    // Prefer the footer index; fall back to walking the chunks
+    uint64_t footer_offset = file_size - sizeof(footer);
+    if (file_size > sizeof(header) + sizeof(footer) &&
+        io_reader_pread(reader->file, &footer, sizeof(footer), footer_offset) == sizeof(footer) &&
+        footer.magic == STORE_FOOTER_MAGIC &&
+        (uint64_t)footer.count * sizeof(StoreIndexEntry) <= footer_offset) {
+        reader->chunk_count = footer.count;
+        if (footer.count == 0) {
+            return 0;
+        }
+        reader->index = malloc(footer.count * sizeof(StoreIndexEntry));
+        if (reader->index == NULL ||
+            io_reader_pread(reader->file, reader->index, footer.count * sizeof(StoreIndexEntry),
+                            footer_offset - footer.count * sizeof(StoreIndexEntry)) !=
+            (ssize_t)(footer.count * sizeof(StoreIndexEntry))) {
+            fprintf(stderr, "%s: corrupt index\n", filename);
+            store_close(reader);
+            return -1;
+        }
+        return 0;
+    }
+    
+    if (store_scan_chunks(reader, file_size) != 0) {
+        store_close(reader);
+        return -1;
+    }
+    
+    return 0;
+}
+
+void store_close(StoreReader *reader) {
+    io_reader_close(reader->file);
+    reader->file = NULL;
+    free(reader->index);
+    reader->index = NULL;
+    reader->chunk_count = 0;
+}
+
+// Header only, so callers can skip a chunk on its column ranges
+int store_read_chunk_header(StoreReader *reader, uint32_t index, StoreChunkHeader *header) {
+    uint64_t offset = reader->index[index].offset;
+    
+    if (io_reader_pread(reader->file, header, sizeof(*header), offset) != sizeof(*header) ||
+        header->magic != STORE_CHUNK_MAGIC) {
+        fprintf(stderr, "Corrupt chunk at offset %lld\n", (long long)offset);
+        return -1;
+    }
+    
+    return 0;
+}
+
+int store_read_chunk(StoreReader *reader, uint32_t index, StoreChunk *chunk) {
+    StoreChunkHeader *header = &chunk->header;
+    uint64_t offset = reader->index[index].offset;
+    
+    if (store_read_chunk_header(reader, index, header) != 0) {
+        return -1;
+    }
+    
+    // Grow the per-reader buffers on demand
+    if (header->data_size + STORE_READ_SLACK > chunk->data_capacity) {
+        unsigned char *data = realloc(chunk->data, header->data_size + STORE_READ_SLACK);
+        if (data == NULL) {
+            perror("realloc");
+            return -1;
+        }
+        chunk->data = data;
+        chunk->data_capacity = header->data_size + STORE_READ_SLACK;
+    }
+    if (header->rows > chunk->capacity) {
+        for (int c = 0; c < STORE_COLUMNS; c++) {
+            uint64_t *column = realloc(chunk->columns[c], header->rows * sizeof(uint64_t));
+            if (column == NULL) {
+                perror("realloc");
+                return -1;
+            }
+            chunk->columns[c] = column;
+        }
+        chunk->capacity = header->rows;
+    }
+    
+    if (io_reader_pread(reader->file, chunk->data, header->data_size, offset + sizeof(*header)) !=
+        (ssize_t)header->data_size) {
+        fprintf(stderr, "Truncated chunk at offset %lld\n", (long long)offset);
+        return -1;
+    }
+    memset(chunk->data + header->data_size, 0, STORE_READ_SLACK);
+    
+    uint32_t position = 0;
+    for (int c = 0; c < STORE_COLUMNS; c++) {
+        StoreColumnInfo *info = &header->columns[c];
+        uint64_t *values = chunk->columns[c];
+        
+        unpack_bits(chunk->data + position, header->rows, info->width, values);
+        position += info->size;
+        
+        if (info->encoding == STORE_ENC_DELTA) {
+            uint64_t previous = info->min;
+            for (uint32_t i = 0; i < header->rows; i++) {
+                previous += unzigzag(values[i]);
+                values[i] = previous;
+            }
+        } else {
+            for (uint32_t i = 0; i < header->rows; i++) {
+                values[i] += info->min;
+            }
+        }
+    }
+    
+    return 0;
+}
+
+void store_chunk_free(StoreChunk *chunk) {
+    for (int c = 0; c < STORE_COLUMNS; c++) {
+        free(chunk->columns[c]);
+        chunk->columns[c] = NULL;
+    }
+    free(chunk->data);
+    chunk->data = NULL;
+    chunk->capacity = 0;
+    chunk->data_capacity = 0;
+}
@@ -0,0 +1,107 @@
+#ifndef ZIM_STORE_H
+#define ZIM_STORE_H
+
+#include <stdint.h>
+#include "network.h"
+#include "io_reader.h"
+
+// Columnar record store. A file is a header, a sequence of chunks and a
+// footer index:
+//
+//   StoreFileHeader
+//   StoreChunkHeader, column 0 .. column STORE_COLUMNS-1   (repeated)
+//   StoreIndexEntry x count, StoreFooter
+//
+// Every column in a chunk is bit-packed at a fixed width relative to the
+// column minimum (frame of reference). Timestamps are stored as zigzag
+// deltas from the previous row first. A file without a footer (writer
+// killed) is still readable by walking the chunk headers. Offsets are
+// those of the uncompressed file when the store is compressed.
+#define STORE_MAGIC        0x434d495a  // "ZIMC"
+#define STORE_CHUNK_MAGIC  0x4b4e4843  // "CHNK"
+#define STORE_FOOTER_MAGIC 0x5844495a  // "ZIDX"
+#define STORE_VERSION      1
+#define STORE_CHUNK_ROWS   65536
+
+// Columns
+#define STORE_COL_TIME     0  // Microseconds since the epoch
+#define STORE_COL_SRC_ADDR 1
+#define STORE_COL_DST_ADDR 2
+#define STORE_COL_SRC_PORT 3
+#define STORE_COL_DST_PORT 4
+#define STORE_COL_PROTO    5
+#define STORE_COL_SIZE     6
+#define STORE_COL_RATE     7  // Sample rate, see sampler.h
+#define STORE_COLUMNS      8
+
+// Column encodings
+#define STORE_ENC_FOR      0  // value - min, packed at width bits
+#define STORE_ENC_DELTA    1  // zigzag(value - previous), packed at width bits
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t columns;
+    uint32_t chunk_rows;
+    uint32_t reserved;
+} StoreFileHeader;
+
+typedef struct {
+    uint64_t min;      // Smallest value, also the FOR base
+    uint64_t max;      // Largest value (chunk skipping)
+    uint32_t size;     // Encoded bytes
+    uint8_t encoding;
+    uint8_t width;     // Bits per packed value
+    uint16_t reserved;
+} StoreColumnInfo;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t rows;
+    uint32_t data_size;  // Bytes of column data after this header
+    uint32_t reserved;
+    StoreColumnInfo columns[STORE_COLUMNS];
+} StoreChunkHeader;
+
+typedef struct {
+    uint64_t offset;   // File offset of the chunk header
+    uint64_t min_time;
+    uint64_t max_time;
+    uint32_t rows;
+    uint32_t reserved;
+} StoreIndexEntry;
+
+typedef struct {
+    uint32_t count;
+    uint32_t magic;
+} StoreFooter;
+
+// Reader side; chunks may be read concurrently from several threads
+typedef struct {
+    IoReader *file;
+    StoreIndexEntry *index;
+    uint32_t chunk_count;
+} StoreReader;
+
+// A decoded chunk: one array per column
+typedef struct {
+    StoreChunkHeader header;
+    uint64_t *columns[STORE_COLUMNS];
+    uint32_t capacity;
+    unsigned char *data;
+    uint32_t data_capacity;
+} StoreChunk;
+
+// Function prototypes
+int store_writer_init(const char *filename);
+void store_writer_cleanup(void);
+void store_writer_write_packet(Packet *packet);
+void store_writer_flush(void);
+
+int store_open(const char *filename, StoreReader *reader);
+void store_close(StoreReader *reader);
+int store_read_chunk_header(StoreReader *reader, uint32_t index, StoreChunkHeader *header);
+int store_read_chunk(StoreReader *reader, uint32_t index, StoreChunk *chunk);
+void store_chunk_free(StoreChunk *chunk);
+
+#endif // ZIM_STORE_H
@@ -0,0 +1,380 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include "tcpstat.h"
+#include "config.h"
+
+// Handshake progress
+#define HANDSHAKE_NONE   0  // Joined mid-stream
+#define HANDSHAKE_SYN    1
+#define HANDSHAKE_SYNACK 2
+#define HANDSHAKE_DONE   3
+
+// Sequence state of one direction
+typedef struct {
+    uint32_t next_seq;    // Highest sequence number sent, plus one
+    uint32_t timed_seq;   // End of the segment being timed
+    uint64_t timed_usec;  // When it was seen, 0 if none is being timed
+    uint64_t high_usec;   // When next_seq last advanced
+    uint8_t seq_valid;
+    uint8_t zero_window;  // Window currently closed
+} TcpDirection;
+
+typedef struct {
+    unsigned int client_addr;
+    unsigned int server_addr;
+    unsigned short client_port;
+    unsigned short server_port;
+    unsigned int tunnel_id;
+    uint8_t used;
+    uint8_t handshake;
+    uint32_t client_isn;
+    uint32_t server_isn;
+    uint64_t syn_usec;    // 0 once a SYN or SYN-ACK was resent (ambiguous)
+    uint64_t last_usec;
+    TcpDirection dir[2];  // 0 client to server, 1 server to client
+} TcpConnection;
+
+static TcpConnection *connections = NULL;
+static TcpServerStats *servers = NULL;
+static TcpServerStats total;
+static unsigned long tracked = 0;
+
+int tcpstat_init(void) {
+    connections = calloc(TCPSTAT_SETS * TCPSTAT_WAYS, sizeof(TcpConnection));
+    servers = calloc(TCPSTAT_SERVER_SETS * TCPSTAT_SERVER_WAYS, sizeof(TcpServerStats));
+    if (connections == NULL || servers == NULL) {
+        perror("calloc");
+        tcpstat_cleanup();
+        return -1;
+    }
+    
+    memset(&total, 0, sizeof(total));
+    tracked = 0;
+    return 0;
+}
+
+void tcpstat_cleanup(void) {
+    free(connections);
+    connections = NULL;
+    free(servers);
+    servers = NULL;
+}
+
+static int seq_before(uint32_t a, uint32_t b) {
+    return (int32_t)(a - b) < 0;
+}
+
+// Both directions of a connection hash to the same set
+static uint32_t connection_set(unsigned int src_addr, unsigned short src_port,
+                               unsigned int dst_addr, unsigned short dst_port,
+                               unsigned int tunnel_id) {
+    uint64_t src = ((uint64_t)src_addr << 16) | src_port;
+    uint64_t dst = ((uint64_t)dst_addr << 16) | dst_port;
+    uint64_t low = src < dst ? src : dst, high = src < dst ? dst : src;
+    
+    return sketch_hash(low ^ sketch_hash(high ^ tunnel_id)) % TCPSTAT_SETS;
+}
+
+// Find the packet's connection and its direction. Otherwise returns NULL
+// with *victim set to the way a new connection should take.
+static TcpConnection *lookup(const Packet *packet, uint64_t now, int *direction,
+                             TcpConnection **victim) {
+    uint32_t set = connection_set(packet->src_addr, packet->src_port, packet->dst_addr,
+                                  packet->dst_port, packet->tunnel_id);
+    TcpConnection *ways = &connections[set * TCPSTAT_WAYS];
+    
+    *victim = &ways[0];
+    for (int i = 0; i < TCPSTAT_WAYS; i++) {
+        TcpConnection *entry = &ways[i];
+        
+        if (entry->used && now - entry->last_usec > TCPSTAT_IDLE_USEC) {
+            entry->used = 0;
+            tracked--;
+        }
+        if (!entry->used) {
+            if ((*victim)->used) {
+                *victim = entry;
+            }
+            continue;
+        }
+        if (entry->tunnel_id == packet->tunnel_id) {
+            if (entry->client_addr == packet->src_addr && entry->client_port == packet->src_port &&
+                entry->server_addr == packet->dst_addr && entry->server_port == packet->dst_port) {
+                *direction = 0;
+                return entry;
+            }
+            if (entry->client_addr == packet->dst_addr && entry->client_port == packet->dst_port &&
+                entry->server_addr == packet->src_addr && entry->server_port == packet->src_port) {
+                *direction = 1;
+                return entry;
+            }
+        }
+        if ((*victim)->used && entry->last_usec < (*victim)->last_usec) {
+            *victim = entry;
+        }
+    }
+    
+    return NULL;
+}
+
+// Start tracking a connection in entry, from_client telling which way
+// the packet goes
+static TcpConnection *claim(TcpConnection *entry, const Packet *packet, int from_client) {
+    if (!entry->used) {
+        tracked++;
+    }
+    memset(entry, 0, sizeof(*entry));
+    entry->used = 1;
+    entry->tunnel_id = packet->tunnel_id;
+    if (from_client) {
+        entry->client_addr = packet->src_addr;
+        entry->client_port = packet->src_port;
+        entry->server_addr = packet->dst_addr;
+        entry->server_port = packet->dst_port;
+    } else {
+        entry->client_addr = packet->dst_addr;
+        entry->client_port = packet->dst_port;
+        entry->server_addr = packet->src_addr;
+        entry->server_port = packet->src_port;
+    }
+    
+    return entry;
+}
+
+static TcpServerStats *server_stats(unsigned int addr, unsigned short port, uint64_t now) {
+    uint32_t set = sketch_hash(((uint64_t)addr << 16) | port) % TCPSTAT_SERVER_SETS;
+    TcpServerStats *ways = &servers[set * TCPSTAT_SERVER_WAYS];
+    TcpServerStats *victim = &ways[0];
+    
+    for (int i = 0; i < TCPSTAT_SERVER_WAYS; i++) {
+        if (ways[i].used && ways[i].addr == addr && ways[i].port == port) {
+            ways[i].last_usec = now;
+            return &ways[i];
+        }
+        if (!ways[i].used) {
+            if (victim->used) {
+                victim = &ways[i];
+            }
+        } else if (victim->used && ways[i].last_usec < victim->last_usec) {
+            victim = &ways[i];
+        }
+    }
+    
+    memset(victim, 0, sizeof(*victim));
+    victim->used = 1;
+    victim->addr = addr;
+    victim->port = port;
+    victim->last_usec = now;
+    return victim;
+}
+
+static void account(TcpServerStats *server, const Packet *packet) {
+    unsigned int events = packet->tcp_events;
+    
+    server->packets++;
+    if (events & TCP_EVENT_RETRANSMIT) {
+        server->retransmits++;
+    }
+    if (events & TCP_EVENT_OUT_OF_ORDER) {
+        server->out_of_order++;
+    }
+    if (events & TCP_EVENT_ZERO_WINDOW) {
+        server->zero_windows++;
+    }
+    if (events & TCP_EVENT_HANDSHAKE) {
+        server->handshakes++;
+    }
+    if (events & TCP_EVENT_RTT) {
+        loghist_add(events & TCP_EVENT_HANDSHAKE ? &server->handshake_rtt : &server->data_rtt,
+                    packet->rtt_usec / TCPSTAT_RTT_UNIT_USEC);
+    }
+}
+
+static void rtt_sample(Packet *packet, uint64_t from, uint64_t now) {
+    packet->tcp_events |= TCP_EVENT_RTT;
+    packet->rtt_usec = now - from;
+}
+
+// SYN and SYN-ACK: set up or restart the connection. A resent SYN or
+// SYN-ACK makes the handshake RTT ambiguous, so none is taken.
+static TcpConnection *handshake(Packet *packet, TcpConnection *conn, TcpConnection *victim,
+                                int *direction, uint32_t seq) {
+    struct tcphdr *tcp = packet->tcp_header;
+    
+    if (!tcp->ack) {
+        if (conn != NULL && *direction == 0 && conn->handshake == HANDSHAKE_SYN &&
+            seq == conn->client_isn) {
+            packet->tcp_events |= TCP_EVENT_RETRANSMIT;
+            conn->syn_usec = 0;
+            return conn;
+        }
+        
+        // New connection, or a port reused
+        conn = claim(conn != NULL ? conn : victim, packet, 1);
+        *direction = 0;
+        conn->handshake = HANDSHAKE_SYN;
+        conn->client_isn = seq;
+        conn->syn_usec = packet->timestamp.tv_sec * 1000000ULL + packet->timestamp.tv_usec;
+        conn->dir[0].next_seq = seq + 1;
+        conn->dir[0].seq_valid = 1;
+        return conn;
+    }
+    
+    if (conn == NULL || *direction != 1) {
+        conn = claim(conn != NULL ? conn : victim, packet, 0);
+        *direction = 1;
+    }
+    if (conn->handshake == HANDSHAKE_SYNACK && seq == conn->server_isn) {
+        packet->tcp_events |= TCP_EVENT_RETRANSMIT;
+        conn->syn_usec = 0;
+    } else if (conn->handshake == HANDSHAKE_SYN) {
+        conn->handshake = HANDSHAKE_SYNACK;
+        conn->server_isn = seq;
+    }
+    conn->dir[1].next_seq = seq + 1;
+    conn->dir[1].seq_valid = 1;
+    return conn;
+}
+
+// Sequence tracking of the sending direction
+static void track_data(Packet *packet, TcpDirection *out, uint32_t seq, unsigned int length,
+                       uint64_t now) {
+    uint32_t end = seq + length;
+    
+    if (!out->seq_valid || !seq_before(seq, out->next_seq)) {
+        out->next_seq = end;
+        out->seq_valid = 1;
+        out->high_usec = now;
+        if (out->timed_usec == 0) {
+            out->timed_seq = end;
+            out->timed_usec = now;
+        }
+        return;
+    }
+    
+    // Keepalives resend the last byte
+    if (length <= 1 && end == out->next_seq) {
+        return;
+    }
+    
+    if (now - out->high_usec < TCPSTAT_REORDER_USEC) {
+        packet->tcp_events |= TCP_EVENT_OUT_OF_ORDER;
+    } else {
+        packet->tcp_events |= TCP_EVENT_RETRANSMIT;
+        out->timed_usec = 0;  // Karn: the ACK could be for either copy
+    }
+    if (seq_before(out->next_seq, end)) {
+        out->next_seq = end;
+        out->high_usec = now;
+    }
+}
+
+// Feed one parsed packet. Every TCP packet is looked at, including those
+// shed by the sampler, so RTTs and counts stay exact. The parser only
+// sets tcp_header when the whole header was captured.
+void tcpstat_packet(Packet *packet) {
+    struct tcphdr *tcp = packet->tcp_header;
+    
+    if (connections == NULL || tcp == NULL) {
+        return;
+    }
+    
+    uint64_t now = packet->timestamp.tv_sec * 1000000ULL + packet->timestamp.tv_usec;
+    uint32_t seq = ntohl(tcp->seq), ack = ntohl(tcp->ack_seq);
+    int ip_length = ntohs(packet->ip_header->tot_len);
+    
+    // Segmentation offload leaves the length of large sends at zero
+    if (ip_length == 0) {
+        ip_length = packet->size - ((unsigned char *)packet->ip_header - packet->buffer);
+    }
+    ip_length -= packet->ip_header->ihl * 4 + tcp->doff * 4;
+    unsigned int length = (ip_length > 0 ? ip_length : 0) + tcp->fin;
+    TcpConnection *victim;
+    int direction = 0;
+    TcpConnection *conn = lookup(packet, now, &direction, &victim);
+    
+    if (tcp->syn) {
+        conn = handshake(packet, conn, victim, &direction, seq);
+    } else if (conn == NULL) {
+        if (tcp->rst) {
+            return;
+        }
+        // Joined mid-stream: guess the server from the lower port
+        conn = claim(victim, packet, packet->src_port > packet->dst_port);
+        direction = packet->src_port > packet->dst_port ? 0 : 1;
+    }
+    conn->last_usec = now;
+    
+    TcpDirection *out = &conn->dir[direction], *back = &conn->dir[!direction];
+    
+    if (!tcp->syn) {
+        if (length > 0) {
+            track_data(packet, out, seq, length, now);
+        }
+        
+        // A closed window; the SYN's window is not scaled yet
+        if (tcp->window == 0 && !tcp->rst) {
+            if (!out->zero_window) {
+                out->zero_window = 1;
+                packet->tcp_events |= TCP_EVENT_ZERO_WINDOW;
+            }
+        } else {
+            out->zero_window = 0;
+        }
+    }
+    
+    if (tcp->ack) {
+        if (direction == 0 && conn->handshake == HANDSHAKE_SYNACK && !tcp->syn &&
+            ack == conn->server_isn + 1) {
+            conn->handshake = HANDSHAKE_DONE;
+            packet->tcp_events |= TCP_EVENT_HANDSHAKE;
+            if (conn->syn_usec != 0) {
+                rtt_sample(packet, conn->syn_usec, now);
+            }
+        } else if (back->timed_usec != 0 && !seq_before(ack, back->timed_seq)) {
+            rtt_sample(packet, back->timed_usec, now);
+            back->timed_usec = 0;
+        }
+    }
+    
+    account(server_stats(conn->server_addr, conn->server_port, now), packet);
+    account(&total, packet);
+    
+    if (tcp->rst) {
+        conn->used = 0;
+        tracked--;
+    }
+}
+
+// Totals and the busiest servers, by packets
+void tcpstat_snapshot(TcpStatSnapshot *snapshot) {
+    int count = 0;
+    
+    if (servers == NULL) {
+        memset(snapshot, 0, sizeof(*snapshot));
+        return;
+    }
+    
+    memcpy(&snapshot->total, &total, sizeof(total));
+    snapshot->connections = tracked;
+    
+    for (int i = 0; i < TCPSTAT_SERVER_SETS * TCPSTAT_SERVER_WAYS; i++) {
+        const TcpServerStats *server = &servers[i];
+        int j;
+        
+        if (!server->used ||
+            (count == TCPSTAT_TOP_SERVERS && server->packets <= snapshot->servers[count - 1].packets)) {
+            continue;
+        }
+        
+        j = count < TCPSTAT_TOP_SERVERS ? count++ : count - 1;
+        while (j > 0 && snapshot->servers[j - 1].packets < server->packets) {
+            memcpy(&snapshot->servers[j], &snapshot->servers[j - 1], sizeof(TcpServerStats));
+            j--;
+        }
+        memcpy(&snapshot->servers[j], server, sizeof(TcpServerStats));
+    }
+    snapshot->server_count = count;
+}
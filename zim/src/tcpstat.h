@@ -0,0 +1,70 @@
+#ifndef ZIM_TCPSTAT_H
+#define ZIM_TCPSTAT_H
+
+#include <stdint.h>
+#include "network.h"
+#include "sketch.h"
+
+// Passive TCP analytics. Connections are tracked in both directions in a
+// fixed-size, set-associative table (least recently seen evicted), with a
+// few words of sequence state per direction. Measurements:
+//
+//   handshake RTT  SYN to the ACK that completes the handshake
+//   data RTT       a data segment to the ACK covering it, one segment
+//                  in flight per direction (Karn: never a resent one)
+//   retransmits    data below the highest sequence number seen, arriving
+//                  later than TCPSTAT_REORDER_USEC after it
+//   out-of-order   the same, but sooner (reordered in the network)
+//   zero window    a receiver closing its window
+//
+// Data RTTs are measured at the capture point, so they cover the path
+// from there to the receiver and back. Results are aggregated per server
+// (address and port of the side that answered the SYN, or the lower port
+// when the handshake was missed).
+#define TCPSTAT_SETS 4096
+#define TCPSTAT_WAYS 4
+#define TCPSTAT_SERVER_SETS 128
+#define TCPSTAT_SERVER_WAYS 4
+#define TCPSTAT_TOP_SERVERS 10       // Servers in a snapshot, busiest first
+#define TCPSTAT_IDLE_USEC 120000000  // Connection state is dropped after this
+#define TCPSTAT_REORDER_USEC 3000
+
+// RTT histograms count in these units, so RTTs up to ~1.3s get buckets of their own
+#define TCPSTAT_RTT_UNIT_USEC 10
+
+// Events on a packet (Packet.tcp_events)
+#define TCP_EVENT_RETRANSMIT   0x01
+#define TCP_EVENT_OUT_OF_ORDER 0x02
+#define TCP_EVENT_ZERO_WINDOW  0x04
+#define TCP_EVENT_HANDSHAKE    0x08  // Completed a handshake
+#define TCP_EVENT_RTT          0x10  // Packet.rtt_usec holds a sample (handshake RTT
+                                     // with TCP_EVENT_HANDSHAKE, else data RTT)
+
+typedef struct {
+    unsigned int addr;  // Host byte order; 0 for the totals
+    unsigned short port;
+    unsigned char used;
+    uint64_t last_usec;
+    unsigned long packets;
+    unsigned long handshakes;
+    unsigned long retransmits;
+    unsigned long out_of_order;
+    unsigned long zero_windows;
+    LogHistogram handshake_rtt;  // TCPSTAT_RTT_UNIT_USEC units
+    LogHistogram data_rtt;
+} TcpServerStats;
+
+typedef struct {
+    TcpServerStats total;
+    int server_count;
+    TcpServerStats servers[TCPSTAT_TOP_SERVERS];
+    unsigned long connections;  // Currently tracked
+} TcpStatSnapshot;
+
+// Function prototypes
+int tcpstat_init(void);
+void tcpstat_cleanup(void);
+void tcpstat_packet(Packet *packet);
+void tcpstat_snapshot(TcpStatSnapshot *snapshot);
+
+#endif // ZIM_TCPSTAT_H
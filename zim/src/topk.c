@@ -0,0 +1,311 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "topk.h"
+#include "sketch.h"
+
+#define NOT_LISTED -1
+#define WEIGHT_REFRESH_USEC 1000  // Decay weights are shared within a millisecond
+
+typedef struct {
+    uint64_t key;
+    unsigned long packets;
+    unsigned long bytes;
+    double score;             // Forward-decayed bytes, relative to the landmark
+    uint64_t last_usec;
+    int16_t slot[TOPK_KEYS];  // Position in each heap, NOT_LISTED if outside
+    uint8_t used;
+} TopKEntry;
+
+struct TopKIndex {
+    TopKEntry *entries;
+    uint32_t sets;
+    unsigned long used;
+    uint32_t heap[TOPK_KEYS][TOPK_K];  // Min-heaps of entry numbers
+    int heap_size[TOPK_KEYS];
+    uint64_t landmark_usec;
+    uint64_t newest_usec;
+    uint64_t weight_usec;  // When weight was computed
+    double weight;         // e^(lambda * (weight_usec - landmark_usec))
+};
+
+// Decay rate per microsecond
+static double lambda(void) {
+    return M_LN2 / (TOPK_HALF_LIFE_SEC * 1000000.0);
+}
+
+TopKIndex *topk_create(unsigned int capacity) {
+    TopKIndex *index = calloc(1, sizeof(TopKIndex));
+    if (index == NULL) {
+        perror("calloc");
+        return NULL;
+    }
+    
+    index->sets = capacity / TOPK_WAYS > 0 ? capacity / TOPK_WAYS : 1;
+    index->entries = calloc((size_t)index->sets * TOPK_WAYS, sizeof(TopKEntry));
+    if (index->entries == NULL) {
+        perror("calloc");
+        free(index);
+        return NULL;
+    }
+    
+    return index;
+}
+
+void topk_free(TopKIndex *index) {
+    if (index != NULL) {
+        free(index->entries);
+        free(index);
+    }
+}
+
+static double entry_value(const TopKEntry *entry, int sort) {
+    switch (sort) {
+        case TOPK_PACKETS:
+            return entry->packets;
+        case TOPK_BYTES:
+            return entry->bytes;
+        default:
+            return entry->score;
+    }
+}
+
+static double heap_value(const TopKIndex *index, int sort, int pos) {
+    return entry_value(&index->entries[index->heap[sort][pos]], sort);
+}
+
+static void heap_set(TopKIndex *index, int sort, int pos, uint32_t entry) {
+    index->heap[sort][pos] = entry;
+    index->entries[entry].slot[sort] = pos;
+}
+
+static void sift_up(TopKIndex *index, int sort, int pos) {
+    uint32_t entry = index->heap[sort][pos];
+    double value = entry_value(&index->entries[entry], sort);
+    
+    while (pos > 0) {
+        int parent = (pos - 1) / 2;
+        if (heap_value(index, sort, parent) <= value) {
+            break;
+        }
+        heap_set(index, sort, pos, index->heap[sort][parent]);
+        pos = parent;
+    }
+    heap_set(index, sort, pos, entry);
+}
+
+static void sift_down(TopKIndex *index, int sort, int pos) {
+    uint32_t entry = index->heap[sort][pos];
+    double value = entry_value(&index->entries[entry], sort);
+    int size = index->heap_size[sort];
+    
+    for (;;) {
+        int child = pos * 2 + 1;
+        if (child >= size) {
+            break;
+        }
+        if (child + 1 < size && heap_value(index, sort, child + 1) < heap_value(index, sort, child)) {
+            child++;
+        }
+        if (value <= heap_value(index, sort, child)) {
+            break;
+        }
+        heap_set(index, sort, pos, index->heap[sort][child]);
+        pos = child;
+    }
+    heap_set(index, sort, pos, entry);
+}
+
+static void heap_remove(TopKIndex *index, int sort, int pos) {
+    int last = --index->heap_size[sort];
+    
+    index->entries[index->heap[sort][pos]].slot[sort] = NOT_LISTED;
+    if (pos != last) {
+        uint32_t moved = index->heap[sort][last];
+        
+        heap_set(index, sort, pos, moved);
+        sift_down(index, sort, pos);
+        if (index->entries[moved].slot[sort] == pos) {
+            sift_up(index, sort, pos);
+        }
+    }
+}
+
+// An entry's value only ever grows: move it down its heap, or let it in
+// when it beats the smallest listed entry
+static void heap_update(TopKIndex *index, int sort, uint32_t number) {
+    TopKEntry *entry = &index->entries[number];
+    
+    if (entry->slot[sort] != NOT_LISTED) {
+        sift_down(index, sort, entry->slot[sort]);
+    } else if (index->heap_size[sort] < TOPK_K) {
+        heap_set(index, sort, index->heap_size[sort]++, number);
+        sift_up(index, sort, index->heap_size[sort] - 1);
+    } else if (entry_value(entry, sort) > heap_value(index, sort, 0)) {
+        index->entries[index->heap[sort][0]].slot[sort] = NOT_LISTED;
+        heap_set(index, sort, 0, number);
+        sift_down(index, sort, 0);
+    }
+}
+
+static int listed(const TopKEntry *entry) {
+    for (int sort = 0; sort < TOPK_KEYS; sort++) {
+        if (entry->slot[sort] != NOT_LISTED) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Find the key's entry, or claim one: a free way, else the least recently
+// updated way that is in no top list, else the least recently updated
+static uint32_t lookup(TopKIndex *index, uint64_t key) {
+    uint32_t first = (sketch_hash(key) % index->sets) * TOPK_WAYS;
+    uint32_t victim = first;
+    int victim_rank = 3;
+    
+    for (uint32_t i = first; i < first + TOPK_WAYS; i++) {
+        TopKEntry *entry = &index->entries[i];
+        int rank;
+        
+        if (entry->used && entry->key == key) {
+            return i;
+        }
+        
+        rank = !entry->used ? 0 : listed(entry) ? 2 : 1;
+        if (rank < victim_rank ||
+            (rank == victim_rank && entry->last_usec < index->entries[victim].last_usec)) {
+            victim = i;
+            victim_rank = rank;
+        }
+    }
+    
+    TopKEntry *entry = &index->entries[victim];
+    if (entry->used) {
+        for (int sort = 0; sort < TOPK_KEYS; sort++) {
+            if (entry->slot[sort] != NOT_LISTED) {
+                heap_remove(index, sort, entry->slot[sort]);
+            }
+        }
+    } else {
+        index->used++;
+    }
+    
+    memset(entry, 0, sizeof(*entry));
+    entry->key = key;
+    entry->used = 1;
+    for (int sort = 0; sort < TOPK_KEYS; sort++) {
+        entry->slot[sort] = NOT_LISTED;
+    }
+    return victim;
+}
+
+// Move the landmark to now. Every score shrinks by the same factor, so
+// the rate heap keeps its order.
+static void rescale(TopKIndex *index, uint64_t now_usec) {
+    double factor = exp(-lambda() * (double)(now_usec - index->landmark_usec));
+    uint32_t count = index->sets * TOPK_WAYS;
+    
+    for (uint32_t i = 0; i < count; i++) {
+        index->entries[i].score *= factor;
+    }
+    index->landmark_usec = now_usec;
+    index->weight_usec = now_usec;
+    index->weight = 1.0;
+}
+
+static double weight(TopKIndex *index, uint64_t now_usec) {
+    if (now_usec >= index->weight_usec + WEIGHT_REFRESH_USEC) {
+        index->weight = exp(lambda() * (double)(now_usec - index->landmark_usec));
+        index->weight_usec = now_usec;
+    }
+    return index->weight;
+}
+
+// Count one packet of the given size against key
+void topk_add(TopKIndex *index, uint64_t key, unsigned long bytes, uint64_t now_usec) {
+    if (index->landmark_usec == 0) {
+        index->landmark_usec = now_usec;
+        index->weight_usec = now_usec;
+        index->weight = 1.0;
+    } else if (now_usec > index->landmark_usec + TOPK_RESCALE_SEC * 1000000ULL) {
+        rescale(index, now_usec);
+    }
+    if (now_usec > index->newest_usec) {
+        index->newest_usec = now_usec;
+    }
+    
+    uint32_t number = lookup(index, key);
+    TopKEntry *entry = &index->entries[number];
+    
+    entry->packets++;
+    entry->bytes += bytes;
+    entry->score += bytes * weight(index, now_usec);
+    entry->last_usec = now_usec;
+    
+    for (int sort = 0; sort < TOPK_KEYS; sort++) {
+        heap_update(index, sort, number);
+    }
+}
+
+// Add counts carried over from elsewhere, such as a resumed statistics
+// file. They rank by packets and bytes but never count towards the rate.
+void topk_seed(TopKIndex *index, uint64_t key, unsigned long packets, unsigned long bytes) {
+    uint32_t number = lookup(index, key);
+    TopKEntry *entry = &index->entries[number];
+    
+    entry->packets += packets;
+    entry->bytes += bytes;
+    heap_update(index, TOPK_PACKETS, number);
+    heap_update(index, TOPK_BYTES, number);
+}
+
+typedef struct {
+    double value;
+    uint32_t entry;
+} Ranked;
+
+static int compare_ranked(const void *a, const void *b) {
+    double x = ((const Ranked *)a)->value, y = ((const Ranked *)b)->value;
+    
+    return x < y ? 1 : x > y ? -1 : 0;
+}
+
+// The largest entries by one sort key, largest first. Returns how many
+// items were filled in.
+int topk_list(const TopKIndex *index, int sort, TopKItem *items, int max) {
+    Ranked ranked[TOPK_K];
+    int count = index->heap_size[sort];
+    double decay = exp(-lambda() * (double)(index->newest_usec - index->landmark_usec));
+    
+    for (int i = 0; i < count; i++) {
+        ranked[i].entry = index->heap[sort][i];
+        ranked[i].value = heap_value(index, sort, i);
+    }
+    qsort(ranked, count, sizeof(Ranked), compare_ranked);
+    
+    if (count > max) {
+        count = max;
+    }
+    for (int i = 0; i < count; i++) {
+        const TopKEntry *entry = &index->entries[ranked[i].entry];
+        
+        items[i].key = entry->key;
+        items[i].packets = entry->packets;
+        items[i].bytes = entry->bytes;
+        items[i].rate = entry->score * decay * lambda() * 1000000.0;
+    }
+    
+    return count;
+}
+
+unsigned long topk_entries(const TopKIndex *index) {
+    return index->used;
+}
+
+const char *topk_key_name(int sort) {
+    static const char *names[TOPK_KEYS] = {"packets", "bytes", "rate"};
+    
+    return sort >= 0 && sort < TOPK_KEYS ? names[sort] : "unknown";
+}
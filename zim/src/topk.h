@@ -0,0 +1,49 @@
+#ifndef ZIM_TOPK_H
+#define ZIM_TOPK_H
+
+#include <stdint.h>
+
+// Incrementally maintained top-K index over a large table of counters.
+// Entries live in a set-associative table (TOPK_WAYS per set, the least
+// recently updated entry outside the top lists is evicted first). For
+// every sort key a min-heap holds the TOPK_K largest entries, and each
+// entry remembers its position in the heaps, so an update costs
+// O(log K) and a sorted top list O(K log K), however many entries are
+// tracked.
+//
+// The rate key uses forward decay: each update adds bytes scaled by
+// e^(lambda * (t - landmark)), so scores only ever grow and the heaps
+// stay valid without touching idle entries. Dividing by the same factor
+// at read time gives an exponentially decayed byte rate. The landmark
+// moves forward (rescaling every entry once) before the factors get
+// large.
+#define TOPK_K 256
+#define TOPK_WAYS 4
+#define TOPK_HALF_LIFE_SEC 10  // Rate memory
+#define TOPK_RESCALE_SEC 600   // Landmark moves after this long
+
+// Sort keys
+#define TOPK_PACKETS 0
+#define TOPK_BYTES   1
+#define TOPK_RATE    2
+#define TOPK_KEYS    3
+
+typedef struct {
+    uint64_t key;
+    unsigned long packets;
+    unsigned long bytes;
+    double rate;  // Bytes per second, decayed to the newest update
+} TopKItem;
+
+typedef struct TopKIndex TopKIndex;
+
+// Function prototypes
+TopKIndex *topk_create(unsigned int capacity);
+void topk_free(TopKIndex *index);
+void topk_add(TopKIndex *index, uint64_t key, unsigned long bytes, uint64_t now_usec);
+void topk_seed(TopKIndex *index, uint64_t key, unsigned long packets, unsigned long bytes);
+int topk_list(const TopKIndex *index, int sort, TopKItem *items, int max);
+unsigned long topk_entries(const TopKIndex *index);
+const char *topk_key_name(int sort);
+
+#endif // ZIM_TOPK_H
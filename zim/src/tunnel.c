@@ -0,0 +1,224 @@
+#include <string.h>
+#include <netinet/in.h>
+#include "tunnel.h"
+#include "config.h"
+
+#define ETHER_HEADER_LEN 14
+#define VLAN_HEADER_LEN  4
+#define ETHERTYPE_IPV4   0x0800
+#define ETHERTYPE_VLAN   0x8100
+#define ETHERTYPE_TEB    0x6558  // Transparent Ethernet bridging
+
+// GRE flags (RFC 2784, RFC 2890)
+#define GRE_CHECKSUM 0x8000
+#define GRE_ROUTING  0x4000
+#define GRE_KEY      0x2000
+#define GRE_SEQUENCE 0x1000
+#define GRE_VERSION  0x0007
+
+#define VXLAN_HEADER_LEN  8
+#define VXLAN_FLAG_VNI    0x08
+#define GENEVE_HEADER_LEN 8
+
+static unsigned int get16(const unsigned char *p) {
+    return (p[0] << 8) | p[1];
+}
+
+static unsigned int get24(const unsigned char *p) {
+    return (p[0] << 16) | (p[1] << 8) | p[2];
+}
+
+static unsigned int get32(const unsigned char *p) {
+    return ((unsigned int)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+// Length of the IPv4 header at offset, 0 if there is none
+static unsigned int ipv4_header_len(const unsigned char *frame, unsigned int size, unsigned int offset) {
+    if (offset + 20 > size || (frame[offset] >> 4) != 4) {
+        return 0;
+    }
+    
+    unsigned int length = (frame[offset] & 0x0f) * 4;
+    if (length < 20 || offset + length > size) {
+        return 0;
+    }
+    
+    return length;
+}
+
+// Offset of the IPv4 header in an inner Ethernet frame, 0 if not IPv4
+static unsigned int inner_ethernet(const unsigned char *frame, unsigned int size, unsigned int offset) {
+    if (offset + ETHER_HEADER_LEN > size) {
+        return 0;
+    }
+    
+    unsigned int type = get16(frame + offset + 12);
+    offset += ETHER_HEADER_LEN;
+    if (type == ETHERTYPE_VLAN) {
+        if (offset + VLAN_HEADER_LEN > size) {
+            return 0;
+        }
+        type = get16(frame + offset + 2);
+        offset += VLAN_HEADER_LEN;
+    }
+    
+    return type == ETHERTYPE_IPV4 ? offset : 0;
+}
+
+static unsigned int decap_gre(const unsigned char *frame, unsigned int size, unsigned int offset,
+                              unsigned int *id) {
+    if (offset + 4 > size) {
+        return 0;
+    }
+    
+    unsigned int flags = get16(frame + offset);
+    unsigned int protocol = get16(frame + offset + 2);
+    unsigned int length = 4;
+    
+    // Source routing is obsolete; version 1 is PPTP
+    if (flags & (GRE_ROUTING | GRE_VERSION)) {
+        return 0;
+    }
+    if (flags & GRE_CHECKSUM) {
+        length += 4;
+    }
+    if (flags & GRE_KEY) {
+        if (offset + length + 4 > size) {
+            return 0;
+        }
+        *id = get32(frame + offset + length);
+        length += 4;
+    }
+    if (flags & GRE_SEQUENCE) {
+        length += 4;
+    }
+    
+    offset += length;
+    if (protocol == ETHERTYPE_IPV4) {
+        return offset;
+    }
+    if (protocol == ETHERTYPE_TEB) {
+        return inner_ethernet(frame, size, offset);
+    }
+    return 0;
+}
+
+static unsigned int decap_udp(const unsigned char *frame, unsigned int size, unsigned int offset,
+                              unsigned int *type, unsigned int *id) {
+    if (offset + 8 > size) {
+        return 0;
+    }
+    
+    unsigned int port = get16(frame + offset + 2);
+    offset += 8;
+    
+    if (port == TUNNEL_VXLAN_PORT) {
+        if (offset + VXLAN_HEADER_LEN > size || !(frame[offset] & VXLAN_FLAG_VNI)) {
+            return 0;
+        }
+        *type = TUNNEL_VXLAN;
+        *id = get24(frame + offset + 4);
+        return inner_ethernet(frame, size, offset + VXLAN_HEADER_LEN);
+    }
+    
+    if (port == TUNNEL_GENEVE_PORT) {
+        if (offset + GENEVE_HEADER_LEN > size || (frame[offset] >> 6) != 0) {
+            return 0;
+        }
+        unsigned int options = (frame[offset] & 0x3f) * 4;
+        unsigned int protocol = get16(frame + offset + 2);
+        
+        *type = TUNNEL_GENEVE;
+        *id = get24(frame + offset + 4);
+        offset += GENEVE_HEADER_LEN + options;
+        if (protocol == ETHERTYPE_IPV4) {
+            return offset;
+        }
+        if (protocol == ETHERTYPE_TEB) {
+            return inner_ethernet(frame, size, offset);
+        }
+    }
+    
+    return 0;
+}
+
+// Offset of the IPv4 header carried by the packet at ip_offset, or 0 if
+// it is not a tunnel (or the inner header is cut off). type and id are
+// set when a tunnel is found; id is the VXLAN or GENEVE VNI or the GRE
+// key, 0 if there is none.
+unsigned int tunnel_decap(const unsigned char *frame, unsigned int size, unsigned int ip_offset,
+                          unsigned int *type, unsigned int *id) {
+    unsigned int header_len = ipv4_header_len(frame, size, ip_offset);
+    unsigned int found = TUNNEL_NONE, key = 0, inner = 0;
+    
+    // Fragments other than a complete packet carry partial inner headers
+    if (header_len == 0 || (get16(frame + ip_offset + 6) & 0x3fff) != 0) {
+        return 0;
+    }
+    
+    unsigned int offset = ip_offset + header_len;
+    switch (frame[ip_offset + 9]) {
+        case IPPROTO_IPIP:
+            found = TUNNEL_IPIP;
+            inner = offset;
+            break;
+        case IPPROTO_GRE:
+            found = TUNNEL_GRE;
+            inner = decap_gre(frame, size, offset, &key);
+            break;
+        case PROTO_UDP:
+            inner = decap_udp(frame, size, offset, &found, &key);
+            break;
+        default:
+            return 0;
+    }
+    
+    if (inner == 0 || ipv4_header_len(frame, size, inner) == 0) {
+        return 0;
+    }
+    
+    *type = found;
+    *id = key;
+    return inner;
+}
+
+// Addresses, ports and protocol of every IPv4 layer of an Ethernet
+// frame, outermost first. Returns the number of layers filled in.
+int tunnel_layers(const unsigned char *frame, unsigned int size, TunnelLayer *layers, int max) {
+    unsigned int offset = ETHER_HEADER_LEN;
+    int count = 0;
+    
+    if (size < ETHER_HEADER_LEN + 20 || get16(frame + 12) != ETHERTYPE_IPV4) {
+        return 0;
+    }
+    
+    while (count < max) {
+        const unsigned char *ip = frame + offset;
+        unsigned int ihl = (ip[0] & 0x0f) * 4;
+        TunnelLayer *layer = &layers[count++];
+        
+        memset(layer, 0, sizeof(*layer));
+        layer->protocol = ip[9];
+        layer->src_addr = get32(ip + 12);
+        layer->dst_addr = get32(ip + 16);
+        if ((layer->protocol == PROTO_TCP || layer->protocol == PROTO_UDP) &&
+            offset + ihl + 4 <= size) {
+            layer->src_port = get16(ip + ihl);
+            layer->dst_port = get16(ip + ihl + 2);
+        }
+        
+        unsigned int type, id;
+        offset = tunnel_decap(frame, size, offset, &type, &id);
+        if (offset == 0) {
+            break;
+        }
+    }
+    
+    return count;
+}
+
+const char *tunnel_name(unsigned int type) {
+    static const char *names[TUNNEL_TYPES] = {"none", "gre", "vxlan", "geneve", "ipip"};
+    
+    return type < TUNNEL_TYPES ? names[type] : "unknown";
+}
@@ -0,0 +1,35 @@
+#ifndef ZIM_TUNNEL_H
+#define ZIM_TUNNEL_H
+
+// Tunnel decapsulation. Given the offset of an IPv4 header in a frame,
+// tunnel_decap() recognizes an encapsulated packet and returns the offset
+// of the inner IPv4 header, so the parser can start over from there.
+// Only IPv4 inner packets are followed, directly or inside an Ethernet
+// frame. Fragmented outer packets are not reassembled and stay opaque.
+#define TUNNEL_NONE   0
+#define TUNNEL_GRE    1
+#define TUNNEL_VXLAN  2
+#define TUNNEL_GENEVE 3
+#define TUNNEL_IPIP   4
+#define TUNNEL_TYPES  5
+
+#define TUNNEL_VXLAN_PORT  4789
+#define TUNNEL_GENEVE_PORT 6081
+#define TUNNEL_MAX_DEPTH   4  // Nested tunnels followed at most
+
+// One IPv4 layer of a frame
+typedef struct {
+    unsigned int src_addr;  // Host byte order
+    unsigned int dst_addr;
+    unsigned short src_port;
+    unsigned short dst_port;
+    unsigned int protocol;
+} TunnelLayer;
+
+// Function prototypes
+unsigned int tunnel_decap(const unsigned char *frame, unsigned int size, unsigned int ip_offset,
+                          unsigned int *type, unsigned int *id);
+int tunnel_layers(const unsigned char *frame, unsigned int size, TunnelLayer *layers, int max);
+const char *tunnel_name(unsigned int type);
+
+#endif // ZIM_TUNNEL_H
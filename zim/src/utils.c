@@ -1,6 +1,8 @@
 #include <stdio.h>
 #include <ctype.h>
 #include <string.h>
+#include <stdlib.h>
+#include <arpa/inet.h>
 #include "utils.h"
 
 void print_hex_dump(const unsigned char *data, int size) {
@@ -49,4 +51,58 @@ void format_bytes(unsigned long bytes, char *buffer, size_t buffer_size) {
     }
     
     snprintf(buffer, buffer_size, "%.2f %s", size, units[unit]);
+}
+
+// Accept epoch seconds, "YYYY-MM-DD HH:MM[:SS]" or "HH:MM[:SS]" (today, local time)
+int parse_time_spec(const char *spec, time_t *result) {
+    struct tm tm_info;
+    char *end;
+    int fields;
+    
+    long epoch = strtol(spec, &end, 10);
+    if (end != spec && *end == '\0') {
+        *result = epoch;
+        return 0;
+    }
+    
+    time_t now = time(NULL);
+    localtime_r(&now, &tm_info);
+    tm_info.tm_sec = 0;
+    
+    fields = sscanf(spec, "%d-%d-%d %d:%d:%d", &tm_info.tm_year, &tm_info.tm_mon,
+                    &tm_info.tm_mday, &tm_info.tm_hour, &tm_info.tm_min, &tm_info.tm_sec);
+    if (fields >= 5) {
+        tm_info.tm_year -= 1900;
+        tm_info.tm_mon -= 1;
+    } else {
+        localtime_r(&now, &tm_info);
+        tm_info.tm_sec = 0;
+        fields = sscanf(spec, "%d:%d:%d", &tm_info.tm_hour, &tm_info.tm_min, &tm_info.tm_sec);
+        if (fields < 2) {
+            return -1;
+        }
+    }
+    
+    tm_info.tm_isdst = -1;
+    *result = mktime(&tm_info);
+    return *result == (time_t)-1 ? -1 : 0;
+}
+
+// Dotted quad to a host byte order address
+int parse_ipv4(const char *str, unsigned int *addr) {
+    struct in_addr in;
+    
+    if (inet_pton(AF_INET, str, &in) != 1) {
+        return -1;
+    }
+    
+    *addr = ntohl(in.s_addr);
+    return 0;
+}
+
+void format_ipv4(unsigned int addr, char *buffer, size_t buffer_size) {
+    struct in_addr in;
+    
+    in.s_addr = htonl(addr);
+    inet_ntop(AF_INET, &in, buffer, buffer_size);
 }
\ No newline at end of file
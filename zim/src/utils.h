@@ -2,9 +2,13 @@
 #define ZIM_UTILS_H
 
 #include <sys/time.h>
+#include <time.h>
 
 // Utility function prototypes
 void print_hex_dump(const unsigned char *data, int size);
 void format_bytes(unsigned long bytes, char *buffer, size_t buffer_size);
+int parse_time_spec(const char *spec, time_t *result);
+int parse_ipv4(const char *str, unsigned int *addr);
+void format_ipv4(unsigned int addr, char *buffer, size_t buffer_size);
 
 #endif // ZIM_UTILS_H
\ No newline at end of file
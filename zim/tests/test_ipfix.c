@@ -0,0 +1,265 @@
+// Flow export test: runs the flow table and the IPFIX / NetFlow v9
+// exporter against a UDP listener on the loopback interface and decodes
+// the datagrams it receives.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include "flow.h"
+#include "ipfix.h"
+
+#define IPFIX_RECORD_LEN 66
+#define V9_RECORD_LEN 38
+
+static int failures = 0;
+
+#define CHECK(condition) do { \
+    if (!(condition)) { \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+        failures++; \
+    } \
+} while (0)
+
+static Packet packet;
+
+static unsigned int get16(const unsigned char *p) {
+    return (p[0] << 8) | p[1];
+}
+
+static uint32_t get32(const unsigned char *p) {
+    return ((uint32_t)get16(p) << 16) | get16(p + 2);
+}
+
+static uint64_t get64(const unsigned char *p) {
+    return ((uint64_t)get32(p) << 32) | get32(p + 4);
+}
+
+// Collector socket on 127.0.0.1; its port is written to port
+static int listen_udp(unsigned short *port) {
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    struct timeval timeout = {2, 0};
+    int sock_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    
+    if (sock_fd < 0) {
+        perror("socket");
+        return -1;
+    }
+    
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(sock_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        getsockname(sock_fd, (struct sockaddr *)&addr, &len) < 0) {
+        perror("bind");
+        close(sock_fd);
+        return -1;
+    }
+    setsockopt(sock_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    
+    *port = ntohs(addr.sin_port);
+    return sock_fd;
+}
+
+// Feed one synthetic packet to the flow table
+static void feed(unsigned int src, unsigned int dst, unsigned short src_port,
+                 unsigned short dst_port, unsigned int protocol, unsigned int tcp_flags,
+                 unsigned int size, uint64_t time_ms) {
+    memset(&packet, 0, sizeof(packet));
+    packet.timestamp.tv_sec = time_ms / 1000;
+    packet.timestamp.tv_usec = time_ms % 1000 * 1000;
+    packet.size = size;
+    packet.protocol = protocol;
+    packet.src_addr = src;
+    packet.dst_addr = dst;
+    packet.src_port = src_port;
+    packet.dst_port = dst_port;
+    packet.ip_header = (struct iphdr *)(packet.buffer + 14);
+    if (protocol == PROTO_TCP) {
+        packet.tcp_header = (struct tcphdr *)(packet.buffer + 34);
+        packet.buffer[34 + 13] = tcp_flags;
+    }
+    
+    flow_update(&packet);
+}
+
+// Send everything in the flow table, then receive the datagram
+static ssize_t export_all(int sock_fd, unsigned char *buffer, size_t size) {
+    flow_expire(0, 1);
+    ipfix_flush(1);
+    
+    return recv(sock_fd, buffer, size, 0);
+}
+
+// Check a template set: its header, template ID and field list
+static size_t check_template(const unsigned char *set, int version) {
+    unsigned int count = version == IPFIX_VERSION ? 15 : 10;
+    unsigned int expected[][2] = {
+        {IE_SOURCE_IPV4_ADDRESS, 4}, {IE_DESTINATION_IPV4_ADDRESS, 4},
+        {IE_SOURCE_TRANSPORT_PORT, 2}, {IE_DESTINATION_TRANSPORT_PORT, 2},
+        {IE_PROTOCOL_IDENTIFIER, 1}, {IE_TCP_CONTROL_BITS, 1},
+        {IE_PACKET_DELTA_COUNT, 8}, {IE_OCTET_DELTA_COUNT, 8},
+        {IE_FLOW_START_MILLISECONDS, 8}, {IE_FLOW_END_MILLISECONDS, 8},
+        {ZIM_IE_HANDSHAKE_RTT, 4}, {ZIM_IE_MEAN_RTT, 4}, {ZIM_IE_RETRANSMITS, 4},
+        {ZIM_IE_OUT_OF_ORDER, 4}, {ZIM_IE_ZERO_WINDOWS, 4},
+    };
+    const unsigned char *field = set + 8;
+    
+    if (version == NETFLOW_V9_VERSION) {
+        expected[8][0] = IE_V9_FIRST_SWITCHED;
+        expected[8][1] = 4;
+        expected[9][0] = IE_V9_LAST_SWITCHED;
+        expected[9][1] = 4;
+    }
+    
+    CHECK(get16(set) == (version == IPFIX_VERSION ? 2 : 0));
+    CHECK(get16(set + 4) == IPFIX_TEMPLATE_ID);
+    CHECK(get16(set + 6) == count);
+    for (unsigned int i = 0; i < count; i++) {
+        CHECK(get16(field) == expected[i][0]);
+        CHECK(get16(field + 2) == expected[i][1]);
+        if (expected[i][0] & IPFIX_ENTERPRISE_BIT) {
+            CHECK(get32(field + 4) == ZIM_ENTERPRISE_NUMBER);
+            field += 8;
+        } else {
+            field += 4;
+        }
+    }
+    CHECK(get16(set + 2) == (size_t)(field - set));
+    
+    return get16(set + 2);
+}
+
+// Find the record of the flow from src in a data set
+static const unsigned char *find_record(const unsigned char *records, unsigned int count,
+                                        size_t record_len, unsigned int src) {
+    for (unsigned int i = 0; i < count; i++) {
+        if (get32(records + i * record_len) == src) {
+            return records + i * record_len;
+        }
+    }
+    return NULL;
+}
+
+static void test_export(int version) {
+    unsigned char buffer[IPFIX_MAX_DATAGRAM];
+    size_t header_len = version == IPFIX_VERSION ? 16 : 20;
+    size_t record_len = version == IPFIX_VERSION ? IPFIX_RECORD_LEN : V9_RECORD_LEN;
+    char collector[32];
+    unsigned short port;
+    struct timeval now;
+    int sock_fd = listen_udp(&port);
+    
+    if (sock_fd < 0) {
+        failures++;
+        return;
+    }
+    snprintf(collector, sizeof(collector), "127.0.0.1:%u", port);
+    CHECK(ipfix_init(collector, version) == 0);
+    CHECK(flow_init(ipfix_export_flow) == 0);
+    
+    // Flow times lie after the exporter started, so v9 uptimes are not clamped
+    gettimeofday(&now, NULL);
+    uint64_t start = (uint64_t)now.tv_sec * 1000 + now.tv_usec / 1000 + 1000;
+    
+    // A TCP flow of three packets and a UDP flow of one
+    feed(0x0a000001, 0x0a000002, 1234, 80, PROTO_TCP, 0x02, 60, start);
+    feed(0x0a000001, 0x0a000002, 1234, 80, PROTO_TCP, 0x10, 1500, start + 10);
+    feed(0x0a000001, 0x0a000002, 1234, 80, PROTO_TCP, 0x11, 40, start + 25);
+    feed(0x0a000003, 0x0a000004, 53, 5353, PROTO_UDP, 0, 90, start + 5);
+    
+    ssize_t size = export_all(sock_fd, buffer, sizeof(buffer));
+    CHECK(size > 0);
+    if (size <= 0) {
+        goto done;
+    }
+    
+    // Header, then the template set, then the data set
+    CHECK(get16(buffer) == (unsigned int)version);
+    if (version == IPFIX_VERSION) {
+        CHECK(get16(buffer + 2) == size);
+        CHECK(get32(buffer + 8) == 0);
+    } else {
+        CHECK(get16(buffer + 2) == 3);  // Two records and the template
+        CHECK(get32(buffer + 12) == 0);
+    }
+    
+    size_t offset = header_len + check_template(buffer + header_len, version);
+    const unsigned char *set = buffer + offset;
+    size_t set_len = get16(set + 2);
+    CHECK(get16(set) == IPFIX_TEMPLATE_ID);
+    CHECK(offset + set_len == (size_t)size);
+    CHECK(set_len - 4 >= 2 * record_len && set_len - 4 < 2 * record_len + 4);
+    
+    const unsigned char *tcp = find_record(set + 4, 2, record_len, 0x0a000001);
+    const unsigned char *udp = find_record(set + 4, 2, record_len, 0x0a000003);
+    CHECK(tcp != NULL && udp != NULL);
+    if (tcp == NULL || udp == NULL) {
+        goto done;
+    }
+    
+    CHECK(get32(tcp + 4) == 0x0a000002);
+    CHECK(get16(tcp + 8) == 1234);
+    CHECK(get16(tcp + 10) == 80);
+    CHECK(tcp[12] == PROTO_TCP);
+    CHECK(tcp[13] == 0x13);
+    CHECK(get64(tcp + 14) == 3);
+    CHECK(get64(tcp + 22) == 1600);
+    
+    CHECK(get16(udp + 8) == 53);
+    CHECK(get16(udp + 10) == 5353);
+    CHECK(udp[12] == PROTO_UDP);
+    CHECK(udp[13] == 0);
+    CHECK(get64(udp + 14) == 1);
+    CHECK(get64(udp + 22) == 90);
+    
+    if (version == IPFIX_VERSION) {
+        CHECK(get64(tcp + 30) == start);
+        CHECK(get64(tcp + 38) == start + 25);
+        CHECK(get32(tcp + 46) == 0);  // No handshake RTT was measured
+    } else {
+        CHECK(get32(tcp + 34) - get32(tcp + 30) == 25);
+        CHECK(get32(udp + 30) - get32(tcp + 30) == 5);
+    }
+    
+    // The next datagram has no template, and its sequence number counts
+    // records (IPFIX) or datagrams (v9) sent before it
+    feed(0x0a000005, 0x0a000006, 4000, 443, PROTO_TCP, 0x02, 60, start + 30);
+    size = export_all(sock_fd, buffer, sizeof(buffer));
+    CHECK(size > 0);
+    if (size <= 0) {
+        goto done;
+    }
+    
+    CHECK(get16(buffer + header_len) == IPFIX_TEMPLATE_ID);
+    if (version == IPFIX_VERSION) {
+        CHECK(get32(buffer + 8) == 2);
+        CHECK((size_t)size == header_len + 4 + record_len);
+    } else {
+        CHECK(get16(buffer + 2) == 1);
+        CHECK(get32(buffer + 12) == 1);
+        CHECK((size_t)size == header_len + 4 + ((record_len + 3) & ~3UL));
+    }
+    CHECK(get32(buffer + header_len + 4) == 0x0a000005);
+    CHECK(ipfix_records_sent() >= 3);
+
+done:
+    flow_cleanup();
+    ipfix_cleanup();
+    close(sock_fd);
+}
+
+int main(void) {
+    test_export(IPFIX_VERSION);
+    test_export(NETFLOW_V9_VERSION);
+    
+    if (failures > 0) {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+    printf("Flow export tests passed\n");
+    return 0;
+}